@@ -0,0 +1,310 @@
+//
+// Compile time benchmark of OpenCL drivers.
+//
+// Builds each kernel of the corpus several times on every device with
+// MUDADeviceOCL::loadKernelSource(), reports median, p95 and standard
+// deviation of the build time, and compares them with a baseline file.
+//
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "clew.h"
+
+#include "muda_runtime.h"
+#include "timerutil.h"
+#include "bench_stats.h"
+#include "OptionParser.h"
+
+namespace {
+
+const char *kDefaultCorpus[] = {
+    "bench/corpus/raytrace.cl", "bench/corpus/templated.cl",
+    "bench/corpus/small_kernels.cl",
+};
+
+struct BaselineEntry {
+  double median;
+  double stddev;
+};
+
+struct BenchResult {
+  std::string device; // Device name. Key of the baseline.
+  std::string driver;
+  std::string kernel; // Basename of the kernel file.
+  bool success;
+  oclc::SampleStats stats;
+};
+
+void usage(const char *prog) {
+  printf("Usage: %s <options> [kernel.cl ...]\n", prog);
+  printf("  Benchmarks clBuildProgram time of the kernels on every device.\n");
+  printf("  Without kernels, the corpus in bench/corpus is used(run from the\n");
+  printf("  top directory of oclc).\n");
+  printf("\n");
+  printf("  <options>\n");
+  printf("\n");
+  printf("  --iterations=N      Timed builds per kernel and device. default: 5\n");
+  printf("  --warmup=N          Untimed builds before timing. default: 1\n");
+  printf("  --platform=N        Benchmark only the platform.\n");
+  printf("  --device=N          Benchmark only the device(with --platform).\n");
+  printf("  --clopt=STRING      Compiler options for OpenCL compiler.\n");
+  printf("  --no-nonce          Do not add unique -D to each build. Drivers\n");
+  printf("                      which cache binaries will then hit the cache.\n");
+  printf("  --baseline=FILE     Compare with the baseline and flag regressions.\n");
+  printf("  --save-baseline=FILE  Write the results as a new baseline.\n");
+  printf("  --threshold=PCT     Regression threshold of median. default: 10\n");
+}
+
+std::string basename(const std::string &path) {
+  size_t pos = path.find_last_of("/\\");
+  return (pos == std::string::npos) ? path : path.substr(pos + 1);
+}
+
+// Baseline file is tab separated:
+// device, kernel, median_ms, p95_ms, stddev_ms, driver
+bool readBaseline(const std::string &filename,
+                  std::map<std::string, BaselineEntry> *baseline) {
+  std::ifstream ifs(filename.c_str());
+  if (!ifs) {
+    return false;
+  }
+
+  std::string line;
+  while (std::getline(ifs, line)) {
+    if (line.empty() || (line[0] == '#')) {
+      continue;
+    }
+    std::vector<std::string> cols;
+    std::stringstream ss(line);
+    std::string col;
+    while (std::getline(ss, col, '\t')) {
+      cols.push_back(col);
+    }
+    if (cols.size() < 5) {
+      continue;
+    }
+    BaselineEntry e;
+    e.median = atof(cols[2].c_str());
+    e.stddev = atof(cols[4].c_str());
+    (*baseline)[cols[0] + "\t" + cols[1]] = e;
+  }
+
+  return true;
+}
+
+bool writeBaseline(const std::string &filename,
+                   const std::vector<BenchResult> &results) {
+  FILE *fp = fopen(filename.c_str(), "w");
+  if (!fp) {
+    return false;
+  }
+
+  fprintf(fp, "# oclc compile benchmark baseline\n");
+  fprintf(fp, "# device\tkernel\tmedian_ms\tp95_ms\tstddev_ms\tdriver\n");
+  for (size_t i = 0; i < results.size(); i++) {
+    const BenchResult &r = results[i];
+    if (!r.success) {
+      continue;
+    }
+    fprintf(fp, "%s\t%s\t%.3f\t%.3f\t%.3f\t%s\n", r.device.c_str(),
+            r.kernel.c_str(), r.stats.median, r.stats.p95, r.stats.stddev,
+            r.driver.c_str());
+  }
+
+  return (fclose(fp) == 0);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  optparse::OptionParser parser = optparse::OptionParser();
+
+  parser.add_option("--iterations")
+      .action("store")
+      .type("int")
+      .set_default(5)
+      .dest("iterations");
+  parser.add_option("--warmup")
+      .action("store")
+      .type("int")
+      .set_default(1)
+      .dest("warmup");
+  parser.add_option("--platform").action("store").type("int").dest("platform");
+  parser.add_option("--device").action("store").type("int").dest("device");
+  parser.add_option("--clopt").action("store").type("string").dest("clopt");
+  parser.add_option("--no-nonce").action("store_true").dest("no_nonce");
+  parser.add_option("--baseline").action("store").dest("baseline");
+  parser.add_option("--save-baseline").action("store").dest("save_baseline");
+  parser.add_option("--threshold")
+      .action("store")
+      .type("float")
+      .set_default(10)
+      .dest("threshold");
+  parser.add_option("--usage").action("store_true").dest("usage");
+
+  optparse::Values &options = parser.parse_args(argc, argv);
+  std::vector<std::string> kernels = parser.args();
+
+  if ((bool)options.get("usage")) {
+    usage(argv[0]);
+    return 0;
+  }
+
+  if (kernels.empty()) {
+    for (size_t i = 0; i < sizeof(kDefaultCorpus) / sizeof(kDefaultCorpus[0]);
+         i++) {
+      kernels.push_back(kDefaultCorpus[i]);
+    }
+  }
+
+  int iterations = std::max((int)options.get("iterations"), 1);
+  int warmup = std::max((int)options.get("warmup"), 0);
+  double threshold = (double)options.get("threshold");
+  bool useNonce = !(bool)options.get("no_nonce");
+
+  std::map<std::string, BaselineEntry> baseline;
+  if (options.is_set("baseline")) {
+    if (!readBaseline(options["baseline"], &baseline)) {
+      std::cerr << "Failed to read baseline: " << options["baseline"]
+                << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (clewInit() != CLEW_SUCCESS) {
+    std::cerr << "Failed to find OpenCL device." << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  int numPlatforms = muda::MUDADeviceOCL::getNumPlatforms();
+  if (numPlatforms < 1) {
+    std::cerr << "No OpenCL platform found." << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  // Each build gets a unique macro definition, so that drivers which cache
+  // compiled binaries(keyed by source and options) actually compile.
+  unsigned long long nonce = (unsigned long long)time(NULL) * 1000;
+
+  std::vector<BenchResult> results;
+  int numRegressions = 0;
+  int numFailed = 0;
+
+  for (int p = 0; p < numPlatforms; p++) {
+    if (options.is_set("platform") && (p != (int)options.get("platform"))) {
+      continue;
+    }
+
+    muda::MUDADeviceOCL device(muda::ocl_cpu);
+    if (!device.initializeAllDevices(p, false)) {
+      printf("platform %d: failed to create context\n", p);
+      continue;
+    }
+
+    for (int d = 0; d < device.getNumDevices(); d++) {
+      if (options.is_set("device") && (d != (int)options.get("device"))) {
+        continue;
+      }
+
+      std::string deviceName = device.getDeviceName(d);
+      std::string driver = device.getDriverVersion(d);
+      printf("\nplatform %d device %d: %s / %s (driver %s)\n", p, d,
+             device.getPlatformName().c_str(), deviceName.c_str(),
+             driver.c_str());
+      printf("  %-24s %10s %10s %10s %12s %8s\n", "kernel", "median(ms)",
+             "p95(ms)", "stddev(ms)", "baseline(ms)", "change");
+
+      for (size_t k = 0; k < kernels.size(); k++) {
+        BenchResult r;
+        r.device = deviceName;
+        r.driver = driver;
+        r.kernel = basename(kernels[k]);
+        r.success = true;
+
+        std::vector<double> samples;
+        std::string log;
+        for (int i = 0; (i < warmup + iterations) && r.success; i++) {
+          std::string clopt = options["clopt"];
+          if (useNonce) {
+            std::stringstream ss;
+            ss << "-D OCLC_BENCH_NONCE=" << (nonce++) << " " << clopt;
+            clopt = ss.str();
+          }
+
+          timerutil::timerutil timer;
+          muda::MUDAProgram prog = device.loadKernelSource(
+              kernels[k].c_str(), 0, NULL, clopt.c_str(), &log, d);
+          timer.end();
+
+          if (!prog) {
+            r.success = false;
+            break;
+          }
+          device.releaseProgram(prog);
+
+          if (i >= warmup) {
+            samples.push_back(timer.elapsed());
+          }
+        }
+
+        if (!r.success) {
+          numFailed++;
+          printf("  %-24s FAILED\n%s\n", r.kernel.c_str(), log.c_str());
+          results.push_back(r);
+          continue;
+        }
+
+        r.stats = oclc::computeSampleStats(samples);
+        results.push_back(r);
+
+        printf("  %-24s %10.2f %10.2f %10.2f", r.kernel.c_str(),
+               r.stats.median, r.stats.p95, r.stats.stddev);
+
+        std::map<std::string, BaselineEntry>::iterator it =
+            baseline.find(r.device + "\t" + r.kernel);
+        if (it == baseline.end()) {
+          printf("\n");
+          continue;
+        }
+
+        const BaselineEntry &b = it->second;
+        double change = (b.median > 0.0)
+                            ? 100.0 * (r.stats.median - b.median) / b.median
+                            : 0.0;
+        printf(" %12.2f %+7.1f%%", b.median, change);
+
+        // Changes within noise of the baseline are not regressions.
+        if ((change > threshold) &&
+            (r.stats.median - b.median > 2.0 * b.stddev)) {
+          printf("  REGRESSION");
+          numRegressions++;
+        }
+        printf("\n");
+      }
+    }
+  }
+
+  if (options.is_set("save_baseline")) {
+    if (!writeBaseline(options["save_baseline"], results)) {
+      std::cerr << "Failed to write baseline: " << options["save_baseline"]
+                << std::endl;
+      return EXIT_FAILURE;
+    }
+    printf("\nBaseline written to %s\n", options["save_baseline"].c_str());
+  }
+
+  if (numRegressions > 0) {
+    printf("\n%d regression(s) over %.1f%% found.\n", numRegressions,
+           threshold);
+  }
+
+  return ((numRegressions > 0) || (numFailed > 0)) ? EXIT_FAILURE : 0;
+}
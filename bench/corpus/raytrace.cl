@@ -0,0 +1,472 @@
+//
+// Compile benchmark corpus: large path tracing kernel.
+// Long function bodies, deep inlining and many live variables stress the
+// optimizer and register allocator of the driver.
+//
+
+#define EPS 1.0e-4f
+#define PI 3.14159265358979f
+#define INV_PI 0.318309886183791f
+#define MAX_STACK 64
+#define MAX_DEPTH 8
+
+typedef struct {
+  float4 bmin; // w = left child or first primitive
+  float4 bmax; // w = right child or # of primitives(negative for leaf)
+} BVHNode;
+
+typedef struct {
+  float4 v0;
+  float4 e1;
+  float4 e2;
+  float4 n; // w = material id
+} Triangle;
+
+typedef struct {
+  float4 diffuse;  // w = roughness
+  float4 specular; // w = ior
+  float4 emission; // w = type
+} Material;
+
+typedef struct {
+  float3 org;
+  float3 dir;
+  float3 invDir;
+  float tmin;
+  float tmax;
+} Ray;
+
+typedef struct {
+  float t;
+  float u;
+  float v;
+  int prim;
+} Hit;
+
+typedef struct {
+  uint s0;
+  uint s1;
+  uint s2;
+  uint s3;
+} RNG;
+
+//
+// Random number generator(xorshift128).
+//
+inline uint rngNext(RNG *rng) {
+  uint t = rng->s0 ^ (rng->s0 << 11);
+  rng->s0 = rng->s1;
+  rng->s1 = rng->s2;
+  rng->s2 = rng->s3;
+  rng->s3 = (rng->s3 ^ (rng->s3 >> 19)) ^ (t ^ (t >> 8));
+  return rng->s3;
+}
+
+inline float rngFloat(RNG *rng) {
+  return (float)(rngNext(rng) >> 8) * (1.0f / 16777216.0f);
+}
+
+inline void rngInit(RNG *rng, uint seed, uint pixel) {
+  uint h = seed * 0x9E3779B9u ^ pixel * 0x85EBCA6Bu;
+  h ^= h >> 16;
+  h *= 0x7FEB352Du;
+  h ^= h >> 15;
+  h *= 0x846CA68Bu;
+  h ^= h >> 16;
+  rng->s0 = h | 1u;
+  rng->s1 = h * 1664525u + 1013904223u;
+  rng->s2 = rng->s1 * 1664525u + 1013904223u;
+  rng->s3 = rng->s2 * 1664525u + 1013904223u;
+}
+
+//
+// Sampling.
+//
+inline void orthoBasis(float3 n, float3 *t, float3 *b) {
+  float sign = (n.z >= 0.0f) ? 1.0f : -1.0f;
+  float a = -1.0f / (sign + n.z);
+  float c = n.x * n.y * a;
+  *t = (float3)(1.0f + sign * n.x * n.x * a, sign * c, -sign * n.x);
+  *b = (float3)(c, sign + n.y * n.y * a, -n.y);
+}
+
+inline float3 sampleCosineHemisphere(float u0, float u1, float3 n) {
+  float r = sqrt(u0);
+  float phi = 2.0f * PI * u1;
+  float x = r * cos(phi);
+  float y = r * sin(phi);
+  float z = sqrt(fmax(0.0f, 1.0f - u0));
+  float3 t, b;
+  orthoBasis(n, &t, &b);
+  return normalize(x * t + y * b + z * n);
+}
+
+inline float3 sampleGGX(float u0, float u1, float alpha, float3 n) {
+  float phi = 2.0f * PI * u0;
+  float cosTheta = sqrt((1.0f - u1) / (1.0f + (alpha * alpha - 1.0f) * u1));
+  float sinTheta = sqrt(fmax(0.0f, 1.0f - cosTheta * cosTheta));
+  float3 t, b;
+  orthoBasis(n, &t, &b);
+  return normalize(sinTheta * cos(phi) * t + sinTheta * sin(phi) * b +
+                   cosTheta * n);
+}
+
+inline float ggxD(float ndoth, float alpha) {
+  float a2 = alpha * alpha;
+  float d = ndoth * ndoth * (a2 - 1.0f) + 1.0f;
+  return a2 / (PI * d * d + EPS);
+}
+
+inline float smithG1(float ndotv, float alpha) {
+  float a2 = alpha * alpha;
+  return 2.0f * ndotv / (ndotv + sqrt(a2 + (1.0f - a2) * ndotv * ndotv));
+}
+
+inline float fresnelSchlick(float cosTheta, float f0) {
+  float m = clamp(1.0f - cosTheta, 0.0f, 1.0f);
+  float m2 = m * m;
+  return f0 + (1.0f - f0) * m2 * m2 * m;
+}
+
+inline float fresnelDielectric(float cosi, float eta) {
+  float sint2 = eta * eta * fmax(0.0f, 1.0f - cosi * cosi);
+  if (sint2 >= 1.0f) {
+    return 1.0f;
+  }
+  float cost = sqrt(1.0f - sint2);
+  float rs = (cosi - eta * cost) / (cosi + eta * cost);
+  float rp = (eta * cosi - cost) / (eta * cosi + cost);
+  return 0.5f * (rs * rs + rp * rp);
+}
+
+//
+// Intersection.
+//
+inline bool intersectAABB(const Ray *ray, float4 bmin, float4 bmax,
+                          float *tnear) {
+  float3 t0 = (bmin.xyz - ray->org) * ray->invDir;
+  float3 t1 = (bmax.xyz - ray->org) * ray->invDir;
+  float3 tmin3 = fmin(t0, t1);
+  float3 tmax3 = fmax(t0, t1);
+  float tmin = fmax(fmax(tmin3.x, tmin3.y), fmax(tmin3.z, ray->tmin));
+  float tmax = fmin(fmin(tmax3.x, tmax3.y), fmin(tmax3.z, ray->tmax));
+  *tnear = tmin;
+  return tmin <= tmax;
+}
+
+inline bool intersectTriangle(const Ray *ray, __global const Triangle *tri,
+                              Hit *hit, int prim) {
+  float3 e1 = tri->e1.xyz;
+  float3 e2 = tri->e2.xyz;
+  float3 p = cross(ray->dir, e2);
+  float det = dot(e1, p);
+  if (fabs(det) < 1.0e-12f) {
+    return false;
+  }
+  float invDet = 1.0f / det;
+  float3 s = ray->org - tri->v0.xyz;
+  float u = dot(s, p) * invDet;
+  if ((u < 0.0f) || (u > 1.0f)) {
+    return false;
+  }
+  float3 q = cross(s, e1);
+  float v = dot(ray->dir, q) * invDet;
+  if ((v < 0.0f) || (u + v > 1.0f)) {
+    return false;
+  }
+  float t = dot(e2, q) * invDet;
+  if ((t < ray->tmin) || (t > hit->t)) {
+    return false;
+  }
+  hit->t = t;
+  hit->u = u;
+  hit->v = v;
+  hit->prim = prim;
+  return true;
+}
+
+bool traverse(Ray *ray, __global const BVHNode *nodes,
+              __global const Triangle *tris, __global const int *primIndices,
+              Hit *hit, bool anyHit) {
+  int stack[MAX_STACK];
+  int sp = 0;
+  stack[sp++] = 0;
+
+  hit->t = ray->tmax;
+  hit->prim = -1;
+
+  while (sp > 0) {
+    int idx = stack[--sp];
+    BVHNode node = nodes[idx];
+
+    float tnear;
+    if (!intersectAABB(ray, node.bmin, node.bmax, &tnear)) {
+      continue;
+    }
+    if (tnear > hit->t) {
+      continue;
+    }
+
+    int count = as_int(node.bmax.w);
+    if (count < 0) {
+      // Leaf.
+      int first = as_int(node.bmin.w);
+      for (int i = 0; i < -count; i++) {
+        int prim = primIndices[first + i];
+        if (intersectTriangle(ray, &tris[prim], hit, prim)) {
+          if (anyHit) {
+            return true;
+          }
+          ray->tmax = hit->t;
+        }
+      }
+    } else {
+      int left = as_int(node.bmin.w);
+      int right = count;
+      // Visit nearer child first.
+      BVHNode l = nodes[left];
+      BVHNode r = nodes[right];
+      float3 cl = 0.5f * (l.bmin.xyz + l.bmax.xyz) - ray->org;
+      float3 cr = 0.5f * (r.bmin.xyz + r.bmax.xyz) - ray->org;
+      if (sp + 2 > MAX_STACK) {
+        break;
+      }
+      if (dot(cl, ray->dir) < dot(cr, ray->dir)) {
+        stack[sp++] = right;
+        stack[sp++] = left;
+      } else {
+        stack[sp++] = left;
+        stack[sp++] = right;
+      }
+    }
+  }
+
+  return hit->prim >= 0;
+}
+
+inline void setupRay(Ray *ray, float3 org, float3 dir) {
+  ray->org = org;
+  ray->dir = dir;
+  ray->invDir = (float3)(1.0f / (fabs(dir.x) > 1.0e-8f ? dir.x : 1.0e-8f),
+                         1.0f / (fabs(dir.y) > 1.0e-8f ? dir.y : 1.0e-8f),
+                         1.0f / (fabs(dir.z) > 1.0e-8f ? dir.z : 1.0e-8f));
+  ray->tmin = EPS;
+  ray->tmax = 1.0e+30f;
+}
+
+//
+// Light sampling.
+//
+float3 sampleLights(float3 p, float3 n, __global const Triangle *tris,
+                    __global const Material *materials,
+                    __global const int *lights, int numLights,
+                    __global const BVHNode *nodes,
+                    __global const int *primIndices, RNG *rng) {
+  if (numLights == 0) {
+    return (float3)(0.0f);
+  }
+
+  int li = min((int)(rngFloat(rng) * numLights), numLights - 1);
+  __global const Triangle *tri = &tris[lights[li]];
+
+  float u0 = rngFloat(rng);
+  float u1 = rngFloat(rng);
+  if (u0 + u1 > 1.0f) {
+    u0 = 1.0f - u0;
+    u1 = 1.0f - u1;
+  }
+
+  float3 lp = tri->v0.xyz + u0 * tri->e1.xyz + u1 * tri->e2.xyz;
+  float3 ln = tri->n.xyz;
+  float area = 0.5f * length(cross(tri->e1.xyz, tri->e2.xyz));
+
+  float3 d = lp - p;
+  float dist2 = dot(d, d);
+  float dist = sqrt(dist2);
+  d /= dist;
+
+  float cosL = -dot(d, ln);
+  float cosS = dot(d, n);
+  if ((cosL <= 0.0f) || (cosS <= 0.0f)) {
+    return (float3)(0.0f);
+  }
+
+  Ray shadow;
+  setupRay(&shadow, p + n * EPS, d);
+  shadow.tmax = dist - 2.0f * EPS;
+  Hit h;
+  if (traverse(&shadow, nodes, tris, primIndices, &h, true)) {
+    return (float3)(0.0f);
+  }
+
+  int mat = (int)tri->n.w;
+  float pdf = dist2 / (cosL * area * numLights);
+  return materials[mat].emission.xyz * cosS * INV_PI / pdf;
+}
+
+//
+// Path tracing.
+//
+float3 radiance(Ray ray, __global const BVHNode *nodes,
+                __global const Triangle *tris, __global const int *primIndices,
+                __global const Material *materials, __global const int *lights,
+                int numLights, __read_only image2d_t envmap, sampler_t smp,
+                RNG *rng) {
+  float3 L = (float3)(0.0f);
+  float3 throughput = (float3)(1.0f);
+  bool specularBounce = true;
+
+  for (int depth = 0; depth < MAX_DEPTH; depth++) {
+    Hit hit;
+    if (!traverse(&ray, nodes, tris, primIndices, &hit, false)) {
+      // Environment.
+      float3 d = ray.dir;
+      float u = 0.5f + atan2(d.x, -d.z) * (0.5f * INV_PI);
+      float v = acos(clamp(d.y, -1.0f, 1.0f)) * INV_PI;
+      float4 env = read_imagef(envmap, smp, (float2)(u, v));
+      L += throughput * env.xyz;
+      break;
+    }
+
+    __global const Triangle *tri = &tris[hit.prim];
+    Material mat = materials[(int)tri->n.w];
+    float3 p = ray.org + hit.t * ray.dir;
+    float3 n = tri->n.xyz;
+    if (dot(n, ray.dir) > 0.0f) {
+      n = -n;
+    }
+
+    if (specularBounce) {
+      L += throughput * mat.emission.xyz;
+    }
+
+    int type = (int)mat.emission.w;
+    float3 wo = -ray.dir;
+    float3 wi;
+
+    if (type == 0) {
+      // Lambert.
+      L += throughput * mat.diffuse.xyz *
+           sampleLights(p, n, tris, materials, lights, numLights, nodes,
+                        primIndices, rng);
+      wi = sampleCosineHemisphere(rngFloat(rng), rngFloat(rng), n);
+      throughput *= mat.diffuse.xyz;
+      specularBounce = false;
+    } else if (type == 1) {
+      // GGX microfacet.
+      float alpha = fmax(mat.diffuse.w * mat.diffuse.w, 1.0e-3f);
+      float3 h = sampleGGX(rngFloat(rng), rngFloat(rng), alpha, n);
+      wi = 2.0f * dot(wo, h) * h - wo;
+      float ndotl = dot(n, wi);
+      float ndotv = dot(n, wo);
+      float ndoth = dot(n, h);
+      float vdoth = dot(wo, h);
+      if ((ndotl <= 0.0f) || (ndotv <= 0.0f)) {
+        break;
+      }
+      float F = fresnelSchlick(vdoth, mat.specular.x);
+      float G = smithG1(ndotl, alpha) * smithG1(ndotv, alpha);
+      float D = ggxD(ndoth, alpha);
+      float pdf = D * ndoth / (4.0f * vdoth + EPS);
+      float brdf = F * G * D / (4.0f * ndotl * ndotv + EPS);
+      throughput *= mat.specular.xyz * brdf * ndotl / (pdf + EPS);
+      specularBounce = alpha < 0.05f;
+    } else if (type == 2) {
+      // Dielectric.
+      float ior = mat.specular.w;
+      bool entering = dot(tri->n.xyz, ray.dir) < 0.0f;
+      float eta = entering ? (1.0f / ior) : ior;
+      float cosi = dot(wo, n);
+      float F = fresnelDielectric(cosi, eta);
+      if (rngFloat(rng) < F) {
+        wi = 2.0f * cosi * n - wo;
+      } else {
+        float k = 1.0f - eta * eta * (1.0f - cosi * cosi);
+        wi = normalize(-eta * wo + (eta * cosi - sqrt(fmax(k, 0.0f))) * n);
+        n = -n;
+      }
+      throughput *= mat.specular.xyz;
+      specularBounce = true;
+    } else {
+      break;
+    }
+
+    // Russian roulette.
+    if (depth >= 3) {
+      float q = fmax(0.05f, 1.0f - fmax(throughput.x,
+                                         fmax(throughput.y, throughput.z)));
+      if (rngFloat(rng) < q) {
+        break;
+      }
+      throughput /= (1.0f - q);
+    }
+
+    setupRay(&ray, p + n * EPS, wi);
+  }
+
+  return L;
+}
+
+__kernel void render(__global float4 *accum, __global const BVHNode *nodes,
+                     __global const Triangle *tris,
+                     __global const int *primIndices,
+                     __global const Material *materials,
+                     __global const int *lights, int numLights,
+                     __read_only image2d_t envmap, int width, int height,
+                     float4 eye, float4 lookat, float4 up, float fov,
+                     uint frame, int spp) {
+  int x = get_global_id(0);
+  int y = get_global_id(1);
+  if ((x >= width) || (y >= height)) {
+    return;
+  }
+
+  const sampler_t smp =
+      CLK_NORMALIZED_COORDS_TRUE | CLK_ADDRESS_REPEAT | CLK_FILTER_LINEAR;
+
+  RNG rng;
+  rngInit(&rng, frame, (uint)(y * width + x));
+
+  float3 w = normalize(lookat.xyz - eye.xyz);
+  float3 u = normalize(cross(w, up.xyz));
+  float3 v = cross(u, w);
+  float scale = tan(0.5f * fov * PI / 180.0f);
+  float aspect = (float)width / (float)height;
+
+  float3 sum = (float3)(0.0f);
+  for (int s = 0; s < spp; s++) {
+    float px = ((float)x + rngFloat(&rng)) / (float)width * 2.0f - 1.0f;
+    float py = 1.0f - ((float)y + rngFloat(&rng)) / (float)height * 2.0f;
+    float3 dir = normalize(w + px * scale * aspect * u + py * scale * v);
+
+    Ray ray;
+    setupRay(&ray, eye.xyz, dir);
+    sum += radiance(ray, nodes, tris, primIndices, materials, lights,
+                    numLights, envmap, smp, &rng);
+  }
+
+  float4 prev = accum[y * width + x];
+  float4 cur = (float4)(sum / (float)spp, 1.0f);
+  accum[y * width + x] = (frame == 0) ? cur : (prev + cur);
+}
+
+__kernel void tonemap(__global const float4 *accum, __global uchar4 *out,
+                      int width, int height, float exposure) {
+  int x = get_global_id(0);
+  int y = get_global_id(1);
+  if ((x >= width) || (y >= height)) {
+    return;
+  }
+
+  float4 c = accum[y * width + x];
+  float3 rgb = c.xyz / fmax(c.w, 1.0f) * exposure;
+
+  // ACES filmic approximation.
+  rgb = (rgb * (2.51f * rgb + 0.03f)) / (rgb * (2.43f * rgb + 0.59f) + 0.14f);
+  rgb = clamp(rgb, 0.0f, 1.0f);
+  rgb = pow(rgb, (float3)(1.0f / 2.2f));
+
+  out[y * width + x] = (uchar4)((uchar)(rgb.x * 255.0f + 0.5f),
+                                (uchar)(rgb.y * 255.0f + 0.5f),
+                                (uchar)(rgb.z * 255.0f + 0.5f), 255);
+}
@@ -0,0 +1,200 @@
+//
+// Compile benchmark corpus: many small, independent kernels.
+// Per-kernel overhead of the driver dominates the build time.
+//
+
+__kernel void fill(__global float *x, float v, int n) {
+  int i = get_global_id(0);
+  if (i < n) {
+    x[i] = v;
+  }
+}
+
+__kernel void copy(__global const float *x, __global float *y, int n) {
+  int i = get_global_id(0);
+  if (i < n) {
+    y[i] = x[i];
+  }
+}
+
+__kernel void saxpy(float a, __global const float *x, __global float *y,
+                    int n) {
+  int i = get_global_id(0);
+  if (i < n) {
+    y[i] = a * x[i] + y[i];
+  }
+}
+
+__kernel void scale(__global float *x, float s, int n) {
+  int i = get_global_id(0);
+  if (i < n) {
+    x[i] *= s;
+  }
+}
+
+__kernel void iota(__global int *x, int start, int n) {
+  int i = get_global_id(0);
+  if (i < n) {
+    x[i] = start + i;
+  }
+}
+
+__kernel void gather(__global const float *x, __global const int *idx,
+                     __global float *y, int n) {
+  int i = get_global_id(0);
+  if (i < n) {
+    y[i] = x[idx[i]];
+  }
+}
+
+__kernel void scatter(__global const float *x, __global const int *idx,
+                      __global float *y, int n) {
+  int i = get_global_id(0);
+  if (i < n) {
+    y[idx[i]] = x[i];
+  }
+}
+
+__kernel void clamp01(__global float *x, int n) {
+  int i = get_global_id(0);
+  if (i < n) {
+    x[i] = clamp(x[i], 0.0f, 1.0f);
+  }
+}
+
+__kernel void abs_diff(__global const float *x, __global const float *y,
+                       __global float *z, int n) {
+  int i = get_global_id(0);
+  if (i < n) {
+    z[i] = fabs(x[i] - y[i]);
+  }
+}
+
+__kernel void histogram256(__global const uchar *x, __global uint *hist,
+                           int n) {
+  int i = get_global_id(0);
+  if (i < n) {
+    atomic_inc(&hist[x[i]]);
+  }
+}
+
+__kernel void rgba_to_gray(__global const uchar4 *rgba, __global uchar *gray,
+                           int n) {
+  int i = get_global_id(0);
+  if (i < n) {
+    float4 c = convert_float4(rgba[i]);
+    gray[i] = convert_uchar_sat(0.299f * c.x + 0.587f * c.y + 0.114f * c.z);
+  }
+}
+
+__kernel void normalize3(__global float4 *v, int n) {
+  int i = get_global_id(0);
+  if (i < n) {
+    float4 a = v[i];
+    v[i] = (float4)(normalize(a.xyz), a.w);
+  }
+}
+
+__kernel void dot4(__global const float4 *x, __global const float4 *y,
+                   __global float *z, int n) {
+  int i = get_global_id(0);
+  if (i < n) {
+    z[i] = dot(x[i], y[i]);
+  }
+}
+
+__kernel void copy2d(__global const float *src, int srcPitch,
+                     __global float *dst, int dstPitch, int width,
+                     int height) {
+  int x = get_global_id(0);
+  int y = get_global_id(1);
+  if ((x < width) && (y < height)) {
+    dst[y * dstPitch + x] = src[y * srcPitch + x];
+  }
+}
+
+__kernel void bitonic_step(__global float *x, int j, int k) {
+  int i = get_global_id(0);
+  int ixj = i ^ j;
+  if (ixj > i) {
+    float a = x[i];
+    float b = x[ixj];
+    bool up = ((i & k) == 0);
+    if ((a > b) == up) {
+      x[i] = b;
+      x[ixj] = a;
+    }
+  }
+}
+
+__kernel void mandelbrot(__global uchar *out, int width, int height,
+                         int maxIter) {
+  int px = get_global_id(0);
+  int py = get_global_id(1);
+  if ((px >= width) || (py >= height)) {
+    return;
+  }
+  float cx = 3.0f * px / width - 2.0f;
+  float cy = 2.0f * py / height - 1.0f;
+  float x = 0.0f;
+  float y = 0.0f;
+  int i = 0;
+  while ((i < maxIter) && (x * x + y * y < 4.0f)) {
+    float t = x * x - y * y + cx;
+    y = 2.0f * x * y + cy;
+    x = t;
+    i++;
+  }
+  out[py * width + px] = (uchar)(255 * i / maxIter);
+}
+
+__kernel void box3x3(__global const float *in, __global float *out, int width,
+                     int height) {
+  int x = get_global_id(0);
+  int y = get_global_id(1);
+  if ((x >= width) || (y >= height)) {
+    return;
+  }
+  float sum = 0.0f;
+  for (int dy = -1; dy <= 1; dy++) {
+    for (int dx = -1; dx <= 1; dx++) {
+      int sx = clamp(x + dx, 0, width - 1);
+      int sy = clamp(y + dy, 0, height - 1);
+      sum += in[sy * width + sx];
+    }
+  }
+  out[y * width + x] = sum / 9.0f;
+}
+
+__kernel void count_nonzero(__global const int *x, __global int *count,
+                            int n) {
+  int i = get_global_id(0);
+  if ((i < n) && (x[i] != 0)) {
+    atomic_inc(count);
+  }
+}
+
+__kernel void morton2d(__global const ushort2 *p, __global uint *code, int n) {
+  int i = get_global_id(0);
+  if (i >= n) {
+    return;
+  }
+  uint x = p[i].x;
+  uint y = p[i].y;
+  x = (x | (x << 8)) & 0x00FF00FFu;
+  x = (x | (x << 4)) & 0x0F0F0F0Fu;
+  x = (x | (x << 2)) & 0x33333333u;
+  x = (x | (x << 1)) & 0x55555555u;
+  y = (y | (y << 8)) & 0x00FF00FFu;
+  y = (y | (y << 4)) & 0x0F0F0F0Fu;
+  y = (y | (y << 2)) & 0x33333333u;
+  y = (y | (y << 1)) & 0x55555555u;
+  code[i] = x | (y << 1);
+}
+
+__kernel void softplus(__global const float *x, __global float *y, int n) {
+  int i = get_global_id(0);
+  if (i < n) {
+    y[i] = log1p(exp(x[i]));
+  }
+}
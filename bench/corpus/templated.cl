@@ -0,0 +1,126 @@
+//
+// Compile benchmark corpus: kernels "templated" by macros.
+// A few macro definitions expand to many kernels, which stresses the
+// preprocessor and the number of functions the driver compiles.
+//
+
+#define TYPES(X)                                                               \
+  X(float)                                                                     \
+  X(int)                                                                       \
+  X(uint)                                                                      \
+  X(short)                                                                     \
+  X(uchar)
+
+#define OPS(X, T)                                                              \
+  X(T, add, (a + b))                                                           \
+  X(T, sub, (a - b))                                                           \
+  X(T, mul, (a * b))                                                           \
+  X(T, max, (a > b ? a : b))                                                   \
+  X(T, min, (a < b ? a : b))
+
+// Elementwise binary operation.
+#define DEFINE_BINARY(T, NAME, EXPR)                                           \
+  __kernel void NAME##_##T(__global const T *x, __global const T *y,           \
+                           __global T *z, int n) {                             \
+    int i = get_global_id(0);                                                  \
+    if (i < n) {                                                               \
+      T a = x[i];                                                              \
+      T b = y[i];                                                              \
+      z[i] = EXPR;                                                             \
+    }                                                                          \
+  }
+
+// Work-group reduction with local memory.
+#define DEFINE_REDUCE(T, NAME, EXPR)                                           \
+  __kernel void reduce_##NAME##_##T(__global const T *x, __global T *out,      \
+                                    __local T *scratch, int n) {               \
+    int gid = get_global_id(0);                                                \
+    int lid = get_local_id(0);                                                 \
+    int lsize = get_local_size(0);                                             \
+    scratch[lid] = (gid < n) ? x[gid] : x[0];                                  \
+    barrier(CLK_LOCAL_MEM_FENCE);                                              \
+    for (int s = lsize / 2; s > 0; s >>= 1) {                                  \
+      if (lid < s) {                                                           \
+        T a = scratch[lid];                                                    \
+        T b = scratch[lid + s];                                                \
+        scratch[lid] = EXPR;                                                   \
+      }                                                                        \
+      barrier(CLK_LOCAL_MEM_FENCE);                                            \
+    }                                                                          \
+    if (lid == 0) {                                                            \
+      out[get_group_id(0)] = scratch[0];                                       \
+    }                                                                          \
+  }
+
+// Inclusive scan within a work-group(Hillis-Steele).
+#define DEFINE_SCAN(T)                                                         \
+  __kernel void scan_##T(__global const T *x, __global T *y,                   \
+                         __local T *scratch, int n) {                          \
+    int gid = get_global_id(0);                                                \
+    int lid = get_local_id(0);                                                 \
+    int lsize = get_local_size(0);                                             \
+    scratch[lid] = (gid < n) ? x[gid] : (T)0;                                  \
+    barrier(CLK_LOCAL_MEM_FENCE);                                              \
+    for (int off = 1; off < lsize; off <<= 1) {                                \
+      T v = (lid >= off) ? scratch[lid - off] : (T)0;                          \
+      barrier(CLK_LOCAL_MEM_FENCE);                                            \
+      scratch[lid] += v;                                                       \
+      barrier(CLK_LOCAL_MEM_FENCE);                                            \
+    }                                                                          \
+    if (gid < n) {                                                             \
+      y[gid] = scratch[lid];                                                   \
+    }                                                                          \
+  }
+
+// Tiled matrix transpose.
+#define DEFINE_TRANSPOSE(T, TILE)                                              \
+  __kernel void transpose_##T##_##TILE(__global const T *in, __global T *out,  \
+                                       int width, int height) {                \
+    __local T tile[TILE][TILE + 1];                                            \
+    int x = get_group_id(0) * TILE + get_local_id(0);                          \
+    int y = get_group_id(1) * TILE + get_local_id(1);                          \
+    if ((x < width) && (y < height)) {                                         \
+      tile[get_local_id(1)][get_local_id(0)] = in[y * width + x];              \
+    }                                                                          \
+    barrier(CLK_LOCAL_MEM_FENCE);                                              \
+    x = get_group_id(1) * TILE + get_local_id(0);                              \
+    y = get_group_id(0) * TILE + get_local_id(1);                              \
+    if ((x < height) && (y < width)) {                                         \
+      out[y * height + x] = tile[get_local_id(0)][get_local_id(1)];            \
+    }                                                                          \
+  }
+
+// 1D convolution with unrolled taps.
+#define TAP(i) acc += w[i] * x[clamp(gid + (i)-R, 0, n - 1)];
+#define TAPS3 TAP(0) TAP(1) TAP(2)
+#define TAPS5 TAPS3 TAP(3) TAP(4)
+#define TAPS9 TAPS5 TAP(5) TAP(6) TAP(7) TAP(8)
+#define TAPS17                                                                 \
+  TAPS9 TAP(9) TAP(10) TAP(11) TAP(12) TAP(13) TAP(14) TAP(15) TAP(16)
+
+#define DEFINE_CONV(N, RADIUS)                                                 \
+  __kernel void conv##N(__global const float *x, __constant float *w,          \
+                        __global float *y, int n) {                            \
+    const int R = RADIUS;                                                      \
+    int gid = get_global_id(0);                                                \
+    if (gid >= n) {                                                            \
+      return;                                                                  \
+    }                                                                          \
+    float acc = 0.0f;                                                          \
+    TAPS##N y[gid] = acc;                                                      \
+  }
+
+#define DEFINE_ALL_BINARY(T) OPS(DEFINE_BINARY, T)
+#define DEFINE_ALL_REDUCE(T) OPS(DEFINE_REDUCE, T)
+#define DEFINE_TRANSPOSES(T)                                                   \
+  DEFINE_TRANSPOSE(T, 8) DEFINE_TRANSPOSE(T, 16) DEFINE_TRANSPOSE(T, 32)
+
+TYPES(DEFINE_ALL_BINARY)
+TYPES(DEFINE_ALL_REDUCE)
+TYPES(DEFINE_SCAN)
+TYPES(DEFINE_TRANSPOSES)
+
+DEFINE_CONV(3, 1)
+DEFINE_CONV(5, 2)
+DEFINE_CONV(9, 4)
+DEFINE_CONV(17, 8)
@@ -0,0 +1,62 @@
+//
+// Summary statistics of benchmark samples.
+//
+#ifndef OCLC_BENCH_STATS_H
+#define OCLC_BENCH_STATS_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace oclc {
+
+struct SampleStats {
+  double median;
+  double p95; // Nearest-rank 95th percentile.
+  double mean;
+  double stddev; // Sample standard deviation.
+  double min;
+  double max;
+
+  SampleStats()
+      : median(0.0), p95(0.0), mean(0.0), stddev(0.0), min(0.0), max(0.0) {}
+};
+
+//  Function: computeSampleStats
+//  Returns statistics of `samples`(all zero when empty).
+inline SampleStats computeSampleStats(std::vector<double> samples) {
+  SampleStats s;
+  if (samples.empty()) {
+    return s;
+  }
+
+  std::sort(samples.begin(), samples.end());
+  size_t n = samples.size();
+
+  s.median = (n % 2) ? samples[n / 2]
+                     : 0.5 * (samples[n / 2 - 1] + samples[n / 2]);
+
+  size_t rank = size_t(std::ceil(0.95 * double(n)));
+  s.p95 = samples[std::max(rank, size_t(1)) - 1];
+
+  s.min = samples[0];
+  s.max = samples[n - 1];
+
+  double sum = 0.0;
+  for (size_t i = 0; i < n; i++) {
+    sum += samples[i];
+  }
+  s.mean = sum / double(n);
+
+  double var = 0.0;
+  for (size_t i = 0; i < n; i++) {
+    var += (samples[i] - s.mean) * (samples[i] - s.mean);
+  }
+  s.stddev = (n > 1) ? std::sqrt(var / double(n - 1)) : 0.0;
+
+  return s;
+}
+
+} // namespace oclc
+
+#endif // OCLC_BENCH_STATS_H
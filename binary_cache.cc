@@ -0,0 +1,446 @@
+//
+// Persistent on-disk cache of compiled kernel binaries.
+//
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <direct.h>
+#include <process.h>
+#include <sys/utime.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#include <utime.h>
+#endif
+
+#include "binary_cache.h"
+
+namespace oclc {
+
+namespace {
+
+const char kEntryMagic[8] = {'O', 'C', 'L', 'C', 'B', 'I', 'N', '1'};
+const char *kEntrySuffix = ".bin";
+const size_t kEntryHeaderSize = 8 + sizeof(unsigned long long);
+
+// Evict down to this ratio of the size limit, so that eviction does not run
+// on every store once the cache is full.
+const double kEvictLowWatermark = 0.9;
+
+// Temporary files older than this are left over from killed processes.
+const double kStaleTempFileSec = 3600.0;
+
+std::atomic<unsigned int> gTempFileCounter(0);
+
+struct EntryInfo {
+  std::string path;
+  unsigned long long size;
+  double mtime; // sec
+};
+
+bool olderFirst(const EntryInfo &a, const EntryInfo &b) {
+  return a.mtime < b.mtime;
+}
+
+bool endsWith(const std::string &s, const std::string &suffix) {
+  return (s.size() >= suffix.size()) &&
+         (s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0);
+}
+
+int currentPid() {
+#ifdef _WIN32
+  return _getpid();
+#else
+  return int(getpid());
+#endif
+}
+
+#ifndef _WIN32
+// Use sub-second precision when available, so that LRU order of entries
+// stored within the same second is kept.
+double mtimeOf(const struct stat &st) {
+#if defined(__APPLE__)
+  return double(st.st_mtimespec.tv_sec) + st.st_mtimespec.tv_nsec * 1.0e-9;
+#elif defined(__linux__)
+  return double(st.st_mtim.tv_sec) + st.st_mtim.tv_nsec * 1.0e-9;
+#else
+  return double(st.st_mtime);
+#endif
+}
+#endif
+
+// Lists regular files in `dir`.
+void listFiles(const std::string &dir, std::vector<EntryInfo> *entries) {
+#ifdef _WIN32
+  WIN32_FIND_DATAA data;
+  HANDLE h = FindFirstFileA((dir + "\\*").c_str(), &data);
+  if (h == INVALID_HANDLE_VALUE) {
+    return;
+  }
+  do {
+    if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+      continue;
+    }
+    std::string path = dir + "/" + data.cFileName;
+    struct _stat st;
+    if (_stat(path.c_str(), &st) == 0) {
+      EntryInfo e;
+      e.path = path;
+      e.size = (unsigned long long)st.st_size;
+      e.mtime = double(st.st_mtime);
+      entries->push_back(e);
+    }
+  } while (FindNextFileA(h, &data));
+  FindClose(h);
+#else
+  DIR *d = opendir(dir.c_str());
+  if (!d) {
+    return;
+  }
+  struct dirent *ent;
+  while ((ent = readdir(d)) != NULL) {
+    std::string path = dir + "/" + ent->d_name;
+    struct stat st;
+    if ((stat(path.c_str(), &st) == 0) && S_ISREG(st.st_mode)) {
+      EntryInfo e;
+      e.path = path;
+      e.size = (unsigned long long)st.st_size;
+      e.mtime = mtimeOf(st);
+      entries->push_back(e);
+    }
+  }
+  closedir(d);
+#endif
+}
+
+// Returns size of the file, or 0 when it does not exist.
+unsigned long long fileSize(const std::string &path) {
+#ifdef _WIN32
+  struct _stat st;
+  if (_stat(path.c_str(), &st) != 0) {
+    return 0;
+  }
+#else
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    return 0;
+  }
+#endif
+  return (unsigned long long)st.st_size;
+}
+
+bool renameFile(const std::string &from, const std::string &to) {
+#ifdef _WIN32
+  return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+  return (rename(from.c_str(), to.c_str()) == 0);
+#endif
+}
+
+// Size index holds the total bytes of entries as a decimal number. It is
+// only accessed under the lock. Returns false when it is missing or broken.
+bool readSizeIndex(const std::string &path, unsigned long long *total) {
+  FILE *fp = fopen(path.c_str(), "rb");
+  if (!fp) {
+    return false;
+  }
+  bool ok = (fscanf(fp, "%llu", total) == 1);
+  fclose(fp);
+  return ok;
+}
+
+void writeSizeIndex(const std::string &path, unsigned long long total) {
+  FILE *fp = fopen(path.c_str(), "wb");
+  if (!fp) {
+    return;
+  }
+  fprintf(fp, "%llu\n", total);
+  fclose(fp);
+}
+
+// Exclusive inter-process lock held while it is alive.
+class FileLock {
+public:
+  explicit FileLock(const std::string &path) {
+#ifdef _WIN32
+    handle = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE,
+                         FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_ALWAYS,
+                         FILE_ATTRIBUTE_NORMAL, NULL);
+    locked = false;
+    if (handle != INVALID_HANDLE_VALUE) {
+      OVERLAPPED ov;
+      memset(&ov, 0, sizeof(ov));
+      locked = LockFileEx(handle, LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &ov) != 0;
+    }
+#else
+    fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    locked = false;
+    if (fd >= 0) {
+      while (flock(fd, LOCK_EX) != 0) {
+        if (errno != EINTR) {
+          return;
+        }
+      }
+      locked = true;
+    }
+#endif
+  }
+
+  ~FileLock() {
+#ifdef _WIN32
+    if (handle != INVALID_HANDLE_VALUE) {
+      if (locked) {
+        OVERLAPPED ov;
+        memset(&ov, 0, sizeof(ov));
+        UnlockFileEx(handle, 0, 1, 0, &ov);
+      }
+      CloseHandle(handle);
+    }
+#else
+    if (fd >= 0) {
+      if (locked) {
+        flock(fd, LOCK_UN);
+      }
+      close(fd);
+    }
+#endif
+  }
+
+  bool isLocked() const { return locked; }
+
+private:
+#ifdef _WIN32
+  HANDLE handle;
+#else
+  int fd;
+#endif
+  bool locked;
+};
+
+// FNV-1a 64bit.
+unsigned long long fnv1a(unsigned long long h, const void *data, size_t len) {
+  const unsigned char *p = reinterpret_cast<const unsigned char *>(data);
+  for (size_t i = 0; i < len; i++) {
+    h ^= (unsigned long long)p[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+// Finalizer of MurmurHash3. Spreads FNV state to all output bits.
+unsigned long long fmix64(unsigned long long k) {
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdULL;
+  k ^= k >> 33;
+  k *= 0xc4ceb9fe1a85ec53ULL;
+  k ^= k >> 33;
+  return k;
+}
+
+} // namespace
+
+BinaryCache::BinaryCache(const std::string &dir, unsigned long long maxBytes)
+    : dir(dir), maxBytes(maxBytes) {}
+
+bool BinaryCache::initialize() {
+#ifdef _WIN32
+  int ret = _mkdir(dir.c_str());
+#else
+  int ret = mkdir(dir.c_str(), 0755);
+#endif
+  if ((ret != 0) && (errno != EEXIST)) {
+    return false;
+  }
+  return true;
+}
+
+std::string BinaryCache::computeKey(const std::vector<std::string> &parts) {
+  // Two FNV-1a streams with different offset basis give 128bit key.
+  // Each part is prefixed by its length so that part boundaries matter.
+  unsigned long long h0 = 14695981039346656037ULL;
+  unsigned long long h1 = 0x6c62272e07bb0142ULL;
+  for (size_t i = 0; i < parts.size(); i++) {
+    unsigned long long len = parts[i].size();
+    h0 = fnv1a(h0, &len, sizeof(len));
+    h1 = fnv1a(h1, &len, sizeof(len));
+    h0 = fnv1a(h0, parts[i].data(), parts[i].size());
+    h1 = fnv1a(h1, parts[i].data(), parts[i].size());
+    h1 = fnv1a(h1, &h0, sizeof(h0));
+  }
+
+  h0 = fmix64(h0);
+  h1 = fmix64(h1);
+
+  char buf[40];
+  snprintf(buf, sizeof(buf), "%016llx%016llx", h0, h1);
+  return std::string(buf);
+}
+
+std::string BinaryCache::entryPath(const std::string &key) const {
+  return dir + "/" + key + kEntrySuffix;
+}
+
+bool BinaryCache::lookup(const std::string &key, std::vector<char> *binary) {
+  std::string path = entryPath(key);
+
+  // No lock is required. Entries are replaced by atomic rename, and an
+  // entry unlinked by eviction stays readable while it is open.
+  FILE *fp = fopen(path.c_str(), "rb");
+  if (!fp) {
+    return false;
+  }
+
+  char magic[8];
+  unsigned long long size = 0;
+  bool ok = (fread(magic, 1, 8, fp) == 8) &&
+            (memcmp(magic, kEntryMagic, 8) == 0) &&
+            (fread(&size, sizeof(size), 1, fp) == 1) && (size > 0) &&
+            (size < (1ULL << 32));
+  if (ok) {
+    binary->resize(size_t(size));
+    ok = (fread(&binary->at(0), 1, size_t(size), fp) == size_t(size));
+  }
+  fclose(fp);
+
+  if (!ok) {
+    binary->clear();
+    return false;
+  }
+
+  // Update LRU timestamp.
+#ifdef _WIN32
+  _utime(path.c_str(), NULL);
+#else
+  utime(path.c_str(), NULL);
+#endif
+
+  return true;
+}
+
+bool BinaryCache::store(const std::string &key,
+                        const std::vector<char> &binary) {
+  if (binary.empty()) {
+    return false;
+  }
+
+  char suffix[64];
+  snprintf(suffix, sizeof(suffix), ".tmp.%d.%u", currentPid(),
+           gTempFileCounter.fetch_add(1));
+  std::string tmpPath = dir + "/" + key + suffix;
+
+  FILE *fp = fopen(tmpPath.c_str(), "wb");
+  if (!fp) {
+    return false;
+  }
+
+  unsigned long long size = binary.size();
+  bool ok = (fwrite(kEntryMagic, 1, 8, fp) == 8) &&
+            (fwrite(&size, sizeof(size), 1, fp) == 1) &&
+            (fwrite(&binary.at(0), 1, binary.size(), fp) == binary.size());
+  ok = (fclose(fp) == 0) && ok;
+
+  if (!ok) {
+    ::remove(tmpPath.c_str());
+    return false;
+  }
+
+  std::string path = entryPath(key);
+  if (maxBytes == 0) {
+    // Unlimited. No size accounting is required.
+    ok = renameFile(tmpPath, path);
+  } else {
+    FileLock lock(dir + "/lock");
+    unsigned long long replaced = fileSize(path);
+    ok = renameFile(tmpPath, path);
+    if (ok && lock.isLocked()) {
+      updateSize(kEntryHeaderSize + binary.size(), replaced);
+    }
+  }
+
+  if (!ok) {
+    ::remove(tmpPath.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+void BinaryCache::remove(const std::string &key) {
+  std::string path = entryPath(key);
+  if (maxBytes == 0) {
+    ::remove(path.c_str());
+    return;
+  }
+
+  FileLock lock(dir + "/lock");
+  unsigned long long removed = fileSize(path);
+  if ((::remove(path.c_str()) == 0) && lock.isLocked()) {
+    updateSize(0, removed);
+  }
+}
+
+void BinaryCache::updateSize(unsigned long long added,
+                             unsigned long long removed) {
+  std::string indexPath = dir + "/size";
+
+  unsigned long long total;
+  if (readSizeIndex(indexPath, &total)) {
+    total = (total + added > removed) ? (total + added - removed) : 0;
+  } else {
+    total = maxBytes + 1; // Rebuild the index by scanning the directory.
+  }
+
+  if (total > maxBytes) {
+    total = evict();
+  }
+
+  writeSizeIndex(indexPath, total);
+}
+
+unsigned long long BinaryCache::evict() {
+  std::vector<EntryInfo> files;
+  listFiles(dir, &files);
+
+  time_t now = time(NULL);
+  std::vector<EntryInfo> entries;
+  unsigned long long total = 0;
+  for (size_t i = 0; i < files.size(); i++) {
+    if (endsWith(files[i].path, kEntrySuffix)) {
+      entries.push_back(files[i]);
+      total += files[i].size;
+    } else if ((files[i].path.find(".tmp.") != std::string::npos) &&
+               (double(now) - files[i].mtime > kStaleTempFileSec)) {
+      ::remove(files[i].path.c_str());
+    }
+  }
+
+  if (total <= maxBytes) {
+    return total;
+  }
+
+  std::sort(entries.begin(), entries.end(), olderFirst);
+
+  unsigned long long target =
+      (unsigned long long)(double(maxBytes) * kEvictLowWatermark);
+  for (size_t i = 0; (i < entries.size()) && (total > target); i++) {
+    if (::remove(entries[i].path.c_str()) == 0) {
+      total -= entries[i].size;
+    }
+  }
+
+  return total;
+}
+
+} // namespace oclc
@@ -0,0 +1,70 @@
+//
+// Persistent on-disk cache of compiled kernel binaries.
+//
+#ifndef OCLC_BINARY_CACHE_H
+#define OCLC_BINARY_CACHE_H
+
+#include <string>
+#include <vector>
+
+namespace oclc {
+
+// Cache entries are stored as `<dir>/<key>.bin`, where key is a hash of
+// everything which affects the compiled binary(source, headers, compiler
+// options, device name and driver version). A driver update changes the key,
+// so stale entries are never hit and are eventually evicted.
+//
+// The cache can be shared by concurrent oclc processes:
+//  - entries are written to a temporary file and then renamed, so readers
+//    never see a partially written entry.
+//  - eviction is serialized by a lock file(`<dir>/lock`).
+//  - total size of entries is kept in `<dir>/size` under the lock, so the
+//    directory is scanned only when the total exceeds the limit(or the index
+//    is missing).
+//  - LRU order is maintained by file modification time, which is updated on
+//    every hit.
+class BinaryCache {
+public:
+  BinaryCache(const std::string &dir, unsigned long long maxBytes);
+
+  //  Function: initialize
+  //  Creates cache directory when it does not exist.
+  bool initialize();
+
+  //  Function: computeKey
+  //  Returns hex string of 128bit hash of `parts`.
+  static std::string computeKey(const std::vector<std::string> &parts);
+
+  //  Function: lookup
+  //  Returns true and fills `binary` when the entry exists.
+  bool lookup(const std::string &key, std::vector<char> *binary);
+
+  //  Function: store
+  //  Stores entry atomically, then evicts least recently used entries when
+  //  the cache exceeds the size limit.
+  bool store(const std::string &key, const std::vector<char> &binary);
+
+  //  Function: remove
+  //  Removes entry(e.g. the driver rejected the cached binary).
+  void remove(const std::string &key);
+
+  const std::string &directory() const { return dir; }
+
+private:
+  std::string entryPath(const std::string &key) const;
+
+  // Adds to the size index, and evicts when it exceeds the limit. Called
+  // with the lock held.
+  void updateSize(unsigned long long added, unsigned long long removed);
+
+  // Scans the directory and evicts least recently used entries. Returns
+  // total bytes of remaining entries. Called with the lock held.
+  unsigned long long evict();
+
+  std::string dir;
+  unsigned long long maxBytes;
+};
+
+} // namespace oclc
+
+#endif // OCLC_BINARY_CACHE_H
@@ -0,0 +1,265 @@
+//
+// Compile job used by oclc driver.
+//
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#include "compile_job.h"
+#include "binary_cache.h"
+#include "include_scanner.h"
+#include "include_vfs.h"
+#include "timerutil.h"
+
+namespace oclc {
+
+bool readfile(const std::string &path, std::string *content) {
+  FILE *fp = fopen(path.c_str(), "rb");
+  if (!fp) {
+    return false;
+  }
+
+  content->clear();
+  char buf[65536];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+    content->append(buf, n);
+  }
+  // e.g. `path` is a directory.
+  bool ret = (ferror(fp) == 0);
+  fclose(fp);
+
+  return ret;
+}
+
+bool writefile(const std::string &path, const std::vector<char> &data) {
+  FILE *fp = fopen(path.c_str(), "wb");
+  if (!fp) {
+    return false;
+  }
+
+  size_t n = 0;
+  if (!data.empty()) {
+    n = fwrite(&data.at(0), 1, data.size(), fp);
+  }
+  fclose(fp);
+
+  return (n == data.size());
+}
+
+std::string moduleFilename(const std::string &input,
+                           const std::string &outdir) {
+  if (outdir.empty()) {
+    return input + ".clbin";
+  }
+
+  std::string basename = input;
+  size_t pos = input.find_last_of("/\\");
+  if (pos != std::string::npos) {
+    basename = input.substr(pos + 1);
+  }
+
+  std::string dir = outdir;
+  if (dir[dir.size() - 1] != '/' && dir[dir.size() - 1] != '\\') {
+    dir += "/";
+  }
+
+  return dir + basename + ".clbin";
+}
+
+std::string computeCompileKey(muda::MUDADeviceOCL *device, int deviceID,
+                              const CompileOptions &options,
+                              const std::string &source,
+                              const std::vector<std::string> *depContents) {
+  std::vector<std::string> parts;
+  parts.push_back(source);
+  parts.push_back(options.clopt);
+  for (size_t i = 0; i < options.headers.size(); i++) {
+    parts.push_back(options.headers[i]);
+  }
+  if (depContents) {
+    for (size_t i = 0; i < depContents->size(); i++) {
+      parts.push_back((*depContents)[i]);
+    }
+  }
+  parts.push_back(device->getPlatformName());
+  parts.push_back(device->getPlatformVersion());
+  parts.push_back(device->getDeviceName(deviceID));
+  parts.push_back(device->getDriverVersion(deviceID));
+
+  return BinaryCache::computeKey(parts);
+}
+
+bool compileSource(muda::MUDADeviceOCL *device, int deviceID,
+                   const std::string &source, const CompileOptions &options,
+                   CompileResult *result, std::vector<char> *binary,
+                   const std::vector<std::string> *depContents) {
+  std::string key;
+  if (options.cache) {
+    key = computeCompileKey(device, deviceID, options, source, depContents);
+
+    std::vector<char> bins;
+    if (options.cache->lookup(key, &bins)) {
+      muda::MUDAProgram prog = device->loadKernelBinary(
+          reinterpret_cast<const unsigned char *>(&bins.at(0)), bins.size(),
+          &result->log, deviceID);
+      if (prog) {
+        device->releaseProgram(prog);
+        if (binary) {
+          binary->swap(bins);
+        }
+        result->cached = true;
+        result->success = true;
+        return true;
+      }
+
+      // Driver rejected the binary. Rebuild from source.
+      options.cache->remove(key);
+      result->log.clear();
+    }
+  }
+
+  std::vector<const char *> headers;
+  for (size_t i = 0; i < options.headers.size(); i++) {
+    headers.push_back(options.headers[i].c_str());
+  }
+
+  muda::MUDAProgram prog = device->loadKernelSourceString(
+      source.c_str(), source.size(), int(headers.size()),
+      headers.empty() ? NULL : &headers.at(0), options.clopt.c_str(),
+      &result->log, deviceID);
+
+  if (!prog) {
+    return false;
+  }
+
+  if (binary || options.cache) {
+    std::vector<char> bins;
+    bool ret = device->getModule(prog, bins);
+    device->releaseProgram(prog);
+
+    if (!ret || bins.empty()) {
+      result->log += "Failed to get kernel module.\n";
+      return false;
+    }
+
+    if (options.cache) {
+      options.cache->store(key, bins);
+    }
+
+    if (binary) {
+      binary->swap(bins);
+    }
+  } else {
+    device->releaseProgram(prog);
+  }
+
+  result->success = true;
+  return true;
+}
+
+muda::MUDAProgram buildProgram(muda::MUDADeviceOCL *device,
+                               const std::string &input,
+                               const CompileOptions &options,
+                               std::string *log) {
+  std::string source;
+  bool ret = options.vfs ? options.vfs->expand(input, options.includeDirs,
+                                               &source, NULL)
+                         : readfile(input, &source);
+  if (!ret) {
+    (*log) = "Failed to open file: " + input + "\n";
+    return NULL;
+  }
+
+  std::vector<const char *> headers;
+  for (size_t i = 0; i < options.headers.size(); i++) {
+    headers.push_back(options.headers[i].c_str());
+  }
+
+  return device->loadKernelSourceString(
+      source.c_str(), source.size(), int(headers.size()),
+      headers.empty() ? NULL : &headers.at(0), options.clopt.c_str(), log);
+}
+
+static bool runCompileJobImpl(muda::MUDADeviceOCL *device,
+                              const CompileJob &job,
+                              const CompileOptions &options,
+                              CompileResult *result) {
+  std::string source;
+  std::vector<std::string> deps;
+  std::vector<std::string> depContents;
+
+  timerutil::timerutil timer;
+
+  if (options.vfs) {
+    // Included files are inlined, so they are part of the source(and the
+    // cache key).
+    bool ret =
+        options.vfs->expand(job.input, options.includeDirs, &source, &deps);
+    timer.end();
+    device->addProfile("readSource", timer.elapsed());
+    if (!ret) {
+      result->log = "Failed to open file: " + job.input + "\n";
+      return false;
+    }
+  } else {
+    bool ret = readfile(job.input, &source);
+    timer.end();
+    device->addProfile("readSource", timer.elapsed());
+    if (!ret) {
+      result->log = "Failed to open file: " + job.input + "\n";
+      return false;
+    }
+
+    // Included files are scanned for the dependency file, and for the cache
+    // key since the driver resolves #include by itself.
+    if (!job.depFile.empty() || options.cache) {
+      scanIncludes(job.input, options.includeDirs, &deps, &depContents);
+    }
+  }
+
+  std::vector<char> bins;
+  if (!compileSource(device, job.deviceID, source, options, result,
+                     options.module ? &bins : NULL, &depContents)) {
+    return false;
+  }
+
+  if (options.module && !writefile(job.moduleFile, bins)) {
+    result->log += "Failed to write kernel module: " + job.moduleFile + "\n";
+    result->success = false;
+    return false;
+  }
+
+  if (!job.depFile.empty()) {
+    // Dependency file is written only on success, so that a failed input is
+    // rebuilt next time.
+    deps.insert(deps.begin(), job.input);
+    deps.insert(deps.begin() + 1, options.headerFiles.begin(),
+                options.headerFiles.end());
+    std::string target = options.module ? job.moduleFile : job.depFile;
+    if (!writeDepfile(job.depFile, target, deps)) {
+      result->log += "Failed to write dependency file: " + job.depFile + "\n";
+      result->success = false;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool runCompileJob(muda::MUDADeviceOCL *device, const CompileJob &job,
+                   const CompileOptions &options, CompileResult *result) {
+  result->success = false;
+  result->log.clear();
+
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  bool ret = runCompileJobImpl(device, job, options, result);
+  result->msec = std::chrono::duration<double, std::milli>(
+                     std::chrono::steady_clock::now() - start)
+                     .count();
+
+  return ret;
+}
+
+} // namespace oclc
@@ -0,0 +1,101 @@
+//
+// Compile job used by oclc driver.
+//
+#ifndef OCLC_COMPILE_JOB_H
+#define OCLC_COMPILE_JOB_H
+
+#include <string>
+#include <vector>
+
+#include "muda_runtime.h"
+
+namespace oclc {
+
+class BinaryCache;
+class IncludeVFS;
+
+// Options shared by all compile jobs in a run.
+struct CompileOptions {
+  std::string clopt;                // Compiler options passed to the driver.
+  std::vector<std::string> headers; // Contents of --header files.
+  std::vector<std::string> headerFiles; // Paths of --header files.
+  std::vector<std::string> includeDirs; // Search paths of #include(-I).
+  bool module;                      // Extract and write kernel module.
+  bool verbose;
+  BinaryCache *cache;               // Compiled binary cache. NULL = disabled.
+  IncludeVFS *vfs; // Inline #include from the VFS. NULL = driver reads them.
+
+  CompileOptions() : module(false), verbose(false), cache(NULL), vfs(NULL) {}
+};
+
+// One input kernel file.
+struct CompileJob {
+  std::string input;      // Path to .cl file.
+  std::string moduleFile; // Output path of kernel module(used with -c).
+  std::string depFile;    // Output path of dependency file. Empty = none.
+  int deviceID;           // Device to build for. -1 = current device.
+
+  CompileJob() : deviceID(-1) {}
+};
+
+// Per-input result.
+struct CompileResult {
+  bool success;
+  std::string log; // Build log or error message.
+  double msec;     // Wall clock time of the job.
+  bool cached;     // Program was created from cached binary.
+
+  CompileResult() : success(false), msec(0.0), cached(false) {}
+};
+
+//  Function: runCompileJob
+//  Compiles `job.input` with `device` and writes kernel module when requested.
+//  Build log is stored to `result` instead of being printed, so this can be
+//  used for many inputs in one process.
+bool runCompileJob(muda::MUDADeviceOCL *device, const CompileJob &job,
+                   const CompileOptions &options, CompileResult *result);
+
+//  Function: compileSource
+//  Compiles kernel source string for ith device of `device`(current device if
+//  -1), using the binary cache when enabled. Compiled binary is stored to
+//  `binary` when it is not NULL. `depContents` are contents of files
+//  included by the source, which are part of the cache key.
+bool compileSource(muda::MUDADeviceOCL *device, int deviceID,
+                   const std::string &source, const CompileOptions &options,
+                   CompileResult *result, std::vector<char> *binary,
+                   const std::vector<std::string> *depContents = NULL);
+
+//  Function: buildProgram
+//  Builds `input` with the same headers, includes and options as
+//  runCompileJob(), and returns the program for running its kernels(NULL on
+//  failure, with the reason in `log`). Release it with releaseProgram().
+muda::MUDAProgram buildProgram(muda::MUDADeviceOCL *device,
+                               const std::string &input,
+                               const CompileOptions &options,
+                               std::string *log);
+
+//  Function: computeCompileKey
+//  Returns hash of everything which affects the compiled binary.
+std::string computeCompileKey(
+    muda::MUDADeviceOCL *device, int deviceID, const CompileOptions &options,
+    const std::string &source,
+    const std::vector<std::string> *depContents = NULL);
+
+//  Function: moduleFilename
+//  Returns default module filename for the input, i.e. `input.clbin` (or
+//  `outdir/basename.clbin` when `outdir` is not empty). `.clbin` is the suffix
+//  MUDADeviceOCL::loadKernelBinary() looks for.
+std::string moduleFilename(const std::string &input, const std::string &outdir);
+
+//  Function: readfile
+//  Reads whole file. Returns false when the file could not be opened or
+//  read(e.g. a directory).
+bool readfile(const std::string &path, std::string *content);
+
+//  Function: writefile
+//  Writes `data` to `path`.
+bool writefile(const std::string &path, const std::vector<char> &data);
+
+} // namespace oclc
+
+#endif // OCLC_COMPILE_JOB_H
@@ -0,0 +1,686 @@
+//
+// Long-lived compile server over Unix domain socket(POSIX only).
+//
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <list>
+#include <map>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+#include <utility>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "compile_server.h"
+#include "include_scanner.h"
+#include "include_vfs.h"
+#include "ipc.h"
+#include "thread_pool.h"
+
+namespace oclc {
+
+#ifndef _WIN32
+
+namespace {
+
+// Request types.
+enum { kRequestCompile = 1, kRequestShutdown = 2 };
+
+// Values of `cached` field in the response.
+enum { kNotCached = 0, kCachedInMemory = 1, kCachedOnDisk = 2 };
+
+volatile sig_atomic_t gStopRequested = 0;
+
+void stopHandler(int sig) {
+  (void)sig;
+  gStopRequested = 1;
+}
+
+// Build result kept in memory.
+struct BuildEntry {
+  bool success;
+  std::string log;
+  std::vector<char> binary;
+};
+
+// Least recently used build results.
+class BuildLRU {
+public:
+  explicit BuildLRU(size_t maxEntries) : maxEntries(maxEntries) {}
+
+  bool lookup(const std::string &key, BuildEntry *entry) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Map::iterator it = entries.find(key);
+    if (it == entries.end()) {
+      return false;
+    }
+    order.splice(order.begin(), order, it->second.second);
+    (*entry) = it->second.first;
+    return true;
+  }
+
+  void insert(const std::string &key, const BuildEntry &entry) {
+    if (maxEntries == 0) {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    Map::iterator it = entries.find(key);
+    if (it != entries.end()) {
+      it->second.first = entry;
+      order.splice(order.begin(), order, it->second.second);
+      return;
+    }
+    order.push_front(key);
+    entries[key] = std::make_pair(entry, order.begin());
+    while (entries.size() > maxEntries) {
+      entries.erase(order.back());
+      order.pop_back();
+    }
+  }
+
+private:
+  typedef std::unordered_map<
+      std::string, std::pair<BuildEntry, std::list<std::string>::iterator> >
+      Map;
+
+  size_t maxEntries;
+  std::list<std::string> order; // front = most recently used.
+  Map entries;
+  std::mutex mutex;
+};
+
+class CompileServer {
+public:
+  explicit CompileServer(const ServerConfig &config)
+      : config(config), lru(config.maxEntries) {}
+
+  ~CompileServer() {
+    std::map<std::pair<int, int>, muda::MUDADeviceOCL *>::iterator it;
+    for (it = devices.begin(); it != devices.end(); it++) {
+      delete it->second;
+    }
+  }
+
+  // Returns warm device, creating it on first use.
+  muda::MUDADeviceOCL *getDevice(int platformID, int deviceID,
+                                 std::string *err) {
+    std::lock_guard<std::mutex> lock(devicesMutex);
+
+    std::pair<int, int> key(platformID, deviceID);
+    std::map<std::pair<int, int>, muda::MUDADeviceOCL *>::iterator it =
+        devices.find(key);
+    if (it != devices.end()) {
+      return it->second;
+    }
+
+    if (platformID < 0 ||
+        platformID >= muda::MUDADeviceOCL::getNumPlatforms()) {
+      (*err) = "Invalid platform ID.\n";
+      return NULL;
+    }
+
+    muda::MUDADeviceOCL *device = new muda::MUDADeviceOCL(muda::ocl_cpu);
+    if (!device->initialize(platformID, deviceID, false)) {
+      delete device;
+      (*err) = "Failed to initialize OpenCL device.\n";
+      return NULL;
+    }
+
+    // initialize() falls back to device 0 for an invalid ID. Do not cache
+    // it under the invalid key.
+    if (deviceID < 0 || deviceID >= device->getNumDevices()) {
+      delete device;
+      (*err) = "Invalid device ID.\n";
+      return NULL;
+    }
+
+    if (config.verbose) {
+      printf("[server] Ready: platform %d device %d: %s\n", platformID,
+             deviceID, device->getDeviceName().c_str());
+    }
+
+    devices[key] = device;
+    return device;
+  }
+
+  void warmUp() {
+    std::string err;
+    if (config.warmAllDevices) {
+      int numPlatforms = muda::MUDADeviceOCL::getNumPlatforms();
+      for (int p = 0; p < numPlatforms; p++) {
+        muda::MUDADeviceOCL *device = getDevice(p, 0, &err);
+        if (!device) {
+          continue;
+        }
+        for (int d = 1; d < device->getNumDevices(); d++) {
+          getDevice(p, d, &err);
+        }
+      }
+    } else {
+      getDevice(config.platformID, config.deviceID, &err);
+    }
+  }
+
+  // Serves one request of the connection. Returns false when the connection
+  // should be closed(closed by the client, broken or shutdown request).
+  bool serveRequest(int fd) {
+    std::string msg;
+    if (!recvMessage(fd, &msg)) {
+      return false;
+    }
+
+    MessageReader r(msg);
+    unsigned int type = 0;
+    if (!r.getU32(&type)) {
+      return false;
+    }
+
+    if (type == kRequestShutdown) {
+      gStopRequested = 1;
+      sendMessage(fd, std::string());
+      return false;
+    }
+
+    if (type != kRequestCompile) {
+      return false;
+    }
+
+    MessageWriter w;
+    if (!handleCompile(r, &w)) {
+      return false;
+    }
+    return sendMessage(fd, w.data());
+  }
+
+private:
+  bool handleCompile(MessageReader &r, MessageWriter *w) {
+    unsigned int platformID, deviceID, wantModule, numHeaders;
+    std::string input, source;
+    CompileOptions options;
+    if (!r.getU32(&platformID) || !r.getU32(&deviceID) ||
+        !r.getU32(&wantModule) || !r.getString(&input) ||
+        !r.getString(&options.clopt) || !r.getU32(&numHeaders)) {
+      return false;
+    }
+    for (unsigned int i = 0; i < numHeaders; i++) {
+      std::string header;
+      if (!r.getString(&header)) {
+        return false;
+      }
+      options.headers.push_back(header);
+    }
+    unsigned int numDeps;
+    if (!r.getString(&source) || !r.getU32(&numDeps)) {
+      return false;
+    }
+    // Contents of included files, scanned by the client.
+    std::vector<std::string> depContents(numDeps);
+    for (unsigned int i = 0; i < numDeps; i++) {
+      if (!r.getString(&depContents[i])) {
+        return false;
+      }
+    }
+    options.cache = config.cache;
+
+    BuildEntry entry;
+    unsigned int cached = kNotCached;
+
+    std::string err;
+    muda::MUDADeviceOCL *device = getDevice(int(platformID), int(deviceID),
+                                            &err);
+    if (!device) {
+      entry.success = false;
+      entry.log = err;
+    } else {
+      std::string key = computeCompileKey(device, -1, options, source,
+                                          &depContents);
+      if (lru.lookup(key, &entry)) {
+        cached = kCachedInMemory;
+      } else {
+        CompileResult result;
+        entry.success = compileSource(device, -1, source, options, &result,
+                                      &entry.binary, &depContents);
+        entry.log = result.log;
+        if (result.cached) {
+          cached = kCachedOnDisk;
+        }
+        lru.insert(key, entry);
+      }
+    }
+
+    if (config.verbose) {
+      printf("[server] %s: %s%s\n", input.c_str(),
+             entry.success ? "OK" : "FAILED",
+             (cached == kCachedInMemory)
+                 ? " (memory)"
+                 : ((cached == kCachedOnDisk) ? " (disk)" : ""));
+      fflush(stdout);
+    }
+
+    w->putU32(entry.success ? 1 : 0);
+    w->putU32(cached);
+    w->putString(entry.log);
+    w->putBytes(wantModule ? entry.binary : std::vector<char>());
+
+    return true;
+  }
+
+  ServerConfig config;
+  BuildLRU lru;
+
+  std::map<std::pair<int, int>, muda::MUDADeviceOCL *> devices;
+  std::mutex devicesMutex;
+};
+
+// Client connections of the server. A connection is either idle, polled by
+// the accept loop, or busy while the pool serves one of its requests, so idle
+// clients do not occupy pool threads.
+class ConnectionSet {
+public:
+  ConnectionSet() : stopping(false) {
+    wakeFds[0] = -1;
+    wakeFds[1] = -1;
+  }
+
+  ~ConnectionSet() {
+    std::set<int>::iterator it;
+    for (it = fds.begin(); it != fds.end(); it++) {
+      close(*it);
+    }
+    if (wakeFds[0] >= 0) {
+      close(wakeFds[0]);
+      close(wakeFds[1]);
+    }
+  }
+
+  // Creates the pipe to wake up the accept loop.
+  bool open() {
+    if (pipe(wakeFds) != 0) {
+      return false;
+    }
+    fcntl(wakeFds[0], F_SETFL, fcntl(wakeFds[0], F_GETFL) | O_NONBLOCK);
+    fcntl(wakeFds[1], F_SETFL, fcntl(wakeFds[1], F_GETFL) | O_NONBLOCK);
+    return true;
+  }
+
+  int wakeFd() const { return wakeFds[0]; }
+
+  void add(int fd) {
+    std::lock_guard<std::mutex> lock(mutex);
+    fds.insert(fd);
+  }
+
+  // Called by the pool after a request was served. Keeps the connection for
+  // the next request, or closes it.
+  void release(int fd, bool keep) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!keep || stopping) {
+        fds.erase(fd);
+        close(fd);
+        return;
+      }
+      returned.push_back(fd);
+    }
+    char c = 0;
+    ssize_t n = write(wakeFds[1], &c, 1);
+    (void)n; // Pipe full means the loop wakes up anyway.
+  }
+
+  // Returns connections released since the last call, to be polled again.
+  void takeReturned(std::vector<int> *idle) {
+    char buf[64];
+    while (read(wakeFds[0], buf, sizeof(buf)) > 0) {
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    idle->insert(idle->end(), returned.begin(), returned.end());
+    returned.clear();
+  }
+
+  // Wakes up requests blocked on the connections, so the pool can be
+  // joined. Idle connections are closed by the destructor.
+  void shutdownAll() {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+    std::set<int>::iterator it;
+    for (it = fds.begin(); it != fds.end(); it++) {
+      shutdown(*it, SHUT_RDWR);
+    }
+  }
+
+private:
+  ConnectionSet(const ConnectionSet &);
+  ConnectionSet &operator=(const ConnectionSet &);
+
+  std::set<int> fds; // All open connections.
+  std::vector<int> returned;
+  int wakeFds[2];
+  bool stopping;
+  std::mutex mutex;
+};
+
+std::string currentDirectory() {
+  char buf[PATH_MAX];
+  if (getcwd(buf, sizeof(buf)) == NULL) {
+    return std::string(".");
+  }
+  return std::string(buf);
+}
+
+std::string absoluteDirectoryOf(const std::string &path) {
+  char buf[PATH_MAX];
+  std::string abs = (realpath(path.c_str(), buf) != NULL) ? std::string(buf)
+                                                            : path;
+  size_t pos = abs.find_last_of('/');
+  if (pos == std::string::npos) {
+    return currentDirectory();
+  }
+  if (pos == 0) {
+    return std::string("/");
+  }
+  return abs.substr(0, pos);
+}
+
+} // namespace
+
+int runCompileServer(const ServerConfig &config) {
+  struct sockaddr_un addr;
+  if (config.socketPath.size() >= sizeof(addr.sun_path)) {
+    std::cerr << "Socket path too long: " << config.socketPath << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  CompileServer server(config);
+  server.warmUp();
+
+  int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listenFd < 0) {
+    perror("socket");
+    return EXIT_FAILURE;
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, config.socketPath.c_str(), sizeof(addr.sun_path) - 1);
+
+  // Remove stale socket left by a killed server.
+  unlink(config.socketPath.c_str());
+
+  if (bind(listenFd, reinterpret_cast<struct sockaddr *>(&addr),
+           sizeof(addr)) != 0) {
+    perror("bind");
+    close(listenFd);
+    return EXIT_FAILURE;
+  }
+
+  // Only the owner may submit sources to the server.
+  if (chmod(config.socketPath.c_str(), 0600) != 0) {
+    perror("chmod");
+    close(listenFd);
+    unlink(config.socketPath.c_str());
+    return EXIT_FAILURE;
+  }
+
+  if (listen(listenFd, 64) != 0) {
+    perror("listen");
+    close(listenFd);
+    unlink(config.socketPath.c_str());
+    return EXIT_FAILURE;
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGINT, stopHandler);
+  signal(SIGTERM, stopHandler);
+
+  printf("[server] Listening on %s\n", config.socketPath.c_str());
+  fflush(stdout);
+
+  ConnectionSet connections;
+  if (!connections.open()) {
+    perror("pipe");
+    close(listenFd);
+    unlink(config.socketPath.c_str());
+    return EXIT_FAILURE;
+  }
+
+  {
+    ThreadPool pool(config.numThreads);
+    std::vector<int> idle;
+
+    while (!gStopRequested) {
+      std::vector<struct pollfd> pfds(2 + idle.size());
+      pfds[0].fd = listenFd;
+      pfds[1].fd = connections.wakeFd();
+      for (size_t i = 0; i < idle.size(); i++) {
+        pfds[2 + i].fd = idle[i];
+      }
+      for (size_t i = 0; i < pfds.size(); i++) {
+        pfds[i].events = POLLIN;
+        pfds[i].revents = 0;
+      }
+
+      // Wake up periodically to check stop request.
+      int ret = poll(&pfds.at(0), nfds_t(pfds.size()), 200);
+      if (ret <= 0) {
+        continue;
+      }
+
+      // Hand one request per task to the pool. The connection is polled
+      // again after the response was sent.
+      std::vector<int> stillIdle;
+      for (size_t i = 0; i < idle.size(); i++) {
+        if (pfds[2 + i].revents & (POLLIN | POLLHUP | POLLERR | POLLNVAL)) {
+          int fd = idle[i];
+          pool.enqueue([&server, &connections, fd] {
+            connections.release(fd, server.serveRequest(fd));
+          });
+        } else {
+          stillIdle.push_back(idle[i]);
+        }
+      }
+      idle.swap(stillIdle);
+
+      if (pfds[1].revents & POLLIN) {
+        connections.takeReturned(&idle);
+      }
+
+      if (pfds[0].revents & POLLIN) {
+        int fd = accept(listenFd, NULL, NULL);
+        if (fd >= 0) {
+          connections.add(fd);
+          idle.push_back(fd);
+        }
+      }
+    }
+
+    close(listenFd);
+    unlink(config.socketPath.c_str());
+
+    // Unblock requests waiting for clients, then the ThreadPool destructor
+    // waits for requests in progress.
+    connections.shutdownAll();
+  }
+
+  printf("[server] Shutdown.\n");
+
+  return 0;
+}
+
+CompileClient::CompileClient() : fd(-1) {}
+
+CompileClient::~CompileClient() {
+  if (fd >= 0) {
+    close(fd);
+  }
+}
+
+bool CompileClient::connect(const std::string &socketPath) {
+  struct sockaddr_un addr;
+  if (socketPath.size() >= sizeof(addr.sun_path)) {
+    return false;
+  }
+
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return false;
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+
+  if (::connect(fd, reinterpret_cast<struct sockaddr *>(&addr),
+                sizeof(addr)) != 0) {
+    close(fd);
+    fd = -1;
+    return false;
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+
+  return true;
+}
+
+bool CompileClient::compile(const CompileJob &job,
+                            const CompileOptions &options, int platformID,
+                            int deviceID, CompileResult *result) {
+  result->success = false;
+  result->cached = false;
+  result->log.clear();
+
+  std::string source;
+  std::vector<std::string> deps, depContents;
+  if (options.vfs) {
+    // Included files are inlined, so the server does not read them.
+    if (!options.vfs->expand(job.input, options.includeDirs, &source,
+                             &deps)) {
+      result->log = "Failed to open file: " + job.input + "\n";
+      return false;
+    }
+  } else {
+    if (!readfile(job.input, &source)) {
+      result->log = "Failed to open file: " + job.input + "\n";
+      return false;
+    }
+    // Included files are part of the cache key of the server.
+    scanIncludes(job.input, options.includeDirs, &deps, &depContents);
+  }
+
+  // The server resolves #include in its own working directory.
+  std::string clopt = "-I\"" + absoluteDirectoryOf(job.input) + "\" -I\"" +
+                      currentDirectory() + "\" " + options.clopt;
+
+  MessageWriter w;
+  w.putU32(kRequestCompile);
+  w.putU32((unsigned int)platformID);
+  w.putU32((unsigned int)deviceID);
+  w.putU32(options.module ? 1 : 0);
+  w.putString(job.input);
+  w.putString(clopt);
+  w.putU32((unsigned int)options.headers.size());
+  for (size_t i = 0; i < options.headers.size(); i++) {
+    w.putString(options.headers[i]);
+  }
+  w.putString(source);
+
+  w.putU32((unsigned int)depContents.size());
+  for (size_t i = 0; i < depContents.size(); i++) {
+    w.putString(depContents[i]);
+  }
+
+  std::string msg;
+  if (!sendMessage(fd, w.data()) || !recvMessage(fd, &msg)) {
+    result->log = "Lost connection to compile server.\n";
+    return false;
+  }
+
+  MessageReader r(msg);
+  unsigned int success, cached;
+  std::vector<char> binary;
+  if (!r.getU32(&success) || !r.getU32(&cached) ||
+      !r.getString(&result->log) || !r.getBytes(&binary)) {
+    result->log = "Broken response from compile server.\n";
+    return false;
+  }
+
+  result->cached = (cached != kNotCached);
+  result->success = (success != 0);
+
+  if (result->success && options.module) {
+    if (!writefile(job.moduleFile, binary)) {
+      result->log += "Failed to write kernel module: " + job.moduleFile + "\n";
+      result->success = false;
+    }
+  }
+
+  if (result->success && !job.depFile.empty()) {
+    deps.insert(deps.begin(), job.input);
+    deps.insert(deps.begin() + 1, options.headerFiles.begin(),
+                options.headerFiles.end());
+    std::string target = options.module ? job.moduleFile : job.depFile;
+    if (!writeDepfile(job.depFile, target, deps)) {
+      result->log += "Failed to write dependency file: " + job.depFile + "\n";
+      result->success = false;
+    }
+  }
+
+  return result->success;
+}
+
+bool CompileClient::shutdownServer() {
+  MessageWriter w;
+  w.putU32(kRequestShutdown);
+
+  std::string msg;
+  return sendMessage(fd, w.data()) && recvMessage(fd, &msg);
+}
+
+#else
+
+int runCompileServer(const ServerConfig &config) {
+  (void)config;
+  std::cerr << "Compile server is not supported on this platform."
+            << std::endl;
+  return EXIT_FAILURE;
+}
+
+CompileClient::CompileClient() : fd(-1) {}
+
+CompileClient::~CompileClient() {}
+
+bool CompileClient::connect(const std::string &socketPath) {
+  (void)socketPath;
+  return false;
+}
+
+bool CompileClient::compile(const CompileJob &job,
+                            const CompileOptions &options, int platformID,
+                            int deviceID, CompileResult *result) {
+  (void)job;
+  (void)options;
+  (void)platformID;
+  (void)deviceID;
+  result->success = false;
+  result->log = "Compile server is not supported on this platform.\n";
+  return false;
+}
+
+bool CompileClient::shutdownServer() { return false; }
+
+#endif
+
+} // namespace oclc
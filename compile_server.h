@@ -0,0 +1,67 @@
+//
+// Long-lived compile server over Unix domain socket(POSIX only).
+//
+#ifndef OCLC_COMPILE_SERVER_H
+#define OCLC_COMPILE_SERVER_H
+
+#include <string>
+#include <vector>
+
+#include "compile_job.h"
+
+namespace oclc {
+
+struct ServerConfig {
+  std::string socketPath;
+  int platformID; // Device warmed up at startup.
+  int deviceID;
+  bool warmAllDevices; // Warm up every device of every platform at startup.
+  int numThreads;      // # of requests served concurrently.
+  size_t maxEntries;   // Capacity of in-memory LRU of build results.
+  BinaryCache *cache;  // On-disk cache. Can be NULL.
+  bool verbose;
+
+  ServerConfig()
+      : platformID(0), deviceID(0), warmAllDevices(false), numThreads(4),
+        maxEntries(1024), cache(NULL), verbose(false) {}
+};
+
+//  Function: runCompileServer
+//  Serves compile requests until a client sends shutdown request or the
+//  process receives SIGINT/SIGTERM.
+//  MUDADeviceOCL instances are kept alive per platform/device, and build
+//  results are kept in an in-memory LRU, so a repeated request is answered
+//  without calling the driver. clewInit() must be called before.
+//  Returns process exit code.
+int runCompileServer(const ServerConfig &config);
+
+// Thin client of the compile server. Does not require OpenCL runtime.
+class CompileClient {
+public:
+  CompileClient();
+  ~CompileClient();
+
+  bool connect(const std::string &socketPath);
+
+  //  Function: compile
+  //  Sends `job.input` to the server and receives result. Directory of the
+  //  input and current directory are added to include path(-I), since the
+  //  server runs in other directory. Kernel module is written to
+  //  `job.moduleFile` when `options.module` is true.
+  bool compile(const CompileJob &job, const CompileOptions &options,
+               int platformID, int deviceID, CompileResult *result);
+
+  //  Function: shutdownServer
+  //  Asks the server to exit.
+  bool shutdownServer();
+
+private:
+  CompileClient(const CompileClient &);
+  CompileClient &operator=(const CompileClient &);
+
+  int fd;
+};
+
+} // namespace oclc
+
+#endif // OCLC_COMPILE_SERVER_H
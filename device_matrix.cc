@@ -0,0 +1,149 @@
+//
+// Cross-platform/cross-device compile matrix(--all-devices).
+//
+#include <algorithm>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <thread>
+
+#include "device_matrix.h"
+
+namespace oclc {
+
+namespace {
+
+struct DeviceColumn {
+  int platformID;
+  int deviceID;
+  std::string platformName;
+  std::string deviceName;
+  std::vector<CompileResult> results; // per input
+};
+
+struct PlatformResult {
+  bool initialized;
+  std::vector<DeviceColumn> columns;
+
+  PlatformResult() : initialized(false) {}
+};
+
+void buildPlatform(int platformID, const std::vector<CompileJob> &jobs,
+                   const CompileOptions &options, PlatformResult *out) {
+  muda::MUDADeviceOCL device(muda::ocl_cpu);
+  if (!device.initializeAllDevices(platformID, false)) {
+    return;
+  }
+  out->initialized = true;
+
+  int numDevices = device.getNumDevices();
+  out->columns.resize(numDevices);
+
+  // Only the result of the build matters here, so no module is written.
+  CompileOptions opts = options;
+  opts.module = false;
+
+  std::vector<std::thread> threads;
+  for (int d = 0; d < numDevices; d++) {
+    DeviceColumn &col = out->columns[d];
+    col.platformID = platformID;
+    col.deviceID = d;
+    col.platformName = device.getPlatformName();
+    col.deviceName = device.getDeviceName(d);
+    col.results.resize(jobs.size());
+
+    threads.push_back(std::thread([&, d] {
+      DeviceColumn &c = out->columns[d];
+      for (size_t i = 0; i < jobs.size(); i++) {
+        CompileJob job = jobs[i];
+        job.deviceID = d;
+        runCompileJob(&device, job, opts, &c.results[i]);
+      }
+    }));
+  }
+
+  for (size_t i = 0; i < threads.size(); i++) {
+    threads[i].join();
+  }
+}
+
+} // namespace
+
+int runDeviceMatrix(const std::vector<CompileJob> &jobs,
+                    const CompileOptions &options) {
+  int numPlatforms = muda::MUDADeviceOCL::getNumPlatforms();
+  if (numPlatforms < 1) {
+    return -1;
+  }
+
+  std::vector<PlatformResult> platforms(numPlatforms);
+  std::vector<std::thread> threads;
+  for (int p = 0; p < numPlatforms; p++) {
+    threads.push_back(std::thread(buildPlatform, p, std::cref(jobs),
+                                  std::cref(options), &platforms[p]));
+  }
+  for (size_t i = 0; i < threads.size(); i++) {
+    threads[i].join();
+  }
+
+  std::vector<const DeviceColumn *> columns;
+  printf("Devices:\n");
+  for (int p = 0; p < numPlatforms; p++) {
+    if (!platforms[p].initialized) {
+      printf("  platform %d: failed to initialize(no device or no context)\n",
+             p);
+      continue;
+    }
+    for (size_t d = 0; d < platforms[p].columns.size(); d++) {
+      const DeviceColumn &col = platforms[p].columns[d];
+      printf("  [%d] platform %d device %d: %s / %s\n", int(columns.size()),
+             col.platformID, col.deviceID, col.platformName.c_str(),
+             col.deviceName.c_str());
+      columns.push_back(&col);
+    }
+  }
+  printf("\n");
+
+  if (columns.empty()) {
+    return -1;
+  }
+
+  size_t inputWidth = 5;
+  for (size_t i = 0; i < jobs.size(); i++) {
+    inputWidth = std::max(inputWidth, jobs[i].input.size());
+  }
+
+  printf("%-*s", int(inputWidth), "input");
+  for (size_t c = 0; c < columns.size(); c++) {
+    printf("  [%2d]            ", int(c));
+  }
+  printf("\n");
+
+  int numFailed = 0;
+  for (size_t i = 0; i < jobs.size(); i++) {
+    printf("%-*s", int(inputWidth), jobs[i].input.c_str());
+    for (size_t c = 0; c < columns.size(); c++) {
+      const CompileResult &r = columns[c]->results[i];
+      printf("  %s %10.1fms", r.success ? "PASS" : "FAIL", r.msec);
+      if (!r.success) {
+        numFailed++;
+      }
+    }
+    printf("\n");
+  }
+
+  // Build logs of failures.
+  for (size_t c = 0; c < columns.size(); c++) {
+    for (size_t i = 0; i < jobs.size(); i++) {
+      const CompileResult &r = columns[c]->results[i];
+      if (!r.success) {
+        printf("\n==> [%d] %s: %s\n%s\n", int(c), columns[c]->deviceName.c_str(),
+               jobs[i].input.c_str(), r.log.c_str());
+      }
+    }
+  }
+
+  return numFailed;
+}
+
+} // namespace oclc
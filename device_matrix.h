@@ -0,0 +1,26 @@
+//
+// Cross-platform/cross-device compile matrix(--all-devices).
+//
+#ifndef OCLC_DEVICE_MATRIX_H
+#define OCLC_DEVICE_MATRIX_H
+
+#include <vector>
+
+#include "compile_job.h"
+
+namespace oclc {
+
+//  Function: runDeviceMatrix
+//  Builds every input for every device of every platform and prints a
+//  pass/fail and build time matrix. One context is created per platform, and
+//  platforms and devices are built concurrently.
+//  A platform which fails to initialize(e.g. an ICD without devices) is
+//  reported and skipped.
+//  clewInit() must be called before. Returns # of failed builds, or -1 when
+//  no OpenCL device was found.
+int runDeviceMatrix(const std::vector<CompileJob> &jobs,
+                    const CompileOptions &options);
+
+} // namespace oclc
+
+#endif // OCLC_DEVICE_MATRIX_H
@@ -0,0 +1,307 @@
+//
+// #include dependency scanner and Make/Ninja depfile writer.
+//
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <set>
+
+#include "compile_job.h"
+#include "include_scanner.h"
+
+namespace oclc {
+
+namespace {
+
+bool isSpace(char c) { return (c == ' ') || (c == '\t') || (c == '\r'); }
+
+bool fileExists(const std::string &path) {
+  FILE *fp = fopen(path.c_str(), "rb");
+  if (!fp) {
+    return false;
+  }
+  fclose(fp);
+  return true;
+}
+
+// Returns a path which identifies the file regardless of how it was spelled.
+std::string canonicalPath(const std::string &path) {
+#ifdef _WIN32
+  char buf[_MAX_PATH];
+  if (_fullpath(buf, path.c_str(), _MAX_PATH) == NULL) {
+    return path;
+  }
+#else
+  char buf[PATH_MAX];
+  if (realpath(path.c_str(), buf) == NULL) {
+    return path;
+  }
+#endif
+  return std::string(buf);
+}
+
+// Splits source into lines with comments removed and backslash-newline
+// continuations joined.
+void logicalLines(const std::string &src, std::vector<std::string> *lines) {
+  std::string line;
+  bool inBlockComment = false;
+  size_t n = src.size();
+  for (size_t i = 0; i < n; i++) {
+    char c = src[i];
+    if (inBlockComment) {
+      if ((c == '*') && (i + 1 < n) && (src[i + 1] == '/')) {
+        inBlockComment = false;
+        line += ' ';
+        i++;
+      }
+      continue;
+    }
+    if ((c == '\\') && (i + 1 < n) && (src[i + 1] == '\n')) {
+      i++;
+      continue;
+    }
+    if ((c == '/') && (i + 1 < n) && (src[i + 1] == '*')) {
+      inBlockComment = true;
+      i++;
+      continue;
+    }
+    if ((c == '/') && (i + 1 < n) && (src[i + 1] == '/')) {
+      while ((i + 1 < n) && (src[i + 1] != '\n')) {
+        i++;
+      }
+      continue;
+    }
+    if (c == '\n') {
+      lines->push_back(line);
+      line.clear();
+      continue;
+    }
+    line += c;
+  }
+  if (!line.empty()) {
+    lines->push_back(line);
+  }
+}
+
+} // namespace
+
+std::string directoryOf(const std::string &path) {
+  size_t pos = path.find_last_of("/\\");
+  if (pos == std::string::npos) {
+    return std::string();
+  }
+  return path.substr(0, pos + 1);
+}
+
+std::string joinPath(const std::string &dir, const std::string &name) {
+  if (dir.empty() || (name[0] == '/')) {
+    return name;
+  }
+  char last = dir[dir.size() - 1];
+  if ((last == '/') || (last == '\\')) {
+    return dir + name;
+  }
+  return dir + "/" + name;
+}
+
+bool parseIncludeDirective(const std::string &line, std::string *name,
+                           bool *quoted) {
+  size_t i = 0;
+  while ((i < line.size()) && isSpace(line[i])) {
+    i++;
+  }
+  if ((i >= line.size()) || (line[i] != '#')) {
+    return false;
+  }
+  i++;
+  while ((i < line.size()) && isSpace(line[i])) {
+    i++;
+  }
+  if (line.compare(i, 7, "include") != 0) {
+    return false;
+  }
+  i += 7;
+  while ((i < line.size()) && isSpace(line[i])) {
+    i++;
+  }
+  if (i >= line.size()) {
+    return false;
+  }
+
+  char close;
+  if (line[i] == '"') {
+    close = '"';
+    (*quoted) = true;
+  } else if (line[i] == '<') {
+    close = '>';
+    (*quoted) = false;
+  } else {
+    return false; // Macro include. Not supported.
+  }
+
+  size_t end = line.find(close, i + 1);
+  if ((end == std::string::npos) || (end == i + 1)) {
+    return false;
+  }
+  (*name) = line.substr(i + 1, end - i - 1);
+
+  return true;
+}
+
+void parseIncludeDirs(const std::string &clopt,
+                      std::vector<std::string> *dirs) {
+  // Tokenize with quotes.
+  std::vector<std::string> tokens;
+  std::string tok;
+  bool inToken = false;
+  char quote = 0;
+  for (size_t i = 0; i < clopt.size(); i++) {
+    char c = clopt[i];
+    if (quote) {
+      if (c == quote) {
+        quote = 0;
+      } else {
+        tok += c;
+      }
+    } else if ((c == '"') || (c == '\'')) {
+      quote = c;
+      inToken = true;
+    } else if (isSpace(c) || (c == '\n')) {
+      if (inToken) {
+        tokens.push_back(tok);
+        tok.clear();
+        inToken = false;
+      }
+    } else {
+      tok += c;
+      inToken = true;
+    }
+  }
+  if (inToken) {
+    tokens.push_back(tok);
+  }
+
+  for (size_t i = 0; i < tokens.size(); i++) {
+    if (tokens[i].compare(0, 2, "-I") != 0) {
+      continue;
+    }
+    if (tokens[i].size() > 2) {
+      dirs->push_back(tokens[i].substr(2));
+    } else if (i + 1 < tokens.size()) {
+      dirs->push_back(tokens[i + 1]);
+      i++;
+    }
+  }
+}
+
+bool scanIncludes(const std::string &input,
+                  const std::vector<std::string> &includeDirs,
+                  std::vector<std::string> *deps,
+                  std::vector<std::string> *contents) {
+  std::set<std::string> visited;
+  visited.insert(canonicalPath(input));
+
+  // Files to scan. Depth-first order does not matter for dependencies.
+  std::vector<std::string> stack;
+  stack.push_back(input);
+
+  bool first = true;
+  while (!stack.empty()) {
+    std::string path = stack.back();
+    stack.pop_back();
+
+    std::string src;
+    if (!readfile(path, &src)) {
+      if (first) {
+        return false;
+      }
+      continue;
+    }
+    first = false;
+
+    std::vector<std::string> lines;
+    logicalLines(src, &lines);
+
+    std::vector<std::string> found;
+    for (size_t i = 0; i < lines.size(); i++) {
+      std::string name;
+      bool quoted = false;
+      if (!parseIncludeDirective(lines[i], &name, &quoted)) {
+        continue;
+      }
+
+      std::string resolved;
+      if (quoted) {
+        std::string candidate = joinPath(directoryOf(path), name);
+        if (fileExists(candidate)) {
+          resolved = candidate;
+        }
+      }
+      for (size_t d = 0; resolved.empty() && (d < includeDirs.size()); d++) {
+        std::string candidate = joinPath(includeDirs[d], name);
+        if (fileExists(candidate)) {
+          resolved = candidate;
+        }
+      }
+      if (resolved.empty()) {
+        continue;
+      }
+
+      if (!visited.insert(canonicalPath(resolved)).second) {
+        continue;
+      }
+
+      deps->push_back(resolved);
+      if (contents) {
+        std::string content;
+        readfile(resolved, &content);
+        contents->push_back(content);
+      }
+      found.push_back(resolved);
+    }
+
+    // Push in reverse so that files are scanned in include order.
+    for (size_t i = found.size(); i > 0; i--) {
+      stack.push_back(found[i - 1]);
+    }
+  }
+
+  return true;
+}
+
+static std::string escapeMakePath(const std::string &path) {
+  std::string s;
+  for (size_t i = 0; i < path.size(); i++) {
+    char c = path[i];
+    if ((c == ' ') || (c == '#')) {
+      s += '\\';
+    } else if (c == '$') {
+      s += '$';
+    }
+    s += c;
+  }
+  return s;
+}
+
+bool writeDepfile(const std::string &path, const std::string &target,
+                  const std::vector<std::string> &deps) {
+  FILE *fp = fopen(path.c_str(), "w");
+  if (!fp) {
+    return false;
+  }
+
+  fprintf(fp, "%s:", escapeMakePath(target).c_str());
+  for (size_t i = 0; i < deps.size(); i++) {
+    fprintf(fp, " \\\n  %s", escapeMakePath(deps[i]).c_str());
+  }
+  fprintf(fp, "\n");
+
+  // Skip the input itself(first dependency).
+  for (size_t i = 1; i < deps.size(); i++) {
+    fprintf(fp, "\n%s:\n", escapeMakePath(deps[i]).c_str());
+  }
+
+  return (fclose(fp) == 0);
+}
+
+} // namespace oclc
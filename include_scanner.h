@@ -0,0 +1,56 @@
+//
+// #include dependency scanner and Make/Ninja depfile writer.
+//
+#ifndef OCLC_INCLUDE_SCANNER_H
+#define OCLC_INCLUDE_SCANNER_H
+
+#include <string>
+#include <vector>
+
+namespace oclc {
+
+//  Function: parseIncludeDirs
+//  Appends include directories given by `-I DIR`, `-IDIR` or `-I"DIR"` in
+//  OpenCL compiler options to `dirs`.
+void parseIncludeDirs(const std::string &clopt, std::vector<std::string> *dirs);
+
+//  Function: directoryOf
+//  Returns the directory part of `path` with the trailing separator, or an
+//  empty string when `path` has no directory.
+std::string directoryOf(const std::string &path);
+
+//  Function: joinPath
+//  Returns `name` in `dir`. An absolute `name` is returned as is.
+std::string joinPath(const std::string &dir, const std::string &name);
+
+//  Function: parseIncludeDirective
+//  Parses `#include "name"`(`quoted` = true) or `#include <name>` line.
+//  Returns false for other lines and macro includes.
+bool parseIncludeDirective(const std::string &line, std::string *name,
+                           bool *quoted);
+
+//  Function: scanIncludes
+//  Finds files transitively included by `input`. `#include "file"` is
+//  searched in the directory of the including file first, then in
+//  `includeDirs`. `#include <file>` is searched in `includeDirs` only.
+//  Conditional compilation is not evaluated, so every #include line counts
+//  (a superset of the real dependencies, which is safe for a build system).
+//  Includes which cannot be found(e.g. provided by the driver) are skipped.
+//  Resolved paths are appended to `deps` in discovery order without
+//  duplicates, and their contents to `contents` when it is not NULL.
+bool scanIncludes(const std::string &input,
+                  const std::vector<std::string> &includeDirs,
+                  std::vector<std::string> *deps,
+                  std::vector<std::string> *contents);
+
+//  Function: writeDepfile
+//  Writes Makefile rule `target: deps...` to `path`. `deps[0]` is the input.
+//  An empty rule is also written for each other dependency, so that a
+//  removed header does not break the build(same as gcc -MP). The format is
+//  also understood by Ninja.
+bool writeDepfile(const std::string &path, const std::string &target,
+                  const std::vector<std::string> &deps);
+
+} // namespace oclc
+
+#endif // OCLC_INCLUDE_SCANNER_H
@@ -0,0 +1,211 @@
+//
+// In-memory virtual filesystem of kernel headers.
+//
+#include <cstdio>
+#include <cstring>
+
+#include "compile_job.h"
+#include "include_scanner.h"
+#include "include_vfs.h"
+
+namespace oclc {
+
+namespace {
+
+// Guards against unbounded recursion of files which include each other
+// through different spellings of the path.
+const size_t kMaxIncludeDepth = 200;
+
+// Returns `#line` directive which sets the line number of the next line.
+std::string lineDirective(int line, const std::string &path) {
+  std::string escaped;
+  for (size_t i = 0; i < path.size(); i++) {
+    if ((path[i] == '\\') || (path[i] == '"')) {
+      escaped += '\\';
+    }
+    escaped += path[i];
+  }
+
+  char buf[32];
+  snprintf(buf, sizeof(buf), "#line %d \"", line);
+  return std::string(buf) + escaped + "\"\n";
+}
+
+// Updates block comment state with one line. String literals are not
+// considered, which is enough for kernel sources.
+bool endsInBlockComment(const std::string &line, bool inBlockComment) {
+  for (size_t i = 0; i + 1 < line.size(); i++) {
+    if (inBlockComment) {
+      if ((line[i] == '*') && (line[i + 1] == '/')) {
+        inBlockComment = false;
+        i++;
+      }
+    } else if ((line[i] == '/') && (line[i + 1] == '/')) {
+      break;
+    } else if ((line[i] == '/') && (line[i + 1] == '*')) {
+      inBlockComment = true;
+      i++;
+    }
+  }
+  return inBlockComment;
+}
+
+bool isPragmaOnce(const std::string &line) {
+  size_t i = line.find_first_not_of(" \t");
+  if ((i == std::string::npos) || (line[i] != '#')) {
+    return false;
+  }
+  i = line.find_first_not_of(" \t", i + 1);
+  if ((i == std::string::npos) || (line.compare(i, 6, "pragma") != 0)) {
+    return false;
+  }
+  i = line.find_first_not_of(" \t", i + 6);
+  return (i != std::string::npos) && (line.compare(i, 4, "once") == 0);
+}
+
+} // namespace
+
+std::shared_ptr<const std::string> IncludeVFS::load(const std::string &path) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::map<std::string, std::shared_ptr<const std::string> >::iterator it =
+        files.find(path);
+    if (it != files.end()) {
+      return it->second; // NULL for a file known not to exist.
+    }
+  }
+
+  // Read without lock so that loading files does not serialize threads.
+  std::shared_ptr<std::string> content(new std::string());
+  if (!readfile(path, content.get())) {
+    content.reset();
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  std::pair<std::map<std::string,
+                     std::shared_ptr<const std::string> >::iterator,
+            bool>
+      ret = files.insert(std::make_pair(
+          path, std::shared_ptr<const std::string>(content)));
+
+  return ret.first->second; // Another thread may have loaded it first.
+}
+
+void IncludeVFS::clear() {
+  std::lock_guard<std::mutex> lock(mutex);
+  files.clear();
+}
+
+std::string IncludeVFS::resolve(const std::string &from,
+                                const std::string &name, bool quoted,
+                                const std::vector<std::string> &dirs) {
+  if (quoted) {
+    std::string candidate = joinPath(directoryOf(from), name);
+    if (load(candidate)) {
+      return candidate;
+    }
+  }
+  for (size_t i = 0; i < dirs.size(); i++) {
+    std::string candidate = joinPath(dirs[i], name);
+    if (load(candidate)) {
+      return candidate;
+    }
+  }
+  return std::string();
+}
+
+bool IncludeVFS::expand(const std::string &input,
+                        const std::vector<std::string> &includeDirs,
+                        std::string *out, std::vector<std::string> *deps) {
+  // Input is not cached, since it is compiled only once in a run.
+  std::string content;
+  if (!readfile(input, &content)) {
+    return false;
+  }
+
+  ExpandState state;
+  state.includeDirs = &includeDirs;
+  state.deps = deps;
+
+  out->clear();
+  out->reserve(content.size());
+  out->append(lineDirective(1, input));
+  return expandFile(input, content, &state, out);
+}
+
+bool IncludeVFS::expandFile(const std::string &path,
+                            const std::string &content, ExpandState *state,
+                            std::string *out) {
+  state->stack.push_back(path);
+
+  bool inBlockComment = false;
+  int lineNo = 0;
+  size_t pos = 0;
+  while (pos < content.size()) {
+    size_t end = content.find('\n', pos);
+    size_t next = (end == std::string::npos) ? content.size() : end + 1;
+    std::string line = content.substr(pos, next - pos);
+    pos = next;
+    lineNo++;
+
+    if (inBlockComment) {
+      inBlockComment = endsInBlockComment(line, inBlockComment);
+      out->append(line);
+      continue;
+    }
+
+    // #pragma once is handled here. Left in the inlined text, the driver
+    // would warn about #pragma once in main file.
+    if ((state->stack.size() > 1) && isPragmaOnce(line)) {
+      state->pragmaOnce.insert(path);
+      out->push_back('\n');
+      continue;
+    }
+
+    std::string name;
+    bool quoted = false;
+    if (parseIncludeDirective(line, &name, &quoted)) {
+      std::string resolved =
+          resolve(path, name, quoted, *state->includeDirs);
+      bool recursive = false;
+      for (size_t i = 0; i < state->stack.size(); i++) {
+        if (state->stack[i] == resolved) {
+          recursive = true;
+        }
+      }
+
+      if (recursive) {
+        // Include guard of a file being expanded makes this a no-op.
+        out->push_back('\n');
+        continue;
+      }
+
+      if (!resolved.empty() && (state->stack.size() < kMaxIncludeDepth)) {
+        std::shared_ptr<const std::string> header = load(resolved);
+
+        if (state->deps && state->seen.insert(resolved).second) {
+          state->deps->push_back(resolved);
+        }
+
+        if (state->pragmaOnce.count(resolved) == 0) {
+          out->append(lineDirective(1, resolved));
+          expandFile(resolved, *header, state, out);
+          if (!out->empty() && ((*out)[out->size() - 1] != '\n')) {
+            out->push_back('\n');
+          }
+        }
+        out->append(lineDirective(lineNo + 1, path));
+        continue;
+      }
+      // Not found in the VFS. Leave it to the driver.
+    }
+
+    inBlockComment = endsInBlockComment(line, inBlockComment);
+    out->append(line);
+  }
+
+  state->stack.pop_back();
+  return true;
+}
+
+} // namespace oclc
@@ -0,0 +1,76 @@
+//
+// In-memory virtual filesystem of kernel headers.
+//
+#ifndef OCLC_INCLUDE_VFS_H
+#define OCLC_INCLUDE_VFS_H
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace oclc {
+
+// Files are loaded once and shared by all compile jobs and threads, so a
+// header included by many kernels in a batch run is read only once.
+//
+// OpenCL 1.2 clCompileProgram() can take embedded headers(`input_headers`),
+// but clew only provides OpenCL 1.1 API. Instead, `expand()` inlines
+// #include directives resolved in the VFS into the source with #line
+// directives, so the driver does not touch the filesystem for them and
+// diagnostics still refer to the original file and line.
+//
+// `--header` files are only loaded(not expanded), since they are prepended to
+// the source as they are. #include directives in them are resolved by the
+// driver.
+class IncludeVFS {
+public:
+  IncludeVFS() {}
+
+  //  Function: load
+  //  Returns content of `path`, loading it on first access. Returns NULL
+  //  when the file could not be read. The content is kept until `clear()`.
+  std::shared_ptr<const std::string> load(const std::string &path);
+
+  //  Function: clear
+  //  Drops all cached contents(e.g. files were modified).
+  void clear();
+
+  //  Function: expand
+  //  Reads `input` and inlines files included by it recursively.
+  //  `#include "file"` is searched in the directory of the including file
+  //  first, then in `includeDirs`. `#include <file>` is searched in
+  //  `includeDirs` only. Includes which are not found(or use a macro) are
+  //  left to the driver. Inlined files are appended to `deps` when it is not
+  //  NULL. Returns false when `input` could not be read.
+  bool expand(const std::string &input,
+              const std::vector<std::string> &includeDirs, std::string *out,
+              std::vector<std::string> *deps);
+
+private:
+  IncludeVFS(const IncludeVFS &);
+  IncludeVFS &operator=(const IncludeVFS &);
+
+  struct ExpandState {
+    const std::vector<std::string> *includeDirs;
+    std::vector<std::string> stack;   // Canonical paths being expanded.
+    std::set<std::string> pragmaOnce; // Files with #pragma once inlined.
+    std::set<std::string> seen;       // For `deps`.
+    std::vector<std::string> *deps;
+  };
+
+  bool expandFile(const std::string &path, const std::string &content,
+                  ExpandState *state, std::string *out);
+
+  std::string resolve(const std::string &from, const std::string &name,
+                      bool quoted, const std::vector<std::string> &dirs);
+
+  std::map<std::string, std::shared_ptr<const std::string> > files;
+  std::mutex mutex;
+};
+
+} // namespace oclc
+
+#endif // OCLC_INCLUDE_VFS_H
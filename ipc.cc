@@ -0,0 +1,157 @@
+//
+// Message passing over pipe/socket file descriptors(POSIX only).
+//
+#include <cerrno>
+#include <cstring>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include "ipc.h"
+
+namespace oclc {
+
+// Upper limit of message size, to reject corrupted length prefix.
+static const unsigned int kMaxMessageSize = 1024 * 1024 * 1024;
+
+#ifndef _WIN32
+
+bool writeFull(int fd, const void *buf, size_t len) {
+  const char *p = reinterpret_cast<const char *>(buf);
+  while (len > 0) {
+    ssize_t n = ::write(fd, p, len);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    p += n;
+    len -= size_t(n);
+  }
+  return true;
+}
+
+bool readFull(int fd, void *buf, size_t len) {
+  char *p = reinterpret_cast<char *>(buf);
+  while (len > 0) {
+    ssize_t n = ::read(fd, p, len);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    if (n == 0) {
+      return false; // EOF
+    }
+    p += n;
+    len -= size_t(n);
+  }
+  return true;
+}
+
+#else
+
+bool writeFull(int fd, const void *buf, size_t len) {
+  (void)fd;
+  (void)buf;
+  (void)len;
+  return false;
+}
+
+bool readFull(int fd, void *buf, size_t len) {
+  (void)fd;
+  (void)buf;
+  (void)len;
+  return false;
+}
+
+#endif
+
+static void encodeU32(unsigned int val, unsigned char *p) {
+  p[0] = (unsigned char)(val & 0xff);
+  p[1] = (unsigned char)((val >> 8) & 0xff);
+  p[2] = (unsigned char)((val >> 16) & 0xff);
+  p[3] = (unsigned char)((val >> 24) & 0xff);
+}
+
+static unsigned int decodeU32(const unsigned char *p) {
+  return (unsigned int)p[0] | ((unsigned int)p[1] << 8) |
+         ((unsigned int)p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+bool sendMessage(int fd, const std::string &msg) {
+  unsigned char header[4];
+  encodeU32((unsigned int)msg.size(), header);
+  if (!writeFull(fd, header, sizeof(header))) {
+    return false;
+  }
+  return writeFull(fd, msg.data(), msg.size());
+}
+
+bool recvMessage(int fd, std::string *msg) {
+  unsigned char header[4];
+  if (!readFull(fd, header, sizeof(header))) {
+    return false;
+  }
+  unsigned int len = decodeU32(header);
+  if (len > kMaxMessageSize) {
+    return false;
+  }
+  msg->resize(len);
+  if (len == 0) {
+    return true;
+  }
+  return readFull(fd, &(*msg)[0], len);
+}
+
+void MessageWriter::putU32(unsigned int val) {
+  unsigned char p[4];
+  encodeU32(val, p);
+  buf.append(reinterpret_cast<const char *>(p), 4);
+}
+
+void MessageWriter::putString(const std::string &str) {
+  putU32((unsigned int)str.size());
+  buf.append(str);
+}
+
+void MessageWriter::putBytes(const std::vector<char> &data) {
+  putU32((unsigned int)data.size());
+  if (!data.empty()) {
+    buf.append(&data.at(0), data.size());
+  }
+}
+
+bool MessageReader::getU32(unsigned int *val) {
+  if (pos + 4 > buf.size()) {
+    return false;
+  }
+  (*val) = decodeU32(reinterpret_cast<const unsigned char *>(buf.data()) + pos);
+  pos += 4;
+  return true;
+}
+
+bool MessageReader::getString(std::string *str) {
+  unsigned int len;
+  if (!getU32(&len) || (pos + len > buf.size())) {
+    return false;
+  }
+  str->assign(buf, pos, len);
+  pos += len;
+  return true;
+}
+
+bool MessageReader::getBytes(std::vector<char> *data) {
+  unsigned int len;
+  if (!getU32(&len) || (pos + len > buf.size())) {
+    return false;
+  }
+  data->assign(buf.begin() + pos, buf.begin() + pos + len);
+  pos += len;
+  return true;
+}
+
+} // namespace oclc
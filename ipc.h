@@ -0,0 +1,56 @@
+//
+// Message passing over pipe/socket file descriptors(POSIX only).
+//
+#ifndef OCLC_IPC_H
+#define OCLC_IPC_H
+
+#include <string>
+#include <vector>
+
+namespace oclc {
+
+//  Function: writeFull
+//  Writes `len` bytes to `fd`, retrying on partial write and EINTR.
+bool writeFull(int fd, const void *buf, size_t len);
+
+//  Function: readFull
+//  Reads exactly `len` bytes from `fd`. Returns false on EOF or error.
+bool readFull(int fd, void *buf, size_t len);
+
+//  Function: sendMessage
+//  Sends length-prefixed message.
+bool sendMessage(int fd, const std::string &msg);
+
+//  Function: recvMessage
+//  Receives length-prefixed message sent by sendMessage().
+bool recvMessage(int fd, std::string *msg);
+
+// Helpers to (de)serialize message fields.
+class MessageWriter {
+public:
+  void putU32(unsigned int val);
+  void putString(const std::string &str);
+  void putBytes(const std::vector<char> &data);
+
+  const std::string &data() const { return buf; }
+
+private:
+  std::string buf;
+};
+
+class MessageReader {
+public:
+  explicit MessageReader(const std::string &msg) : buf(msg), pos(0) {}
+
+  bool getU32(unsigned int *val);
+  bool getString(std::string *str);
+  bool getBytes(std::vector<char> *data);
+
+private:
+  const std::string &buf;
+  size_t pos;
+};
+
+} // namespace oclc
+
+#endif // OCLC_IPC_H
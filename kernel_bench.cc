@@ -0,0 +1,830 @@
+//
+// Kernel execution benchmark(--bench).
+//
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <sstream>
+
+#include "kernel_bench.h"
+#include "compile_job.h"
+
+namespace oclc {
+
+namespace {
+
+struct TypeInfo {
+  const char *name;
+  size_t size;
+  bool isFloat;
+};
+
+const TypeInfo kTypes[] = {
+    {"char", 1, false},  {"uchar", 1, false}, {"short", 2, false},
+    {"ushort", 2, false}, {"int", 4, false},  {"uint", 4, false},
+    {"long", 8, false},  {"ulong", 8, false}, {"float", 4, true},
+    {"double", 8, true},
+};
+
+const TypeInfo *findType(const std::string &name) {
+  for (size_t i = 0; i < sizeof(kTypes) / sizeof(kTypes[0]); i++) {
+    if (name == kTypes[i].name) {
+      return &kTypes[i];
+    }
+  }
+  return NULL;
+}
+
+template <typename T> void storeAs(double v, unsigned char *dst) {
+  T t = T(v);
+  memcpy(dst, &t, sizeof(T));
+}
+
+// Stores `v` converted to `type` at `dst`.
+void storeValue(const std::string &type, double v, unsigned char *dst) {
+  if (type == "char") {
+    storeAs<signed char>(v, dst);
+  } else if (type == "uchar") {
+    storeAs<unsigned char>(v, dst);
+  } else if (type == "short") {
+    storeAs<short>(v, dst);
+  } else if (type == "ushort") {
+    storeAs<unsigned short>(v, dst);
+  } else if (type == "int") {
+    storeAs<int>(v, dst);
+  } else if (type == "uint") {
+    storeAs<unsigned int>(v, dst);
+  } else if (type == "long") {
+    storeAs<long long>(v, dst);
+  } else if (type == "ulong") {
+    storeAs<unsigned long long>(v, dst);
+  } else if (type == "float") {
+    storeAs<float>(v, dst);
+  } else if (type == "double") {
+    storeAs<double>(v, dst);
+  }
+}
+
+template <typename T> double loadAs(const unsigned char *src) {
+  T t;
+  memcpy(&t, src, sizeof(T));
+  return double(t);
+}
+
+// Loads the value of `type` at `src` as double.
+double loadValue(const std::string &type, const unsigned char *src) {
+  if (type == "char") {
+    return loadAs<signed char>(src);
+  } else if (type == "uchar") {
+    return loadAs<unsigned char>(src);
+  } else if (type == "short") {
+    return loadAs<short>(src);
+  } else if (type == "ushort") {
+    return loadAs<unsigned short>(src);
+  } else if (type == "int") {
+    return loadAs<int>(src);
+  } else if (type == "uint") {
+    return loadAs<unsigned int>(src);
+  } else if (type == "long") {
+    return loadAs<long long>(src);
+  } else if (type == "ulong") {
+    return loadAs<unsigned long long>(src);
+  } else if (type == "float") {
+    return loadAs<float>(src);
+  } else if (type == "double") {
+    return loadAs<double>(src);
+  }
+  return 0.0;
+}
+
+bool parseNumber(const std::string &s, double *v) {
+  if (s.empty()) {
+    return false;
+  }
+  char *end = NULL;
+  (*v) = strtod(s.c_str(), &end);
+  return (*end == '\0');
+}
+
+bool parseCount(const std::string &s, size_t *n) {
+  if (s.empty() || (s[0] == '-')) {
+    return false;
+  }
+  char *end = NULL;
+  unsigned long long v = strtoull(s.c_str(), &end, 10);
+  if ((*end != '\0') || (v == 0)) {
+    return false;
+  }
+  (*n) = size_t(v);
+  return true;
+}
+
+// Fills host data of the buffer argument. `seed` makes `rand` reproducible.
+void fillBuffer(const KernelArg &arg, unsigned int seed,
+                std::vector<unsigned char> *data) {
+  data->resize(arg.count * arg.typeSize);
+
+  const TypeInfo *info = findType(arg.type);
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<double> unit(0.0, 1.0);
+  std::uniform_int_distribution<int> small(0, 99);
+
+  double constant = 0.0;
+  bool isConstant = parseNumber(arg.fill, &constant);
+
+  for (size_t i = 0; i < arg.count; i++) {
+    double v = 0.0;
+    if (isConstant) {
+      v = constant;
+    } else if (arg.fill == "iota") {
+      v = double(i);
+    } else if (arg.fill == "rand") {
+      v = info->isFloat ? unit(rng) : double(small(rng));
+    }
+    storeValue(arg.type, v, &data->at(i * arg.typeSize));
+  }
+}
+
+// Kernel with its arguments allocated and filled.
+class BenchKernel {
+public:
+  explicit BenchKernel(muda::MUDADeviceOCL *device)
+      : kernel(NULL), bytesPerLaunch(0.0), device(device) {}
+  ~BenchKernel() {
+    for (size_t i = 0; i < mems.size(); i++) {
+      device->free(mems[i]);
+    }
+    if (kernel) {
+      device->releaseKernel(kernel);
+    }
+  }
+
+  bool setup(muda::MUDAProgram program, const KernelBenchConfig &config,
+             std::string *err) {
+    kernel = device->createKernel(program, config.kernelName.c_str());
+    if (!kernel) {
+      (*err) = "Kernel `" + config.kernelName + "' not found in the program.";
+      return false;
+    }
+
+    for (size_t i = 0; i < config.args.size(); i++) {
+      const KernelArg &arg = config.args[i];
+      size_t bytes = arg.count * arg.typeSize;
+
+      bool ok;
+      if (arg.kind == KernelArg::SCALAR) {
+        std::vector<unsigned char> value = arg.value;
+        ok = device->setArg(kernel, int(i), value.size(), arg.typeSize,
+                            &value.at(0));
+      } else if (arg.kind == KernelArg::LOCAL) {
+        ok = device->setArg(kernel, int(i), bytes, arg.typeSize, NULL);
+      } else {
+        muda::MUDAMemory mem =
+            device->alloc(muda::device_global, arg.attrib, bytes);
+        ok = (mem != NULL);
+        if (ok) {
+          mems.push_back(mem);
+          memArgs.push_back(i);
+
+          std::vector<unsigned char> data;
+          fillBuffer(arg, unsigned(i + 1), &data);
+          ok = device->write(0, mem, bytes, &data.at(0)) &&
+               device->bindMemoryObject(kernel, int(i), mem);
+        }
+
+        // Assume that the kernel reads/writes each element once.
+        bytesPerLaunch +=
+            double(bytes) * ((arg.attrib == muda::rw) ? 2.0 : 1.0);
+      }
+
+      if (!ok) {
+        std::stringstream ss;
+        ss << "Failed to set kernel argument " << i << ".";
+        (*err) = ss.str();
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  // Runs `warmup` + `iterations` times, and appends device time of the timed
+  // runs to `msec`.
+  bool run(const KernelBenchConfig &config, const size_t local[3], int warmup,
+           int iterations, std::vector<double> *msec) {
+    for (int i = 0; i < warmup + iterations; i++) {
+      double t = 0.0;
+      if (!device->execute(0, kernel, config.dimension, config.global[0],
+                           config.global[1], config.global[2], local[0],
+                           local[1], local[2], &t)) {
+        return false;
+      }
+      if (i >= warmup) {
+        msec->push_back(t);
+      }
+    }
+    return true;
+  }
+
+  // Reads `out` and `buf` buffers(in argument order).
+  bool readOutputs(const KernelBenchConfig &config,
+                   std::vector<std::vector<unsigned char> > *outputs) {
+    outputs->clear();
+    for (size_t i = 0; i < mems.size(); i++) {
+      const KernelArg &arg = config.args[memArgs[i]];
+      if (arg.attrib == muda::ro) {
+        continue;
+      }
+      outputs->push_back(std::vector<unsigned char>());
+      std::vector<unsigned char> &data = outputs->back();
+      data.resize(arg.count * arg.typeSize);
+      if (!device->read(0, mems[i], data.size(), &data.at(0))) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  muda::MUDAKernel kernel;
+  double bytesPerLaunch; // Bytes of buffers read and written by a launch.
+
+private:
+  muda::MUDADeviceOCL *device;
+  std::vector<muda::MUDAMemory> mems;
+  std::vector<size_t> memArgs; // Argument index of each memory.
+};
+
+std::string formatSizes(int dimension, const size_t sizes[3]) {
+  if (sizes[0] == 0) {
+    return "(driver)";
+  }
+  std::stringstream ss;
+  for (int i = 0; i < dimension; i++) {
+    ss << (i ? "," : "") << sizes[i];
+  }
+  return ss.str();
+}
+
+// Returns max error of `outputs` against `reference`(both read by
+// BenchKernel::readOutputs()). Error of floating point values is relative
+// (absolute below 1.0), and NaN/Inf must match exactly.
+double compareOutputs(const KernelBenchConfig &config,
+                      const std::vector<std::vector<unsigned char> > &reference,
+                      const std::vector<std::vector<unsigned char> > &outputs) {
+  double maxError = 0.0;
+  size_t n = 0;
+  for (size_t i = 0; i < config.args.size(); i++) {
+    const KernelArg &arg = config.args[i];
+    if ((arg.kind != KernelArg::BUFFER) || (arg.attrib == muda::ro)) {
+      continue;
+    }
+    if ((n >= reference.size()) || (n >= outputs.size())) {
+      break;
+    }
+
+    for (size_t k = 0; k < arg.count; k++) {
+      double a = loadValue(arg.type, &reference[n].at(k * arg.typeSize));
+      double b = loadValue(arg.type, &outputs[n].at(k * arg.typeSize));
+      double err;
+      if (std::isfinite(a) && std::isfinite(b)) {
+        err = std::fabs(a - b) / std::max(std::fabs(a), 1.0);
+      } else {
+        bool same = (std::isnan(a) && std::isnan(b)) || (a == b);
+        err = same ? 0.0 : std::numeric_limits<double>::infinity();
+      }
+      maxError = std::max(maxError, err);
+    }
+    n++;
+  }
+  return maxError;
+}
+
+// Flags implied by another flag(OpenCL 1.1 spec 5.6.4.3). Combining them is
+// redundant.
+bool isRedundantFlagSet(const std::vector<std::string> &flags) {
+  static const char *kImplied[][2] = {
+      {"-cl-fast-relaxed-math", "-cl-mad-enable"},
+      {"-cl-fast-relaxed-math", "-cl-no-signed-zeros"},
+      {"-cl-fast-relaxed-math", "-cl-unsafe-math-optimizations"},
+      {"-cl-fast-relaxed-math", "-cl-finite-math-only"},
+      {"-cl-unsafe-math-optimizations", "-cl-mad-enable"},
+      {"-cl-unsafe-math-optimizations", "-cl-no-signed-zeros"},
+  };
+  for (size_t i = 0; i < sizeof(kImplied) / sizeof(kImplied[0]); i++) {
+    if ((std::find(flags.begin(), flags.end(), kImplied[i][0]) !=
+         flags.end()) &&
+        (std::find(flags.begin(), flags.end(), kImplied[i][1]) !=
+         flags.end())) {
+      return true;
+    }
+  }
+  return false;
+}
+
+std::string joinFlags(const std::vector<std::string> &flags) {
+  std::string s;
+  for (size_t i = 0; i < flags.size(); i++) {
+    s += (i ? " " : "") + flags[i];
+  }
+  return s;
+}
+
+// Successful candidates first, faster first.
+bool lessMedian(const LocalSizeCandidate &a, const LocalSizeCandidate &b) {
+  if (a.success != b.success) {
+    return a.success;
+  }
+  return a.stats.median < b.stats.median;
+}
+
+} // namespace
+
+bool parseKernelArg(const std::string &spec, KernelArg *arg,
+                    std::string *err) {
+  std::vector<std::string> fields;
+  {
+    std::stringstream ss(spec);
+    std::string field;
+    while (std::getline(ss, field, ':')) {
+      fields.push_back(field);
+    }
+  }
+
+  if (fields.size() < 2) {
+    (*err) = "Invalid kernel argument: " + spec;
+    return false;
+  }
+
+  const std::string &kind = fields[0];
+  if ((kind == "in") || (kind == "out") || (kind == "buf") ||
+      (kind == "local")) {
+    if ((fields.size() < 3) || (fields.size() > 4) ||
+        ((kind == "local") && (fields.size() != 3))) {
+      (*err) = "Invalid kernel argument: " + spec;
+      return false;
+    }
+
+    const TypeInfo *info = findType(fields[1]);
+    if (!info) {
+      (*err) = "Unknown type `" + fields[1] + "` in kernel argument: " + spec;
+      return false;
+    }
+    arg->type = info->name;
+    arg->typeSize = info->size;
+
+    if (!parseCount(fields[2], &arg->count)) {
+      (*err) = "Invalid # of elements in kernel argument: " + spec;
+      return false;
+    }
+
+    if (kind == "local") {
+      arg->kind = KernelArg::LOCAL;
+      return true;
+    }
+
+    arg->kind = KernelArg::BUFFER;
+    arg->attrib = (kind == "in") ? muda::ro
+                                 : ((kind == "out") ? muda::wo : muda::rw);
+    arg->fill = (kind == "out") ? "zero" : "rand";
+    if (fields.size() == 4) {
+      double v;
+      if ((fields[3] != "zero") && (fields[3] != "iota") &&
+          (fields[3] != "rand") && !parseNumber(fields[3], &v)) {
+        (*err) = "Invalid fill `" + fields[3] + "` in kernel argument: " + spec;
+        return false;
+      }
+      arg->fill = fields[3];
+    }
+    return true;
+  }
+
+  // Scalar.
+  const TypeInfo *info = findType(fields[0]);
+  double v;
+  if (!info || (fields.size() != 2) || !parseNumber(fields[1], &v)) {
+    (*err) = "Invalid kernel argument: " + spec;
+    return false;
+  }
+  arg->kind = KernelArg::SCALAR;
+  arg->type = info->name;
+  arg->typeSize = info->size;
+  arg->value.resize(info->size);
+  storeValue(arg->type, v, &arg->value.at(0));
+
+  return true;
+}
+
+int parseSizes(const std::string &s, size_t sizes[3]) {
+  sizes[0] = sizes[1] = sizes[2] = 1;
+
+  std::stringstream ss(s);
+  std::string field;
+  int n = 0;
+  while (std::getline(ss, field, ',')) {
+    if ((n >= 3) || !parseCount(field, &sizes[n])) {
+      return 0;
+    }
+    n++;
+  }
+
+  return n;
+}
+
+bool runKernelBench(muda::MUDADeviceOCL *device, muda::MUDAProgram program,
+                    const KernelBenchConfig &config, KernelBenchResult *result,
+                    std::string *err) {
+  BenchKernel bench(device);
+  if (!bench.setup(program, config, err)) {
+    return false;
+  }
+  result->bytesPerLaunch = bench.bytesPerLaunch;
+
+  result->msec.clear();
+  if (!bench.run(config, config.local, config.warmup, config.iterations,
+                 &result->msec)) {
+    (*err) = "Failed to execute kernel: " + config.kernelName;
+    return false;
+  }
+
+  result->stats = computeSampleStats(result->msec);
+  return true;
+}
+
+void printKernelBench(const KernelBenchConfig &config,
+                      const KernelBenchResult &result) {
+  printf("[oclc] Kernel %s: global %s, local %s, %d warm-up + %d iterations\n",
+         config.kernelName.c_str(),
+         formatSizes(config.dimension, config.global).c_str(),
+         (config.local[0] == 0)
+             ? "(auto)"
+             : formatSizes(config.dimension, config.local).c_str(),
+         config.warmup, config.iterations);
+
+  const SampleStats &s = result.stats;
+  printf("[oclc]   time(ms):   median %.4f  mean %.4f  min %.4f  max %.4f\n",
+         s.median, s.mean, s.min, s.max);
+  printf("[oclc]   variance:   stddev %.4f ms(%.1f%% of mean)\n", s.stddev,
+         (s.mean > 0.0) ? 100.0 * s.stddev / s.mean : 0.0);
+
+  if (s.median > 0.0) {
+    double items = double(config.global[0]) * double(config.global[1]) *
+                   double(config.global[2]);
+    double sec = s.median * 1.0e-3;
+    printf("[oclc]   throughput: %.2f Mitems/s", items / sec * 1.0e-6);
+    if (result.bytesPerLaunch > 0.0) {
+      printf(", %.2f GB/s(%.2f MB per launch)",
+             result.bytesPerLaunch / sec * 1.0e-9,
+             result.bytesPerLaunch * 1.0e-6);
+    }
+    printf("\n");
+  }
+}
+
+void enumerateLocalSizes(const muda::MUDAWorkGroupLimits &limits,
+                         int dimension, const size_t global[3],
+                         std::vector<LocalSizeCandidate> *candidates) {
+  // Legal sizes of each dimension: powers of two and multiples of the
+  // preferred multiple, which divide the global size(OpenCL 1.x).
+  std::vector<size_t> sizes[3];
+  for (int d = 0; d < 3; d++) {
+    if (d >= dimension) {
+      sizes[d].push_back(1);
+      continue;
+    }
+    size_t maxSize =
+        std::min(limits.maxWorkItemSizes[d], limits.maxWorkGroupSize);
+    for (size_t n = 1; n <= maxSize; n++) {
+      bool isPow2 = ((n & (n - 1)) == 0);
+      bool isMultiple = ((n % limits.preferredMultiple) == 0);
+      if ((isPow2 || isMultiple) && ((global[d] % n) == 0)) {
+        sizes[d].push_back(n);
+      }
+    }
+  }
+
+  std::vector<LocalSizeCandidate> all;
+  for (size_t x = 0; x < sizes[0].size(); x++) {
+    for (size_t y = 0; y < sizes[1].size(); y++) {
+      for (size_t z = 0; z < sizes[2].size(); z++) {
+        LocalSizeCandidate c;
+        c.local[0] = sizes[0][x];
+        c.local[1] = sizes[1][y];
+        c.local[2] = sizes[2][z];
+        if (c.local[0] * c.local[1] * c.local[2] <= limits.maxWorkGroupSize) {
+          all.push_back(c);
+        }
+      }
+    }
+  }
+
+  // Work-groups smaller than the preferred multiple leave SIMD lanes idle, so
+  // they are tried only when nothing else is legal.
+  candidates->clear();
+  for (size_t i = 0; i < all.size(); i++) {
+    const size_t *l = all[i].local;
+    if (l[0] * l[1] * l[2] >= limits.preferredMultiple) {
+      candidates->push_back(all[i]);
+    }
+  }
+  if (candidates->empty()) {
+    candidates->swap(all);
+  }
+}
+
+bool tuneLocalSize(muda::MUDADeviceOCL *device, muda::MUDAProgram program,
+                   const KernelBenchConfig &config, LocalSizeTuneResult *result,
+                   std::string *err) {
+  BenchKernel bench(device);
+  if (!bench.setup(program, config, err)) {
+    return false;
+  }
+
+  if (!device->getWorkGroupLimits(bench.kernel, &result->limits)) {
+    (*err) = "Failed to get work-group size limits of kernel: " +
+             config.kernelName;
+    return false;
+  }
+
+  // The driver's choice is the baseline.
+  result->candidates.clear();
+  result->candidates.push_back(LocalSizeCandidate());
+  std::vector<LocalSizeCandidate> legal;
+  enumerateLocalSizes(result->limits, config.dimension, config.global, &legal);
+  result->candidates.insert(result->candidates.end(), legal.begin(),
+                            legal.end());
+
+  for (size_t i = 0; i < result->candidates.size(); i++) {
+    LocalSizeCandidate &c = result->candidates[i];
+    std::vector<double> msec;
+    // A local size may still fail, e.g. with CL_OUT_OF_RESOURCES.
+    c.success =
+        bench.run(config, c.local, config.warmup, config.iterations, &msec);
+    if (c.success) {
+      c.stats = computeSampleStats(msec);
+    }
+  }
+
+  std::stable_sort(result->candidates.begin(), result->candidates.end(),
+                   lessMedian);
+
+  if (!result->candidates[0].success) {
+    (*err) = "Failed to execute kernel: " + config.kernelName;
+    return false;
+  }
+
+  return true;
+}
+
+void printLocalSizeTune(const KernelBenchConfig &config,
+                        const LocalSizeTuneResult &result) {
+  printf("[oclc] Tuned kernel %s: global %s, %d local sizes(max work-group "
+         "size %d, preferred multiple %d)\n",
+         config.kernelName.c_str(),
+         formatSizes(config.dimension, config.global).c_str(),
+         int(result.candidates.size()), int(result.limits.maxWorkGroupSize),
+         int(result.limits.preferredMultiple));
+  printf("[oclc]   %-16s %12s %12s\n", "local", "median(ms)", "stddev(ms)");
+
+  const LocalSizeCandidate *driver = NULL;
+  const int kMaxRows = 10;
+  for (size_t i = 0; i < result.candidates.size(); i++) {
+    const LocalSizeCandidate &c = result.candidates[i];
+    if (c.local[0] == 0) {
+      driver = &c;
+    }
+    if ((int(i) >= kMaxRows) && (c.local[0] != 0)) {
+      continue;
+    }
+    if (c.success) {
+      printf("[oclc]   %-16s %12.4f %12.4f\n",
+             formatSizes(config.dimension, c.local).c_str(), c.stats.median,
+             c.stats.stddev);
+    } else {
+      printf("[oclc]   %-16s %12s\n",
+             formatSizes(config.dimension, c.local).c_str(), "FAILED");
+    }
+  }
+
+  const LocalSizeCandidate &best = result.candidates[0];
+  printf("[oclc] Best local size: %s(%.4f ms",
+         formatSizes(config.dimension, best.local).c_str(), best.stats.median);
+  if (driver && driver->success && (best.stats.median > 0.0)) {
+    printf(", %.2fx of driver's choice", driver->stats.median /
+                                              best.stats.median);
+  }
+  printf(")\n");
+}
+
+// Builds the program with `flags`, checks the outputs against `reference`
+// and measures the kernel time. The first call(empty `reference`) sets the
+// reference.
+static void evaluateFlagSet(
+    muda::MUDADeviceOCL *device, const std::string &input,
+    const CompileOptions &options, const KernelBenchConfig &config,
+    const FlagTuneConfig &tuneConfig, const std::vector<std::string> &flags,
+    std::vector<std::vector<unsigned char> > *reference, FlagSetResult *out) {
+  out->flags = joinFlags(flags);
+
+  CompileOptions opts = options;
+  if (!flags.empty()) {
+    opts.clopt += " " + out->flags;
+  }
+
+  std::string log;
+  // Released when this flag set is done, since many programs are built.
+  muda::MUDAProgramHandle program(device,
+                                  buildProgram(device, input, opts, &log));
+  if (!program) {
+    out->status = FlagSetResult::BUILD_FAILED;
+    return;
+  }
+
+  {
+    BenchKernel bench(device);
+    std::string err;
+    std::vector<double> msec;
+    std::vector<std::vector<unsigned char> > outputs;
+
+    // First launch on the initial data is checked.
+    if (!bench.setup(program.get(), config, &err) ||
+        !bench.run(config, config.local, 0, 1, &msec) ||
+        !bench.readOutputs(config, &outputs)) {
+      out->status = FlagSetResult::EXEC_FAILED;
+    } else {
+      if (reference->empty()) {
+        reference->swap(outputs);
+      } else {
+        out->maxError = compareOutputs(config, *reference, outputs);
+      }
+
+      if (out->maxError > tuneConfig.tolerance) {
+        out->status = FlagSetResult::MISMATCH;
+      } else {
+        msec.clear();
+        if (bench.run(config, config.local, config.warmup, config.iterations,
+                      &msec)) {
+          out->stats = computeSampleStats(msec);
+          out->status = FlagSetResult::OK;
+        } else {
+          out->status = FlagSetResult::EXEC_FAILED;
+        }
+      }
+    }
+  }
+}
+
+bool tuneCompilerFlags(muda::MUDADeviceOCL *device, const std::string &input,
+                       const CompileOptions &options,
+                       const KernelBenchConfig &config,
+                       const FlagTuneConfig &tuneConfig, FlagTuneResult *result,
+                       std::string *err) {
+  std::vector<std::vector<unsigned char> > reference;
+  result->results.clear();
+  result->best = -1;
+
+  // Baseline: `--clopt` only. Its outputs are the reference.
+  result->results.push_back(FlagSetResult());
+  evaluateFlagSet(device, input, options, config, tuneConfig,
+                  std::vector<std::string>(), &reference,
+                  &result->results[0]);
+  if (result->results[0].status != FlagSetResult::OK) {
+    (*err) = "Failed to build or run kernel without flags: " +
+             config.kernelName;
+    return false;
+  }
+  const SampleStats base = result->results[0].stats;
+
+  // Each flag alone. Flags which break the outputs or clearly slow down the
+  // kernel are not combined.
+  std::vector<std::string> survivors;
+  std::vector<double> survivorMedians;
+  for (size_t i = 0; i < tuneConfig.flags.size(); i++) {
+    std::vector<std::string> flags(1, tuneConfig.flags[i]);
+    FlagSetResult r;
+    evaluateFlagSet(device, input, options, config, tuneConfig, flags,
+                    &reference, &r);
+    if ((r.status == FlagSetResult::OK) &&
+        (r.stats.median > base.median * tuneConfig.pruneRatio) &&
+        (r.stats.median - base.median > 2.0 * base.stddev)) {
+      r.status = FlagSetResult::PRUNED;
+    }
+    if (r.status == FlagSetResult::OK) {
+      survivors.push_back(tuneConfig.flags[i]);
+      survivorMedians.push_back(r.stats.median);
+    }
+    result->results.push_back(r);
+  }
+
+  if (survivors.size() <= tuneConfig.maxExhaustiveFlags) {
+    // Every combination of two or more surviving flags.
+    for (size_t mask = 1; mask < (size_t(1) << survivors.size()); mask++) {
+      std::vector<std::string> flags;
+      for (size_t i = 0; i < survivors.size(); i++) {
+        if (mask & (size_t(1) << i)) {
+          flags.push_back(survivors[i]);
+        }
+      }
+      if ((flags.size() < 2) || isRedundantFlagSet(flags)) {
+        continue;
+      }
+      FlagSetResult r;
+      evaluateFlagSet(device, input, options, config, tuneConfig, flags,
+                      &reference, &r);
+      result->results.push_back(r);
+    }
+  } else {
+    // Greedy: start from the fastest single flag, and add the flag which
+    // improves the current set most, until no flag improves it.
+    size_t first = size_t(
+        std::min_element(survivorMedians.begin(), survivorMedians.end()) -
+        survivorMedians.begin());
+    std::vector<std::string> current(1, survivors[first]);
+    double currentMedian = survivorMedians[first];
+    survivors.erase(survivors.begin() + first);
+    while (!survivors.empty()) {
+      int bestFlag = -1;
+      double bestMedian = currentMedian;
+      for (size_t i = 0; i < survivors.size(); i++) {
+        std::vector<std::string> flags = current;
+        flags.push_back(survivors[i]);
+        if (isRedundantFlagSet(flags)) {
+          continue;
+        }
+        FlagSetResult r;
+        evaluateFlagSet(device, input, options, config, tuneConfig, flags,
+                        &reference, &r);
+        result->results.push_back(r);
+        if ((r.status == FlagSetResult::OK) && (r.stats.median < bestMedian)) {
+          bestFlag = int(i);
+          bestMedian = r.stats.median;
+        }
+      }
+      if (bestFlag < 0) {
+        break;
+      }
+      current.push_back(survivors[size_t(bestFlag)]);
+      survivors.erase(survivors.begin() + bestFlag);
+      currentMedian = bestMedian;
+    }
+  }
+
+  for (size_t i = 0; i < result->results.size(); i++) {
+    const FlagSetResult &r = result->results[i];
+    if ((r.status == FlagSetResult::OK) &&
+        ((result->best < 0) ||
+         (r.stats.median < result->results[size_t(result->best)].stats.median))) {
+      result->best = int(i);
+    }
+  }
+
+  return true;
+}
+
+void printFlagTune(const KernelBenchConfig &config,
+                   const FlagTuneConfig &tuneConfig,
+                   const FlagTuneResult &result) {
+  printf("[oclc] Tuned compiler flags of kernel %s: %d flag sets, tolerance "
+         "%g\n",
+         config.kernelName.c_str(), int(result.results.size()),
+         tuneConfig.tolerance);
+  printf("[oclc]   %-10s %8s %10s  %s\n", "median(ms)", "speedup", "max error",
+         "flags");
+
+  double base = result.results[0].stats.median;
+  for (size_t i = 0; i < result.results.size(); i++) {
+    const FlagSetResult &r = result.results[i];
+    const char *flags = r.flags.empty() ? "(none)" : r.flags.c_str();
+    switch (r.status) {
+    case FlagSetResult::OK:
+    case FlagSetResult::PRUNED:
+      printf("[oclc]   %10.4f %7.2fx %10.2g  %s%s\n", r.stats.median,
+             (r.stats.median > 0.0) ? base / r.stats.median : 0.0, r.maxError,
+             flags, (r.status == FlagSetResult::PRUNED) ? "  (pruned)" : "");
+      break;
+    case FlagSetResult::MISMATCH:
+      printf("[oclc]   %10s %8s %10.2g  %s\n", "MISMATCH", "", r.maxError,
+             flags);
+      break;
+    case FlagSetResult::BUILD_FAILED:
+      printf("[oclc]   %10s %8s %10s  %s\n", "BUILD FAIL", "", "", flags);
+      break;
+    case FlagSetResult::EXEC_FAILED:
+      printf("[oclc]   %10s %8s %10s  %s\n", "EXEC FAIL", "", "", flags);
+      break;
+    }
+  }
+
+  if (result.best >= 0) {
+    const FlagSetResult &best = result.results[size_t(result.best)];
+    printf("[oclc] Fastest passing flags: %s(%.4f ms, %.2fx)\n",
+           best.flags.empty() ? "(none)" : best.flags.c_str(),
+           best.stats.median,
+           (best.stats.median > 0.0) ? base / best.stats.median : 0.0);
+  }
+}
+
+} // namespace oclc
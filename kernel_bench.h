@@ -0,0 +1,182 @@
+//
+// Kernel execution benchmark(--bench).
+//
+#ifndef OCLC_KERNEL_BENCH_H
+#define OCLC_KERNEL_BENCH_H
+
+#include <string>
+#include <vector>
+
+#include "muda_runtime.h"
+#include "bench_stats.h"
+
+namespace oclc {
+
+// Kernel argument given by --arg. Spec is one of
+//
+//   in:TYPE:N[:FILL]    Read only buffer of N elements.
+//   out:TYPE:N[:FILL]   Write only buffer of N elements.
+//   buf:TYPE:N[:FILL]   Read/write buffer of N elements.
+//   local:TYPE:N        __local memory of N elements.
+//   TYPE:VALUE          Scalar.
+//
+// TYPE is char, uchar, short, ushort, int, uint, long, ulong, float or double.
+// FILL is zero, iota, rand or a value. default: rand(zero for out).
+struct KernelArg {
+  enum Kind { BUFFER, LOCAL, SCALAR };
+
+  Kind kind;
+  muda::MUDAMemoryAttrib attrib; // BUFFER only.
+  std::string type;
+  size_t typeSize;
+  size_t count;      // # of elements(BUFFER and LOCAL).
+  std::string fill;  // BUFFER only.
+  std::vector<unsigned char> value; // SCALAR only.
+
+  KernelArg()
+      : kind(SCALAR), attrib(muda::rw), typeSize(0), count(0) {}
+};
+
+//  Function: parseKernelArg
+//  Parses --arg spec. Returns false with the reason in `err` when invalid.
+bool parseKernelArg(const std::string &spec, KernelArg *arg, std::string *err);
+
+//  Function: parseSizes
+//  Parses "X[,Y[,Z]]" of --global/--local. Returns # of dimensions, or 0 when
+//  invalid. Omitted dimensions are set to 1.
+int parseSizes(const std::string &s, size_t sizes[3]);
+
+struct KernelBenchConfig {
+  std::string kernelName;
+  int dimension;
+  size_t global[3];
+  size_t local[3]; // local[0] == 0 lets the driver choose.
+  std::vector<KernelArg> args;
+  int warmup;
+  int iterations;
+
+  KernelBenchConfig() : dimension(1), warmup(3), iterations(10) {
+    for (int i = 0; i < 3; i++) {
+      global[i] = 1;
+      local[i] = 0;
+    }
+  }
+};
+
+struct KernelBenchResult {
+  std::vector<double> msec; // Device time of each timed iteration.
+  SampleStats stats;
+  double bytesPerLaunch;    // Bytes of buffers read and written by a launch.
+
+  KernelBenchResult() : bytesPerLaunch(0.0) {}
+};
+
+//  Function: runKernelBench
+//  Creates the kernel from `program`, allocates and fills its arguments, and
+//  runs warm-up and timed iterations on the current device. Time is measured
+//  with profiling events, so setKernelProfiling(true) must be called before
+//  the program was loaded.
+bool runKernelBench(muda::MUDADeviceOCL *device, muda::MUDAProgram program,
+                    const KernelBenchConfig &config, KernelBenchResult *result,
+                    std::string *err);
+
+//  Function: printKernelBench
+//  Prints kernel time, throughput and run-to-run variance.
+void printKernelBench(const KernelBenchConfig &config,
+                      const KernelBenchResult &result);
+
+// Local size tried by tuneLocalSize().
+struct LocalSizeCandidate {
+  size_t local[3]; // All 0 = driver's choice.
+  bool success;
+  SampleStats stats;
+
+  LocalSizeCandidate() : success(false) {
+    local[0] = local[1] = local[2] = 0;
+  }
+};
+
+struct LocalSizeTuneResult {
+  muda::MUDAWorkGroupLimits limits;
+  std::vector<LocalSizeCandidate> candidates; // Fastest first.
+};
+
+//  Function: enumerateLocalSizes
+//  Returns legal local sizes for the global size within `limits`. Each
+//  dimension is a power of two or a multiple of the preferred multiple, and
+//  divides the global size.
+void enumerateLocalSizes(const muda::MUDAWorkGroupLimits &limits,
+                         int dimension, const size_t global[3],
+                         std::vector<LocalSizeCandidate> *candidates);
+
+//  Function: tuneLocalSize
+//  Runs the kernel of `config` with the driver's choice and every legal local
+//  size(`config.local` is ignored), and sorts them by median kernel time.
+//  Same requirements as runKernelBench().
+bool tuneLocalSize(muda::MUDADeviceOCL *device, muda::MUDAProgram program,
+                   const KernelBenchConfig &config, LocalSizeTuneResult *result,
+                   std::string *err);
+
+//  Function: printLocalSizeTune
+//  Prints the fastest local sizes.
+void printLocalSizeTune(const KernelBenchConfig &config,
+                        const LocalSizeTuneResult &result);
+
+struct FlagTuneConfig {
+  std::vector<std::string> flags; // Candidate flags.
+  double tolerance; // Max error of outputs(relative, absolute below 1.0).
+  double pruneRatio; // A flag slower than baseline * ratio is not combined.
+  size_t maxExhaustiveFlags; // Above this, flags are combined greedily.
+
+  FlagTuneConfig() : tolerance(1.0e-3), pruneRatio(1.05), maxExhaustiveFlags(6) {
+    flags.push_back("-cl-fast-relaxed-math");
+    flags.push_back("-cl-mad-enable");
+    flags.push_back("-cl-no-signed-zeros");
+    flags.push_back("-cl-unsafe-math-optimizations");
+    flags.push_back("-cl-denorms-are-zero");
+  }
+};
+
+// Flag set tried by tuneCompilerFlags().
+struct FlagSetResult {
+  enum Status { OK, PRUNED, MISMATCH, BUILD_FAILED, EXEC_FAILED };
+
+  std::string flags; // Added to --clopt. Empty for the baseline.
+  Status status;
+  double maxError; // Against outputs of the baseline.
+  SampleStats stats;
+
+  FlagSetResult() : status(BUILD_FAILED), maxError(0.0) {}
+};
+
+struct FlagTuneResult {
+  std::vector<FlagSetResult> results; // In evaluation order. [0] is baseline.
+  int best; // Index of the fastest passing flag set.
+
+  FlagTuneResult() : best(-1) {}
+};
+
+struct CompileOptions;
+
+//  Function: tuneCompilerFlags
+//  Builds `input` with the baseline(`options.clopt`), each candidate flag and
+//  combinations of flags which neither broke the outputs nor clearly slowed
+//  down the kernel. For each build, outputs(`out` and `buf` arguments) of
+//  the first launch are compared with the baseline, and the kernel is timed
+//  like runKernelBench().
+bool tuneCompilerFlags(muda::MUDADeviceOCL *device, const std::string &input,
+                       const CompileOptions &options,
+                       const KernelBenchConfig &config,
+                       const FlagTuneConfig &tuneConfig, FlagTuneResult *result,
+                       std::string *err);
+
+//  Function: printFlagTune
+//  Prints time, speedup and error of each flag set, and the fastest passing
+//  one.
+void printFlagTune(const KernelBenchConfig &config,
+                   const FlagTuneConfig &tuneConfig,
+                   const FlagTuneResult &result);
+
+} // namespace oclc
+
+#endif // OCLC_KERNEL_BENCH_H
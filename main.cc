@@ -4,7 +4,15 @@
 #include <cassert>
 #include <string>
 #include <fstream>
+#include <sstream>
 #include <vector>
+#include <algorithm>
+#include <list>
+#include <memory>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <condition_variable>
 
 #ifdef _WIN32
 #include <sys/types.h>
@@ -19,11 +27,22 @@
 #include "clew.h"
 
 #include "muda_runtime.h"
-//#include "timerutil.h"
+#include "compile_job.h"
+#include "thread_pool.h"
+#include "worker_pool.h"
+#include "device_matrix.h"
+#include "binary_cache.h"
+#include "compile_server.h"
+#include "watch.h"
+#include "include_scanner.h"
+#include "include_vfs.h"
+#include "kernel_bench.h"
+#include "muda_tuning_db.h"
+#include "timerutil.h"
 #include "OptionParser.h"
 
 void usage(const char *prog) {
-  printf("Usage: %s <options> input.cl\n", prog);
+  printf("Usage: %s <options> input.cl [input2.cl ...]\n", prog);
   printf("  <options>\n");
   printf("\n");
   printf("  --verbose           Verbose mode.\n");
@@ -32,20 +51,226 @@ void usage(const char *prog) {
   printf(
       "  --clopt=STRING      Specify compiler options for OpenCL compiler.\n");
   printf("  --header=FILENAME   Specify custom header file to be included.\n");
+  printf("                      Can be given multiple times.\n");
+  printf("  -I DIR              Add directory to #include search path.\n");
+  printf("  --no-vfs            Let the OpenCL compiler read #include files.\n");
+  printf("                      default: oclc reads them once and inlines them.\n");
+  printf("  --list=FILENAME     Read input filenames(one per line) from the file.\n");
+  printf("                      Use `-` to read from stdin.\n");
   printf("  -c                  Build kernel module.\n");
+  printf("  -o FILENAME         Output filename of kernel module(single input).\n");
+  printf("                      default: module.dat\n");
+  printf("  --outdir=DIR        Output directory of kernel modules.\n");
+  printf("                      default: next to each input as input.cl.clbin\n");
+  printf("  -j N                Build N programs in parallel(0 = # of cores).\n");
+  printf("                      default: 1\n");
+  printf("  --workers=N         Build in N isolated worker processes(POSIX only).\n");
+  printf("                      A crashed or hung worker only fails its input.\n");
+  printf("  --job-timeout=SEC   Kill a worker when a build takes longer than SEC.\n");
+  printf("                      Used with --workers. default: no timeout\n");
+  printf("  --all-devices       Build for every device of every platform and\n");
+  printf("                      print pass/fail and build time matrix.\n");
+  printf("  --cache-dir=DIR     Cache compiled binaries in DIR.\n");
+  printf("  --cache-size=MB     Size limit of the binary cache. default: 1024\n");
+  printf("  --serve=PATH        Run compile server on Unix domain socket PATH.\n");
+  printf("                      -j sets # of requests served concurrently.\n");
+  printf("                      (default: 4)\n");
+  printf("                      With --all-devices, all devices are warmed up.\n");
+  printf("  --connect=PATH      Send inputs to the compile server at PATH.\n");
+  printf("  --stop-server       Stop the compile server given by --connect.\n");
+  printf("  -MD                 Write Make/Ninja dependency file to OUTPUT.d\n");
+  printf("                      (input.cl.d when -c is not given).\n");
+  printf("  -MF FILENAME        Filename of dependency file(single input).\n");
+  printf("  --time              Print time spent in each phase(clewInit, context\n");
+  printf("                      creation, program build, etc.).\n");
+  printf("  --json=FILENAME     Write the timing as JSON to the file(`-` = stdout).\n");
+  printf("  --watch             Rebuild inputs when they or header files are\n");
+  printf("                      modified(Linux only).\n");
+  printf("  --bench=KERNEL      Run the kernel of the input and report kernel\n");
+  printf("                      time measured on the device.\n");
+  printf("  --global=X[,Y[,Z]]  Global work size of --bench.\n");
+  printf("  --local=X[,Y[,Z]]   Local work size of --bench. default: driver\n");
+  printf("  --arg=SPEC          Kernel argument of --bench, in order. One of\n");
+  printf("                        in:TYPE:N[:FILL]  read only buffer\n");
+  printf("                        out:TYPE:N[:FILL] write only buffer\n");
+  printf("                        buf:TYPE:N[:FILL] read/write buffer\n");
+  printf("                        local:TYPE:N      __local memory\n");
+  printf("                        TYPE:VALUE        scalar\n");
+  printf("                      FILL: zero, iota, rand or value.\n");
+  printf("  --warmup=N          Untimed runs of --bench. default: 3\n");
+  printf("  --iterations=N      Timed runs of --bench. default: 10\n");
+  printf("  --tune-local        Run --bench with every legal local size and\n");
+  printf("                      report the fastest one.\n");
+  printf("  --tune-db=FILENAME  Store the fastest local size of --tune-local to\n");
+  printf("                      the tuning database. --bench without --local\n");
+  printf("                      uses the local size in the database.\n");
+  printf("  --tune-flags        Build with combinations of optimization flags,\n");
+  printf("                      run --bench for each and report the fastest\n");
+  printf("                      flags whose outputs match the build without them.\n");
+  printf("  --flag-candidates=LIST  Comma separated flags of --tune-flags.\n");
+  printf("                      default: -cl-fast-relaxed-math,-cl-mad-enable,\n");
+  printf("                      -cl-no-signed-zeros,-cl-unsafe-math-optimizations,\n");
+  printf("                      -cl-denorms-are-zero\n");
+  printf("  --tolerance=X       Max relative error of outputs. default: 0.001\n");
 }
 
-std::string readfile(const char *path) {
-  std::ifstream clsrc(path);
-  std::istreambuf_iterator<char> vdataBegin(clsrc);
-  std::istreambuf_iterator<char> vdataEnd;
-  std::string clstr(vdataBegin, vdataEnd);
+// Quotes compiler option argument when it contains spaces.
+static std::string quoteOption(const std::string &s) {
+  if (s.find_first_of(" \t") == std::string::npos) {
+    return s;
+  }
+  return "\"" + s + "\"";
+}
+
+static bool readlist(const std::string &filename,
+                     std::vector<std::string> *inputs) {
+  std::istream *is = &std::cin;
+  std::ifstream ifs;
+  if (filename != "-") {
+    ifs.open(filename.c_str());
+    if (!ifs) {
+      return false;
+    }
+    is = &ifs;
+  }
 
-  return clstr;
+  std::string line;
+  while (std::getline(*is, line)) {
+    // Trim whitespace and CR.
+    size_t b = line.find_first_not_of(" \t\r");
+    size_t e = line.find_last_not_of(" \t\r");
+    if (b == std::string::npos) {
+      continue;
+    }
+    line = line.substr(b, e - b + 1);
+    if (line[0] == '#') {
+      continue;
+    }
+    inputs->push_back(line);
+  }
+
+  return true;
+}
+
+// Prints result of one input. Returns false when the input failed.
+static bool printResult(const oclc::CompileJob &job,
+                        const oclc::CompileResult &result, bool batch,
+                        bool verb) {
+  if (batch) {
+    printf("[oclc] %s: %s%s\n", job.input.c_str(),
+           result.success ? "OK" : "FAILED", result.cached ? " (cached)" : "");
+  } else if (verb && result.cached) {
+    printf("[oclc] %s: loaded from cache\n", job.input.c_str());
+  }
+  if (!result.log.empty() && (!result.success || verb)) {
+    printf("%s\n", result.log.c_str());
+  }
+  fflush(stdout);
+
+  return result.success;
+}
+
+// Prints accumulated time of each phase.
+static void printTiming(muda::MUDADeviceOCL *device,
+                        const std::vector<oclc::CompileJob> &jobs,
+                        const std::vector<oclc::CompileResult> &results,
+                        double totalMsec) {
+  std::vector<muda::MUDAProfileEntry> entries;
+  device->getProfile(entries);
+
+  printf("[oclc] Timing:\n");
+  printf("  %-28s %8s %12s %12s\n", "phase", "calls", "total(ms)", "avg(ms)");
+  for (size_t i = 0; i < entries.size(); i++) {
+    printf("  %-28s %8d %12.3f %12.3f\n", entries[i].name.c_str(),
+           entries[i].count, entries[i].msec,
+           entries[i].msec / double(std::max(entries[i].count, 1)));
+  }
+  if (jobs.size() > 1) {
+    printf("  %-28s %8s %12s\n", "input", "", "wall(ms)");
+    for (size_t i = 0; i < jobs.size(); i++) {
+      printf("  %-28s %8s %12.3f\n", jobs[i].input.c_str(),
+             results[i].success ? "" : "FAILED", results[i].msec);
+    }
+  }
+  printf("  %-28s %8s %12.3f\n", "total", "", totalMsec);
+}
+
+static std::string jsonString(const std::string &s) {
+  std::string out = "\"";
+  for (size_t i = 0; i < s.size(); i++) {
+    unsigned char c = static_cast<unsigned char>(s[i]);
+    if ((c == '"') || (c == '\\')) {
+      out += '\\';
+      out += char(c);
+    } else if (c < 0x20) {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\u%04x", c);
+      out += buf;
+    } else {
+      out += char(c);
+    }
+  }
+  return out + "\"";
+}
+
+// Writes the timing as JSON. Device and driver are recorded so that runs can
+// be compared across driver upgrades.
+static bool writeTimingJSON(const std::string &filename,
+                            muda::MUDADeviceOCL *device,
+                            const std::vector<oclc::CompileJob> &jobs,
+                            const std::vector<oclc::CompileResult> &results,
+                            double totalMsec) {
+  std::vector<muda::MUDAProfileEntry> entries;
+  device->getProfile(entries);
+
+  FILE *fp = (filename == "-") ? stdout : fopen(filename.c_str(), "w");
+  if (!fp) {
+    return false;
+  }
+
+  fprintf(fp, "{\n");
+  fprintf(fp, "  \"platform\": %s,\n",
+          jsonString(device->getPlatformName()).c_str());
+  fprintf(fp, "  \"device\": %s,\n",
+          jsonString(device->getDeviceName()).c_str());
+  fprintf(fp, "  \"driver_version\": %s,\n",
+          jsonString(device->getDriverVersion()).c_str());
+  fprintf(fp, "  \"phases\": [\n");
+  for (size_t i = 0; i < entries.size(); i++) {
+    fprintf(fp,
+            "    {\"name\": %s, \"calls\": %d, \"total_ms\": %.3f, "
+            "\"avg_ms\": %.3f}%s\n",
+            jsonString(entries[i].name).c_str(), entries[i].count,
+            entries[i].msec,
+            entries[i].msec / double(std::max(entries[i].count, 1)),
+            (i + 1 < entries.size()) ? "," : "");
+  }
+  fprintf(fp, "  ],\n");
+  fprintf(fp, "  \"inputs\": [\n");
+  for (size_t i = 0; i < jobs.size(); i++) {
+    fprintf(fp,
+            "    {\"input\": %s, \"success\": %s, \"cached\": %s, "
+            "\"wall_ms\": %.3f}%s\n",
+            jsonString(jobs[i].input).c_str(),
+            results[i].success ? "true" : "false",
+            results[i].cached ? "true" : "false", results[i].msec,
+            (i + 1 < jobs.size()) ? "," : "");
+  }
+  fprintf(fp, "  ],\n");
+  fprintf(fp, "  \"total_ms\": %.3f\n", totalMsec);
+  fprintf(fp, "}\n");
+
+  if (fp == stdout) {
+    fflush(stdout);
+    return true;
+  }
+  return (fclose(fp) == 0);
 }
 
 int main(int argc, char *const argv[]) {
 
+  timerutil::timerutil totalTimer;
+
   if (argc < 2) {
     usage(argv[0]);
     exit(1);
@@ -62,91 +287,565 @@ int main(int argc, char *const argv[]) {
       .help("default: %default");
   parser.add_option("--device").action("store").type("int").set_default(0).help(
       "default: %default");
-  parser.add_option("--header").dest("header");
+  parser.add_option("--header").action("append").dest("header");
   parser.add_option("--clopt").action("store").type("string");
   parser.add_option("-c").action("store_true").dest("module");
+  parser.add_option("-o").action("store").dest("output");
+  parser.add_option("--outdir").action("store").dest("outdir");
+  parser.add_option("--list").action("store").dest("list");
+  parser.add_option("-j").action("store").type("int").set_default(1).dest(
+      "jobs");
+  parser.add_option("--workers").action("store").type("int").set_default(0);
+  parser.add_option("--job-timeout")
+      .action("store")
+      .type("float")
+      .set_default(0)
+      .dest("job_timeout");
+  parser.add_option("--all-devices").action("store_true").dest("all_devices");
+  parser.add_option("--cache-dir").action("store").dest("cache_dir");
+  parser.add_option("--cache-size")
+      .action("store")
+      .type("int")
+      .set_default(1024)
+      .dest("cache_size");
+  parser.add_option("--serve").action("store").dest("serve");
+  parser.add_option("--connect").action("store").dest("connect");
+  parser.add_option("--stop-server").action("store_true").dest("stop_server");
+  parser.add_option("--watch").action("store_true").dest("watch");
+  parser.add_option("-I").action("append").dest("include_dirs");
+  parser.add_option("--no-vfs").action("store_true").dest("no_vfs");
+  parser.add_option("--time").action("store_true").dest("time");
+  parser.add_option("--json").action("store").dest("json");
+  parser.add_option("--MD").action("store_true").dest("depfile");
+  parser.add_option("--MF").action("store").dest("depfile_name");
+  parser.add_option("--bench").action("store").dest("bench");
+  parser.add_option("--global").action("store").dest("global");
+  parser.add_option("--local").action("store").dest("local");
+  parser.add_option("--arg").action("append").dest("kernel_args");
+  parser.add_option("--warmup")
+      .action("store")
+      .type("int")
+      .set_default(3)
+      .dest("warmup");
+  parser.add_option("--iterations")
+      .action("store")
+      .type("int")
+      .set_default(10)
+      .dest("iterations");
+  parser.add_option("--tune-local").action("store_true").dest("tune_local");
+  parser.add_option("--tune-db").action("store").dest("tune_db");
+  parser.add_option("--tune-flags").action("store_true").dest("tune_flags");
+  parser.add_option("--flag-candidates").action("store").dest("flag_candidates");
+  parser.add_option("--tolerance")
+      .action("store")
+      .type("float")
+      .set_default(0.001)
+      .dest("tolerance");
+
+  // Accept gcc style -MD/-MF. Short options of the parser are one character.
+  std::vector<const char *> argvs(argv, argv + argc);
+  for (size_t i = 1; i < argvs.size(); i++) {
+    if (strcmp(argvs[i], "-MD") == 0) {
+      argvs[i] = "--MD";
+    } else if (strcmp(argvs[i], "-MF") == 0) {
+      argvs[i] = "--MF";
+    }
+  }
 
-  optparse::Values &options = parser.parse_args(argc, argv);
+  optparse::Values &options = parser.parse_args(argc, &argvs.at(0));
   std::vector<std::string> args = parser.args();
 
-  if (args.size() < 1) {
+  if (options.is_set("list")) {
+    if (!readlist(options["list"], &args)) {
+      std::cerr << "Failed to read input list: " << options["list"]
+                << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  if ((bool)options.get("stop_server")) {
+    oclc::CompileClient client;
+    if (!options.is_set("connect") || !client.connect(options["connect"])) {
+      std::cerr << "Failed to connect to compile server." << std::endl;
+      return EXIT_FAILURE;
+    }
+    return client.shutdownServer() ? 0 : EXIT_FAILURE;
+  }
+
+  if ((args.size() < 1) && !options.is_set("serve")) {
     printf("Needs input OpenCL kernel file.\n");
     usage(argv[0]);
     exit(1);
   }
 
-  {
-    int ret = clewInit();
-    if (ret != CLEW_SUCCESS) {
-      std::cerr << "Failed to find OpenCL device." << std::endl;
+  if (options.is_set("depfile_name") && (args.size() > 1)) {
+    std::cerr << "-MF cannot be used with multiple inputs." << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  if (options.is_set("output") && (args.size() > 1)) {
+    std::cerr << "-o cannot be used with multiple inputs. Use --outdir instead."
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  if ((bool)options.get("watch") &&
+      (options.is_set("connect") || options.is_set("serve") ||
+       ((int)options.get("workers") > 0) || (bool)options.get("all_devices"))) {
+    std::cerr << "--watch cannot be used with --connect, --serve, --workers or "
+                 "--all-devices."
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  // Timing is measured on the context of this process only.
+  if (((bool)options.get("time") || options.is_set("json")) &&
+      (options.is_set("connect") || options.is_set("serve") ||
+       ((int)options.get("workers") > 0) || (bool)options.get("all_devices"))) {
+    std::cerr << "--time and --json cannot be used with --connect, --serve, "
+                 "--workers or --all-devices."
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  oclc::KernelBenchConfig benchConfig;
+  bool bench = options.is_set("bench");
+  if (((bool)options.get("tune_local") || (bool)options.get("tune_flags")) &&
+      !bench) {
+    std::cerr << "--tune-local and --tune-flags need --bench." << std::endl;
+    return EXIT_FAILURE;
+  }
+  if ((bool)options.get("tune_local") && (bool)options.get("tune_flags")) {
+    std::cerr << "--tune-local and --tune-flags cannot be used together."
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (bench) {
+    if ((args.size() != 1) || options.is_set("connect") ||
+        options.is_set("serve") || ((int)options.get("workers") > 0) ||
+        (bool)options.get("all_devices") || (bool)options.get("watch")) {
+      std::cerr << "--bench needs single input, and cannot be used with "
+                   "--connect, --serve, --workers, --all-devices or --watch."
+                << std::endl;
+      return EXIT_FAILURE;
+    }
+
+    benchConfig.kernelName = options["bench"];
+    benchConfig.dimension = oclc::parseSizes(options["global"],
+                                             benchConfig.global);
+    if (benchConfig.dimension == 0) {
+      std::cerr << "--bench needs --global=X[,Y[,Z]]." << std::endl;
+      return EXIT_FAILURE;
+    }
+    if (options.is_set("local") &&
+        (oclc::parseSizes(options["local"], benchConfig.local) !=
+         benchConfig.dimension)) {
+      std::cerr << "--local must have the same dimension as --global."
+                << std::endl;
       return EXIT_FAILURE;
     }
+
+    std::list<std::string> &specs = options.all("kernel_args");
+    for (std::list<std::string>::iterator it = specs.begin();
+         it != specs.end(); it++) {
+      oclc::KernelArg arg;
+      std::string err;
+      if (!oclc::parseKernelArg(*it, &arg, &err)) {
+        std::cerr << err << std::endl;
+        return EXIT_FAILURE;
+      }
+      benchConfig.args.push_back(arg);
+    }
+
+    benchConfig.warmup = std::max((int)options.get("warmup"), 0);
+    benchConfig.iterations = std::max((int)options.get("iterations"), 1);
   }
 
   bool verb = (bool)options.get("verbosity");
-  bool module = (bool)options.get("module");
 
   int reqPlatformID = (int)options.get("platform");
   int deviceNum = (int)options.get("device");
-  const char *headerfilename = options["header"].c_str();
 
   // printf("Use platform: %d\n", reqPlatformID);
 
+  oclc::CompileOptions compileOptions;
+  compileOptions.verbose = verb;
+  compileOptions.module = (bool)options.get("module");
+  compileOptions.clopt = options["clopt"];
+  {
+    // -I is passed to the driver, and also used to find dependencies.
+    std::list<std::string> &dirs = options.all("include_dirs");
+    for (std::list<std::string>::iterator it = dirs.begin(); it != dirs.end();
+         it++) {
+      compileOptions.clopt += " -I" + quoteOption(*it);
+    }
+    oclc::parseIncludeDirs(compileOptions.clopt, &compileOptions.includeDirs);
+  }
+  if (verb) {
+    printf("clopts = %s\n", compileOptions.clopt.c_str());
+  }
+
+  // Headers and included files are loaded once and shared by all inputs.
+  oclc::IncludeVFS vfs;
+  if (!(bool)options.get("no_vfs")) {
+    compileOptions.vfs = &vfs;
+  }
+
+  timerutil::timerutil headerTimer;
+  {
+    std::list<std::string> &headerFiles = options.all("header");
+    for (std::list<std::string>::iterator it = headerFiles.begin();
+         it != headerFiles.end(); it++) {
+      if (verb)
+        printf("Reading header file: %s\n", it->c_str());
+      std::shared_ptr<const std::string> headerStr = vfs.load(*it);
+      if (!headerStr) {
+        std::cerr << "Failed to read header file: " << (*it) << std::endl;
+        return EXIT_FAILURE;
+      }
+      compileOptions.headerFiles.push_back(*it);
+      if (!headerStr->empty()) {
+        compileOptions.headers.push_back(*headerStr);
+      }
+    }
+  }
+  headerTimer.end();
+
+  std::unique_ptr<oclc::BinaryCache> cache;
+  if (options.is_set("cache_dir")) {
+    int cacheSizeMB = (int)options.get("cache_size");
+    cache.reset(new oclc::BinaryCache(
+        options["cache_dir"],
+        (unsigned long long)(cacheSizeMB > 0 ? cacheSizeMB : 0) * 1024 * 1024));
+    if (!cache->initialize()) {
+      std::cerr << "Failed to create cache directory: " << options["cache_dir"]
+                << std::endl;
+      return EXIT_FAILURE;
+    }
+    compileOptions.cache = cache.get();
+  }
+
+  std::vector<oclc::CompileJob> jobs(args.size());
+  for (size_t i = 0; i < args.size(); i++) {
+    jobs[i].input = args[i];
+    if (options.is_set("output")) {
+      jobs[i].moduleFile = options["output"];
+    } else if ((args.size() == 1) && !options.is_set("outdir")) {
+      jobs[i].moduleFile = "module.dat"; // For backward compatibility.
+    } else {
+      jobs[i].moduleFile = oclc::moduleFilename(args[i], options["outdir"]);
+    }
+    if (options.is_set("depfile_name")) {
+      jobs[i].depFile = options["depfile_name"];
+    } else if ((bool)options.get("depfile")) {
+      // Next to the output, or next to the input when only checking.
+      jobs[i].depFile = (compileOptions.module ? jobs[i].moduleFile
+                                               : jobs[i].input) +
+                        ".d";
+    }
+  }
+
+  bool batch = (jobs.size() > 1);
+  int numFailed = 0;
+
+  if (options.is_set("connect")) {
+    // Compile server owns OpenCL context, so clewInit() is not required.
+    oclc::CompileClient client;
+    if (!client.connect(options["connect"])) {
+      std::cerr << "Failed to connect to compile server: "
+                << options["connect"] << std::endl;
+      return EXIT_FAILURE;
+    }
+
+    for (size_t i = 0; i < jobs.size(); i++) {
+      oclc::CompileResult result;
+      std::chrono::steady_clock::time_point start =
+          std::chrono::steady_clock::now();
+      client.compile(jobs[i], compileOptions, reqPlatformID, deviceNum,
+                     &result);
+      result.msec = std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+      if (!printResult(jobs[i], result, batch, verb)) {
+        numFailed++;
+      }
+    }
+
+    if (batch) {
+      printf("[oclc] %d / %d inputs compiled successfully.\n",
+             int(jobs.size()) - numFailed, int(jobs.size()));
+    }
+
+    return (numFailed > 0) ? EXIT_FAILURE : 0;
+  }
+
+  int numWorkers = (int)options.get("workers");
+  if (numWorkers > 0) {
+    // Process isolation. Each worker initializes OpenCL by itself, so
+    // clewInit() must not be called in this process.
+    oclc::WorkerConfig config;
+    config.numWorkers = numWorkers;
+    config.platformID = reqPlatformID;
+    config.deviceID = deviceNum;
+    config.timeoutSec = (double)options.get("job_timeout");
+    config.options = compileOptions;
+
+    std::vector<oclc::CompileResult> results;
+    if (!oclc::runWorkerPool(config, jobs, &results)) {
+      std::cerr << "Failed to run worker processes." << std::endl;
+      return EXIT_FAILURE;
+    }
+
+    for (size_t i = 0; i < jobs.size(); i++) {
+      if (!printResult(jobs[i], results[i], batch, verb)) {
+        numFailed++;
+      }
+    }
+
+    if (batch) {
+      printf("[oclc] %d / %d inputs compiled successfully.\n",
+             int(jobs.size()) - numFailed, int(jobs.size()));
+    }
+
+    return (numFailed > 0) ? EXIT_FAILURE : 0;
+  }
+
+  timerutil::timerutil clewTimer;
+  {
+    int ret = clewInit();
+    clewTimer.end();
+    if (ret != CLEW_SUCCESS) {
+      std::cerr << "Failed to find OpenCL device." << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (options.is_set("serve")) {
+    oclc::ServerConfig config;
+    config.socketPath = options["serve"];
+    config.platformID = reqPlatformID;
+    config.deviceID = deviceNum;
+    config.warmAllDevices = (bool)options.get("all_devices");
+    if (options.is_set_by_user("jobs")) {
+      config.numThreads = (int)options.get("jobs");
+    }
+    if (config.numThreads <= 0) {
+      config.numThreads = oclc::ThreadPool::defaultNumThreads();
+    }
+    config.cache = compileOptions.cache;
+    config.verbose = verb;
+    return oclc::runCompileServer(config);
+  }
+
+  if ((bool)options.get("all_devices")) {
+    int numFailed = oclc::runDeviceMatrix(jobs, compileOptions);
+    if (numFailed < 0) {
+      std::cerr << "No OpenCL device found." << std::endl;
+      return EXIT_FAILURE;
+    }
+    return (numFailed > 0) ? EXIT_FAILURE : 0;
+  }
+
+  // One context is shared by all inputs.
   muda::MUDADeviceOCL *device = new muda::MUDADeviceOCL(muda::ocl_cpu);
   assert(device);
 
+  bool timing = (bool)options.get("time") || options.is_set("json");
+  if (timing) {
+    device->setMeasureProfile(true);
+    device->addProfile("clewInit", clewTimer.elapsed());
+    device->addProfile("readHeaders", headerTimer.elapsed());
+  }
+
+  // Command queue is created when the program is loaded, so enable
+  // profiling events before that.
+  device->setKernelProfiling(bench);
+
   bool ret = device->initialize(reqPlatformID, deviceNum, verb);
-  assert(ret);
+  if (!ret) {
+    std::cerr << "Failed to initialize OpenCL device." << std::endl;
+    return EXIT_FAILURE;
+  }
 
-  int numDevices = device->getNumDevices();
+  if (bench && (bool)options.get("tune_flags")) {
+    oclc::FlagTuneConfig tuneConfig;
+    tuneConfig.tolerance = (double)options.get("tolerance");
+    if (options.is_set("flag_candidates")) {
+      tuneConfig.flags.clear();
+      std::stringstream ss(options["flag_candidates"]);
+      std::string flag;
+      while (std::getline(ss, flag, ',')) {
+        if (!flag.empty()) {
+          tuneConfig.flags.push_back(flag);
+        }
+      }
+    }
 
-  std::string kernelfile = args.at(0);
+    oclc::FlagTuneResult result;
+    std::string err;
+    bool ok = oclc::tuneCompilerFlags(device, args[0], compileOptions,
+                                      benchConfig, tuneConfig, &result, &err);
+    if (ok) {
+      oclc::printFlagTune(benchConfig, tuneConfig, result);
+    } else {
+      std::cerr << err << std::endl;
+    }
 
-  std::string cloptions = options["clopt"];
-  if (verb) {
-    printf("clopts = %s\n", cloptions.c_str());
+    delete device;
+    return ok ? 0 : EXIT_FAILURE;
   }
 
+  if (bench) {
+    std::string log;
+    muda::MUDAProgram program =
+        oclc::buildProgram(device, args[0], compileOptions, &log);
+    if (!program) {
+      printf("[oclc] Failed to compile: %s\n%s", args[0].c_str(), log.c_str());
+      delete device;
+      return EXIT_FAILURE;
+    }
+
+    muda::MUDATuningDB tuningDB;
+    if (options.is_set("tune_db") && !tuningDB.load(options["tune_db"])) {
+      std::cerr << "Failed to read tuning database: " << options["tune_db"]
+                << std::endl;
+      device->releaseProgram(program);
+      delete device;
+      return EXIT_FAILURE;
+    }
+
+    std::string err;
+    bool ok;
+    if ((bool)options.get("tune_local")) {
+      oclc::LocalSizeTuneResult result;
+      ok = oclc::tuneLocalSize(device, program, benchConfig, &result, &err);
+      if (ok) {
+        oclc::printLocalSizeTune(benchConfig, result);
+      }
+
+      if (ok && options.is_set("tune_db")) {
+        muda::MUDATuningEntry entry;
+        entry.device = device->getDeviceKey();
+        entry.kernel = benchConfig.kernelName;
+        entry.dimension = benchConfig.dimension;
+        for (int i = 0; i < 3; i++) {
+          entry.global[i] = benchConfig.global[i];
+          entry.local[i] = result.candidates[0].local[i];
+        }
+        entry.msec = result.candidates[0].stats.median;
+        tuningDB.set(entry);
+        if (tuningDB.save(options["tune_db"])) {
+          printf("[oclc] Saved to tuning database: %s\n",
+                 options["tune_db"].c_str());
+        } else {
+          err = "Failed to write tuning database: " + options["tune_db"];
+          ok = false;
+        }
+      }
+    } else {
+      if (options.is_set("tune_db") && !options.is_set("local")) {
+        // execute() looks up the tuned local size.
+        device->setTuningDB(&tuningDB);
+        size_t tuned[3];
+        if (tuningDB.lookup(device->getDeviceKey(), benchConfig.kernelName,
+                            benchConfig.dimension, benchConfig.global,
+                            tuned)) {
+          printf("[oclc] Local size from tuning database: %d,%d,%d\n",
+                 int(tuned[0]), int(tuned[1]), int(tuned[2]));
+        }
+      }
+
+      oclc::KernelBenchResult result;
+      ok = oclc::runKernelBench(device, program, benchConfig, &result, &err);
+      if (ok) {
+        oclc::printKernelBench(benchConfig, result);
+      }
+    }
+    if (!ok) {
+      std::cerr << err << std::endl;
+    }
 
-  std::string headerStr;
-  if (headerfilename) {
-    if (verb)
-      printf("Reading header file: %s\n", headerfilename);
-    headerStr = readfile(headerfilename);
+    device->releaseProgram(program);
+    delete device;
+    return ok ? 0 : EXIT_FAILURE;
   }
 
-  muda::MUDAProgram prog;
-  if (headerStr.empty()) {
-    prog = device->loadKernelSource(kernelfile.c_str(), 0, NULL, cloptions.c_str());
-  } else {
-    const char *headers[1];
-    headers[0] = headerStr.c_str();
-    prog = device->loadKernelSource(kernelfile.c_str(), 1, headers, cloptions.c_str());
+  int numThreads = (int)options.get("jobs");
+  if (numThreads <= 0) {
+    numThreads = oclc::ThreadPool::defaultNumThreads();
+  }
+  if (numThreads > int(jobs.size())) {
+    numThreads = int(jobs.size());
   }
+  if (verb) {
+    printf("# of build threads = %d\n", numThreads);
+  }
+
+  // Programs are built concurrently in the shared context, but results are
+  // reported in input order so that the output is deterministic.
+  std::vector<oclc::CompileResult> results(jobs.size());
+  std::vector<bool> finished(jobs.size(), false);
+  std::mutex finishedMutex;
+  std::condition_variable finishedCond;
 
-  if (!prog) {
-    return -1;
+  oclc::ThreadPool pool(numThreads);
+  for (size_t i = 0; i < jobs.size(); i++) {
+    pool.enqueue([&, i] {
+      oclc::runCompileJob(device, jobs[i], compileOptions, &results[i]);
+      {
+        std::lock_guard<std::mutex> lock(finishedMutex);
+        finished[i] = true;
+      }
+      finishedCond.notify_all();
+    });
   }
 
-  if (module) {
-    std::vector<char> bins;
-    bool ret = device->getModule(prog, bins);
-    if (!ret) {
-      return -1;
+  for (size_t i = 0; i < jobs.size(); i++) {
+    {
+      std::unique_lock<std::mutex> lock(finishedMutex);
+      finishedCond.wait(lock, [&] { return bool(finished[i]); });
     }
-
-    if (bins.size() == 0) {
-      return -1;
+    if (!printResult(jobs[i], results[i], batch, verb)) {
+      numFailed++;
     }
+  }
+
+  pool.wait();
+
+  if (batch) {
+    printf("[oclc] %d / %d inputs compiled successfully.\n",
+           int(jobs.size()) - numFailed, int(jobs.size()));
+  }
 
-    FILE* fp = fopen("module.dat", "wb");
-    if (!fp) {
-      return -1;
+  if (timing) {
+    totalTimer.end();
+    if ((bool)options.get("time")) {
+      printTiming(device, jobs, results, totalTimer.elapsed());
     }
+    if (options.is_set("json") &&
+        !writeTimingJSON(options["json"], device, jobs, results,
+                         totalTimer.elapsed())) {
+      std::cerr << "Failed to write timing JSON: " << options["json"]
+                << std::endl;
+    }
+  }
+
+  if ((bool)options.get("watch")) {
+    oclc::WatchConfig config;
+    config.headerFiles = compileOptions.headerFiles;
+    config.numThreads = numThreads;
 
-    fwrite(&bins.at(0), 1, bins.size(), fp);
-    fclose(fp);
+    bool ret = oclc::runWatch(
+        device, jobs, compileOptions, config,
+        [verb](const oclc::CompileJob &job, const oclc::CompileResult &result) {
+          printResult(job, result, true, verb);
+        });
+
+    delete device;
+    return ret ? 0 : EXIT_FAILURE;
   }
 
-  return 0;
+  delete device;
+
+  return (numFailed > 0) ? EXIT_FAILURE : 0;
 }
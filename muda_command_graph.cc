@@ -0,0 +1,118 @@
+//
+// Copyright 2009 - 2017 Light Transport Entertainment Inc.
+//
+#include "muda_command_graph.h"
+
+namespace muda {
+
+#ifdef HAVE_OPENCL
+MUDACommandGraph::MUDACommandGraph() : lastSubmit(NULL) {}
+
+MUDACommandGraph::MUDACommandGraph(const MUDACommandGraph &other)
+    : lastSubmit(other.lastSubmit), nodes(other.nodes) {
+  if (lastSubmit) {
+    clRetainEvent(lastSubmit);
+  }
+}
+
+MUDACommandGraph &MUDACommandGraph::operator=(const MUDACommandGraph &other) {
+  if (other.lastSubmit) {
+    clRetainEvent(other.lastSubmit);
+  }
+  if (lastSubmit) {
+    clReleaseEvent(lastSubmit);
+  }
+  nodes = other.nodes;
+  lastSubmit = other.lastSubmit;
+  return *this;
+}
+
+MUDACommandGraph::~MUDACommandGraph() {
+  if (lastSubmit) {
+    clReleaseEvent(lastSubmit);
+  }
+}
+#else
+MUDACommandGraph::MUDACommandGraph() {}
+
+MUDACommandGraph::MUDACommandGraph(const MUDACommandGraph &other)
+    : nodes(other.nodes) {}
+
+MUDACommandGraph &MUDACommandGraph::operator=(const MUDACommandGraph &other) {
+  nodes = other.nodes;
+  return *this;
+}
+
+MUDACommandGraph::~MUDACommandGraph() {}
+#endif
+
+int MUDACommandGraph::addWrite(MUDAMemory mem, size_t size, const void *ptr) {
+  Node node;
+  node.type = Node::WRITE;
+  node.mem = mem;
+  node.size = size;
+  node.hostPtr = const_cast<void *>(ptr);
+  nodes.push_back(node);
+  return int(nodes.size()) - 1;
+}
+
+int MUDACommandGraph::addRead(MUDAMemory mem, size_t size, void *ptr) {
+  Node node;
+  node.type = Node::READ;
+  node.mem = mem;
+  node.size = size;
+  node.hostPtr = ptr;
+  nodes.push_back(node);
+  return int(nodes.size()) - 1;
+}
+
+bool MUDACommandGraph::setHostPtr(int index, void *ptr) {
+  if ((index < 0) || (size_t(index) >= nodes.size()) ||
+      (nodes[index].type == Node::LAUNCH)) {
+    return false;
+  }
+  nodes[index].hostPtr = ptr;
+  return true;
+}
+
+bool MUDACommandGraph::setRange(int index, const MUDANDRange &range) {
+  if ((index < 0) || (size_t(index) >= nodes.size()) ||
+      (nodes[index].type != Node::LAUNCH)) {
+    return false;
+  }
+  nodes[index].range = range;
+  nodes[index].planned = false;
+  return true;
+}
+
+bool MUDACommandGraph::setArg(int index, int argNum, MUDAMemory mem) {
+  Arg *arg = getArg(index, argNum);
+  if (!arg) {
+    return false;
+  }
+  captureArg(arg, mem);
+  return true;
+}
+
+bool MUDACommandGraph::setArg(int index, int argNum,
+                              const MUDALocalMemory &local) {
+  Arg *arg = getArg(index, argNum);
+  if (!arg) {
+    return false;
+  }
+  captureArg(arg, local);
+  return true;
+}
+
+MUDACommandGraph::Arg *MUDACommandGraph::getArg(int index, int argNum) {
+  if ((index < 0) || (size_t(index) >= nodes.size()) ||
+      (nodes[index].type != Node::LAUNCH)) {
+    return NULL;
+  }
+  if ((argNum < 0) || (size_t(argNum) >= nodes[index].args.size())) {
+    return NULL;
+  }
+  return &nodes[index].args[argNum];
+}
+
+} // namespace muda
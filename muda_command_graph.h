@@ -0,0 +1,172 @@
+//
+// Copyright 2009 - 2017 Light Transport Entertainment Inc.
+//
+#ifndef MUDA_COMMAND_GRAPH_H
+#define MUDA_COMMAND_GRAPH_H
+
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+#include "muda_runtime.h"
+
+namespace muda {
+
+// Recorded sequence of transfers and kernel launches. Record once, then
+// replay every frame with MUDADeviceOCL::submit(), changing only the
+// parameters that differ through the set*() functions. Nodes are identified
+// by the index returned by add*().
+// Memory objects, kernels and host pointers are referenced, not copied, and
+// must be valid while the graph is submitted. READ and WRITE nodes are
+// non-blocking transfers from/to the host pointer without the staging of
+// MUDADeviceOCL::read()/write(), so use allocHost() memory for DMA
+// transfers. A graph is submitted to one device.
+class MUDACommandGraph {
+public:
+  // Kernel argument of a LAUNCH node.
+  struct Arg {
+    enum Kind { MEMORY, LOCAL, VALUE };
+
+    Kind kind;
+    MUDAMemory mem;                   // MEMORY
+    size_t size;                      // LOCAL: bytes of __local memory.
+    std::vector<unsigned char> value; // VALUE
+
+    Arg() : kind(VALUE), mem(NULL), size(0) {}
+  };
+
+  struct Node {
+    enum Type { WRITE, READ, LAUNCH };
+
+    Type type;
+    MUDAMemory mem;  // WRITE, READ
+    size_t size;     // WRITE, READ: bytes.
+    void *hostPtr;   // WRITE(source), READ(destination)
+    MUDAKernel kernel; // LAUNCH
+    MUDANDRange range; // LAUNCH
+    std::vector<Arg> args; // LAUNCH
+
+    // Dispatches of LAUNCH, planned by the first submit and reset by
+    // setRange().
+    mutable MUDALaunchPlan plan;
+    mutable bool planned;
+
+    Node()
+        : type(WRITE), mem(NULL), size(0), hostPtr(NULL), kernel(NULL),
+          range(1), planned(false) {}
+  };
+
+  MUDACommandGraph();
+  MUDACommandGraph(const MUDACommandGraph &other);
+  MUDACommandGraph &operator=(const MUDACommandGraph &other);
+  ~MUDACommandGraph();
+
+  //  Function: addWrite
+  //  Records write of `size` bytes from `ptr` to the buffer. Returns the node
+  //  index.
+  int addWrite(MUDAMemory mem, size_t size, const void *ptr);
+
+  //  Function: addRead
+  //  Records read of `size` bytes from the buffer to `ptr`. Returns the node
+  //  index.
+  int addRead(MUDAMemory mem, size_t size, void *ptr);
+
+  //  Function: addLaunch
+  //  Records launch of the kernel with `args`, which are taken like
+  //  MUDADeviceOCL::launch(). Returns the node index.
+  template <typename... Args>
+  int addLaunch(MUDAKernel kernel, const MUDANDRange &range,
+                const Args &... args) {
+    Node node;
+    node.type = Node::LAUNCH;
+    node.kernel = kernel;
+    node.range = range;
+    node.args.resize(sizeof...(Args));
+    captureArgs(&node.args, 0, args...);
+    nodes.push_back(node);
+    return int(nodes.size()) - 1;
+  }
+
+  //  Function: setHostPtr
+  //  Changes the host pointer of a WRITE or READ node.
+  bool setHostPtr(int index, void *ptr);
+
+  //  Function: setRange
+  //  Changes the global and local size of a LAUNCH node.
+  bool setRange(int index, const MUDANDRange &range);
+
+  //  Function: setArg
+  //  Changes the argument `argNum` of a LAUNCH node. The kind of the
+  //  argument(buffer, __local memory or value) may change, but a value must
+  //  keep its size.
+  bool setArg(int index, int argNum, MUDAMemory mem);
+  bool setArg(int index, int argNum, const MUDALocalMemory &local);
+
+  template <typename T> bool setArg(int index, int argNum, const T &value) {
+    Arg *arg = getArg(index, argNum);
+    if (!arg) {
+      return false;
+    }
+    if ((arg->kind == Arg::VALUE) && (arg->value.size() != sizeof(T))) {
+      return false;
+    }
+    captureArg(arg, value);
+    return true;
+  }
+
+  //  Function: clear
+  //  Removes all nodes.
+  void clear() { nodes.clear(); }
+
+  size_t size() const { return nodes.size(); }
+  const Node &node(size_t index) const { return nodes[index]; }
+
+#ifdef HAVE_OPENCL
+  // Event of the last submit, which the next submit waits for. Submits may
+  // go to different or out-of-order queues. Managed by MUDADeviceOCL.
+  mutable cl_event lastSubmit;
+#endif
+
+private:
+  Arg *getArg(int index, int argNum);
+
+  void captureArgs(std::vector<Arg> *args, size_t argNum) {
+    (void)args;
+    (void)argNum;
+  }
+
+  template <typename T, typename... Rest>
+  void captureArgs(std::vector<Arg> *args, size_t argNum, const T &arg,
+                   const Rest &... rest) {
+    captureArg(&args->at(argNum), arg);
+    captureArgs(args, argNum + 1, rest...);
+  }
+
+  static void captureArg(Arg *arg, MUDAMemory mem) {
+    arg->kind = Arg::MEMORY;
+    arg->mem = mem;
+    arg->value.clear();
+  }
+
+  static void captureArg(Arg *arg, const MUDALocalMemory &local) {
+    arg->kind = Arg::LOCAL;
+    arg->size = local.size;
+    arg->value.clear();
+  }
+
+  template <typename T> static void captureArg(Arg *arg, const T &value) {
+    static_assert(!std::is_pointer<T>::value,
+                  "Pass MUDAMemory for buffer arguments.");
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Kernel argument must be trivially copyable.");
+    arg->kind = Arg::VALUE;
+    arg->value.resize(sizeof(T));
+    memcpy(&arg->value.at(0), &value, sizeof(T));
+  }
+
+  std::vector<Node> nodes;
+};
+
+} // namespace muda
+
+#endif // MUDA_COMMAND_GRAPH_H
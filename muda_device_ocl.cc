@@ -1,6 +1,7 @@
 //
 // MUDA device for OpenCL.
 //
+#include <algorithm>
 #include <cassert>
 #include <cstdlib>
 #include <cstdio>
@@ -8,11 +9,16 @@
 #include <iostream>
 #include <fstream>
 #include <iterator>
+#include <sstream>
+#include <thread>
+#include <condition_variable>
 
 #include "muda_runtime.h"
+#include "muda_command_graph.h"
 #include "muda_impl.h"
-
-#include <sys/stat.h>
+#include "muda_memory_pool.h"
+#include "muda_tuning_db.h"
+#include "timerutil.h"
 
 using namespace std;
 
@@ -26,6 +32,81 @@ using namespace std;
 
 namespace muda {
 
+// Measures the scope and adds it to the profile of `device`(NULL = disabled).
+class ProfileScope {
+public:
+  ProfileScope(MUDADeviceOCL *device, const char *name)
+      : device(device), name(name) {}
+  ~ProfileScope() {
+    if (device) {
+      timer.end();
+      device->addProfile(name, timer.elapsed());
+    }
+  }
+
+private:
+  MUDADeviceOCL *device;
+  const char *name;
+  timerutil::timerutil timer;
+};
+
+#define MUDA_PROFILE(name)                                                     \
+  ProfileScope profileScope(this->measureProfile ? this : NULL, name)
+
+#ifdef HAVE_OPENCL
+// Converts wait-list of MUDAEvent to cl_event. NULL events are skipped.
+static void toCLEvents(int numEvents, const MUDAEvent *events,
+                       std::vector<cl_event> *out) {
+  out->clear();
+  for (int i = 0; i < numEvents; i++) {
+    if (events[i]) {
+      out->push_back(events[i]->eventCL);
+    }
+  }
+}
+#endif
+
+// Slab of MUDA objects of type T, shared by all devices.
+template <typename T> static MUDASlab<T> &slab() {
+  // Never destroyed, so that objects can be released at any time of exit.
+  static MUDASlab<T> *s = new MUDASlab<T>();
+  return *s;
+}
+
+// Removes `obj` from the list of live objects. Returns false when not found.
+template <typename T> static bool untrack(std::vector<T> &list, T obj) {
+  typename std::vector<T>::iterator it =
+      std::find(list.begin(), list.end(), obj);
+  if (it == list.end()) {
+    return false;
+  }
+  list.erase(it);
+  return true;
+}
+
+// Forgets the value of the argument set by launch(), e.g. when it is set by
+// setArg().
+static void invalidateArgCache(MUDAKernel kernel, int argNum) {
+  if (size_t(argNum) < kernel->argCache.size()) {
+    kernel->argCache[argNum].clear();
+  }
+}
+
+#ifdef HAVE_OPENCL
+// Releases kernels of getKernel() owned by the program.
+static void releaseKernelTable(MUDAProgram program) {
+  std::unordered_map<std::string, MUDAKernelInstances>::iterator it;
+  for (it = program->kernelTable.begin(); it != program->kernelTable.end();
+       it++) {
+    for (size_t i = 0; i < it->second.all.size(); i++) {
+      clReleaseKernel(it->second.all[i]->kernObjOCL);
+      slab<_MUDAKernel>().destroy(it->second.all[i]);
+    }
+  }
+  program->kernelTable.clear();
+}
+#endif
+
 MUDADeviceOCL::MUDADeviceOCL(MUDADeviceTarget target) : MUDADeviceImpl() {
   assert(target == ocl_cpu || target == ocl_gpu || target == ocl_accel);
 
@@ -41,36 +122,80 @@ MUDADeviceOCL::MUDADeviceOCL(MUDADeviceTarget target) : MUDADeviceImpl() {
 
   this->debug = false;
   this->measureProfile = false;
+  this->kernelProfiling = false;
+  this->tuningDB = NULL;
+  this->queuesPerDevice = 1;
+  this->outOfOrderQueues = false;
+  this->stagingChunkSize = 4 * 1024 * 1024;
+  this->memoryPool = NULL;
 
 #ifdef HAVE_OPENCL
 
   this->context = 0;
-  this->kernels.clear();
-  this->commandQueues.clear();
+  this->platform = 0;
+  this->useAllDevices = false;
+  this->numIdleAsyncThreads = 0;
+  this->numRunningAsyncBuilds = 0;
+  this->stopAsyncThreads = false;
 
 #endif
 }
 
 MUDADeviceOCL::~MUDADeviceOCL() {
 #ifdef HAVE_OPENCL
+  waitAsyncBuilds();
+
   {
-    std::vector<cl_command_queue>::iterator it;
-    for (it = this->commandQueues.begin(); it != this->commandQueues.end();
-         it++) {
-      clReleaseCommandQueue(*it);
+    std::lock_guard<std::mutex> lock(this->asyncMutex);
+    this->stopAsyncThreads = true;
+  }
+  this->asyncCond.notify_all();
+  for (size_t i = 0; i < this->asyncThreads.size(); i++) {
+    this->asyncThreads[i].join();
+  }
+
+  if (this->memoryPool && (this->memoryPool->numLiveBlocks() > 0)) {
+    // Memory objects still refer to their blocks, so keep the pool.
+    cout << "[OCL] Memory pool still has live allocations. Free them before "
+            "destroying the device.\n";
+  } else {
+    delete this->memoryPool;
+  }
+
+  if (!this->pinnedPool.empty()) {
+    // Blocks were mapped on the queue of the current device.
+    cl_command_queue queue = getQueue(-1);
+    for (size_t i = 0; i < this->pinnedPool.size(); i++) {
+      clEnqueueUnmapMemObject(queue, this->pinnedPool[i].memObj,
+                              this->pinnedPool[i].ptr, 0, NULL, NULL);
+      clReleaseMemObject(this->pinnedPool[i].memObj);
+    }
+    clFinish(queue);
+  }
+
+  for (size_t i = 0; i < this->queuePool.size(); i++) {
+    for (size_t k = 0; k < this->queuePool[i].queues.size(); k++) {
+      clReleaseCommandQueue(this->queuePool[i].queues[k]);
     }
   }
 
-// {
-//     std::vector<cl_kernel>::iterator it;
-//     for (it = this->kernels.begin();
-//          it != this->kernels.end();
-//          it++) {
-//         clReleaseKernel(*it);
-//     }
-// }
+  // Kernels hold their program, so release them first.
+  for (size_t i = 0; i < this->kernels.size(); i++) {
+    clReleaseKernel(this->kernels[i]->kernObjOCL);
+    slab<_MUDAKernel>().destroy(this->kernels[i]);
+  }
+
+  for (size_t i = 0; i < this->programs.size(); i++) {
+    releaseKernelTable(this->programs[i]);
+    clReleaseProgram(this->programs[i]->progObjOCL);
+    slab<_MUDAProgram>().destroy(this->programs[i]);
+  }
 
-// clReleaseProgram(this->program);
+  // Memory objects still alive(e.g. kept by the pool above) retain the
+  // context, so the driver frees it with the last of them.
+  if (this->context) {
+    clReleaseContext(this->context);
+  }
 
 #endif
 }
@@ -91,7 +216,10 @@ bool MUDADeviceOCL::initialize(int reqPlatformID, int preferredDeviceID,
     cl_int errCode = CL_SUCCESS;
 
     cl_uint numPlatforms;
-    errCode = clGetPlatformIDs(0, 0, &numPlatforms);
+    {
+      MUDA_PROFILE("clGetPlatformIDs");
+      errCode = clGetPlatformIDs(0, 0, &numPlatforms);
+    }
     if (errCode != CL_SUCCESS) {
       fprintf(stdout, "[OCL] clGetPlatformIDs failed.\n");
       return false;
@@ -102,7 +230,10 @@ bool MUDADeviceOCL::initialize(int reqPlatformID, int preferredDeviceID,
     assert(reqPlatformID < (int)numPlatforms);
     if (verbosity)
       printf("[OCL] Num platforms: %d\n", numPlatforms);
-    errCode = clGetPlatformIDs(numPlatforms, platform_ids, 0);
+    {
+      MUDA_PROFILE("clGetPlatformIDs");
+      errCode = clGetPlatformIDs(numPlatforms, platform_ids, 0);
+    }
     if (errCode != CL_SUCCESS) {
       fprintf(stdout, "[OCL] clGetPlatformIDs failed.\n");
       return false;
@@ -133,13 +264,25 @@ bool MUDADeviceOCL::initialize(int reqPlatformID, int preferredDeviceID,
     cl_device_id devices[32];
 
     // this->devices.resize(max_devices);
-    cl_uint num_devices;
+    cl_uint num_devices = 0;
     platform_id = platform_ids[reqPlatformID];
-    errCode = clGetDeviceIDs(platform_id, CL_DEVICE_TYPE_ALL, max_devices,
-                             devices, &num_devices);
-    CL_CHECK(errCode);
+    this->platform = platform_id;
+    {
+      MUDA_PROFILE("clGetDeviceIDs");
+      errCode = clGetDeviceIDs(platform_id, CL_DEVICE_TYPE_ALL, max_devices,
+                               devices, &num_devices);
+    }
 
-    assert(num_devices >= 1);
+    // A platform may have no devices(CL_DEVICE_NOT_FOUND). Let the caller
+    // decide, like a context creation failure.
+    if ((errCode != CL_SUCCESS) || (num_devices < 1)) {
+      fprintf(stdout, "[OCL] No OpenCL device found in platform %d (%d).\n",
+              reqPlatformID, errCode);
+      return false;
+    }
+    if (num_devices > cl_uint(max_devices)) {
+      num_devices = cl_uint(max_devices);
+    }
 
     if (verbosity)
       printf("[MUDA] [OCL] # of devices = %d\n", num_devices);
@@ -235,11 +378,21 @@ bool MUDADeviceOCL::initialize(int reqPlatformID, int preferredDeviceID,
     printf("[MUDA] [OCL] Use device: %d\n", this->currentDeviceID);
 
   {
+    MUDA_PROFILE("clCreateContext");
     cl_int err;
-    context = clCreateContext(NULL, 1, &this->devices[this->currentDeviceID],
-                              NULL, NULL, &err);
+    if (this->useAllDevices) {
+      // Context for all devices in the platform. Programs are built per
+      // device with loadKernelSource(..., deviceID).
+      context = clCreateContext(NULL, cl_uint(this->devices.size()),
+                                &this->devices.at(0), NULL, NULL, &err);
+    } else {
+      context = clCreateContext(NULL, 1,
+                                &this->devices[this->currentDeviceID], NULL,
+                                NULL, &err);
+    }
 
     if (err != CL_SUCCESS) {
+      context = NULL;
 
       cout << "[OCL] Failed to create CL context.\n";
 
@@ -250,8 +403,8 @@ bool MUDADeviceOCL::initialize(int reqPlatformID, int preferredDeviceID,
         cout << "[OCL] CPU version doesn't work.\n";
       }
 
-      exit(-1); // force exit.
-
+      // Let the caller decide(e.g. --all-devices continues with other
+      // platforms).
       return false;
     }
   }
@@ -266,6 +419,78 @@ bool MUDADeviceOCL::initialize(int reqPlatformID, int preferredDeviceID,
 #endif // HAVE_OPENCL
 }
 
+bool MUDADeviceOCL::initializeAllDevices(int platformID, bool verbosity) {
+  this->useAllDevices = true;
+  return initialize(platformID, 0, verbosity);
+}
+
+int MUDADeviceOCL::getNumPlatforms() {
+#if HAVE_OPENCL
+  cl_uint numPlatforms = 0;
+  cl_int err = clGetPlatformIDs(0, 0, &numPlatforms);
+  if (err != CL_SUCCESS) {
+    return 0;
+  }
+  return int(numPlatforms);
+#else
+  return 0;
+#endif
+}
+
+void MUDADeviceOCL::addProfile(const char *name, double msec) {
+  if (!this->measureProfile) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(this->profileMutex);
+  for (size_t i = 0; i < this->profile.size(); i++) {
+    if (this->profile[i].name == name) {
+      this->profile[i].msec += msec;
+      this->profile[i].count++;
+      return;
+    }
+  }
+
+  MUDAProfileEntry entry;
+  entry.name = name;
+  entry.msec = msec;
+  entry.count = 1;
+  this->profile.push_back(entry);
+}
+
+void MUDADeviceOCL::getProfile(std::vector<MUDAProfileEntry> &entries) {
+  std::lock_guard<std::mutex> lock(this->profileMutex);
+  entries = this->profile;
+}
+
+std::string MUDADeviceOCL::getPlatformName() {
+#if HAVE_OPENCL
+  char buffer[2048];
+  buffer[0] = '\0';
+  clGetPlatformInfo(this->platform, CL_PLATFORM_NAME, sizeof(buffer), buffer,
+                    NULL);
+  return std::string(buffer);
+#else
+  return std::string();
+#endif
+}
+
+std::string MUDADeviceOCL::getDeviceName(int deviceID) {
+#if HAVE_OPENCL
+  if (deviceID < 0) {
+    deviceID = this->currentDeviceID;
+  }
+  char buffer[2048];
+  buffer[0] = '\0';
+  clGetDeviceInfo(this->devices[deviceID], CL_DEVICE_NAME, sizeof(buffer),
+                  buffer, NULL);
+  return std::string(buffer);
+#else
+  (void)deviceID;
+  return std::string();
+#endif
+}
+
 int MUDADeviceOCL::getNumDevices() {
 #if HAVE_OPENCL
   return int(this->devices.size());
@@ -299,6 +524,7 @@ int MUDADeviceOCL::estimateMFlops(int deviceId) {
 bool MUDADeviceOCL::shutdown() {
 
 #if HAVE_OPENCL
+  waitAsyncBuilds();
   return true;
 #else
 
@@ -312,278 +538,718 @@ bool MUDADeviceOCL::shutdown() {
 MUDAProgram MUDADeviceOCL::loadKernelSource(const char *filename, int nheaders,
                                             const char **headers,
                                             const char *options) {
+  return loadKernelSource(filename, nheaders, headers, options, NULL);
+}
+
+MUDAProgram MUDADeviceOCL::loadKernelSource(const char *filename, int nheaders,
+                                            const char **headers,
+                                            const char *options,
+                                            std::string *buildLog,
+                                            int deviceID) {
 #if HAVE_OPENCL
 
   assert(this->context != NULL);
 
-  //size_t len;
-  cl_int err;
+  if (deviceID < 0) {
+    deviceID = this->currentDeviceID;
+  }
+  assert(deviceID < (int)this->devices.size());
 
   char path[4096];
-  sprintf(path, "%s", filename);
+  snprintf(path, sizeof(path), "%s", filename);
 
   if (verb) {
     cout << "[OCL] Read CL kernel: " << path << "\n";
   }
 
 
-  std::ifstream clsrc(path);
-  std::istreambuf_iterator<char> vdataBegin(clsrc);
-  std::istreambuf_iterator<char> vdataEnd;
-  std::string clstr(vdataBegin, vdataEnd);
+  std::string clstr;
+  {
+    MUDA_PROFILE("readSource");
+    std::ifstream clsrc(path);
+    if (!clsrc) {
+      if (buildLog) {
+        (*buildLog) = std::string("Failed to open file: ") + path + "\n";
+      } else {
+        fprintf(stdout, "[OCL] Failed to open file: %s\n", path);
+      }
+      return NULL;
+    }
+    std::istreambuf_iterator<char> vdataBegin(clsrc);
+    std::istreambuf_iterator<char> vdataEnd;
+    clstr.assign(vdataBegin, vdataEnd);
+  }
+
+  return loadKernelSourceString(clstr.c_str(), clstr.size(), nheaders,
+                                headers, options, buildLog, deviceID);
+#else
 
-  std::vector<const char*> args;
-  std::vector<size_t> lengths;
+  cout << "OpenCL device target is not supported in this build."
+       << "\n";
+  return NULL;
+
+#endif
+}
+
+#if HAVE_OPENCL
+// State of one loadKernelSourceAsync() build.
+struct MUDADeviceOCL::AsyncBuild {
+  std::string filename;
+  std::vector<std::string> headers;
+  std::string options;
+  MUDABuildCallback callback;
+  void *userData;
+
+  std::promise<MUDABuildResult> promise;
+
+  AsyncBuild() : callback(NULL), userData(NULL) {}
+};
+
+// Devices whose build is running on this thread(innermost last). A callback
+// which calls shutdown() must not wait for its own build.
+static thread_local std::vector<MUDADeviceOCL *> tlsBuildingDevices;
+#endif
+
+MUDABuildFuture MUDADeviceOCL::loadKernelSourceAsync(
+    const char *filename, int nheaders, const char **headers,
+    const char *options, MUDABuildCallback callback, void *userData) {
+#if HAVE_OPENCL
+  assert(this->context != NULL);
+
+  std::shared_ptr<AsyncBuild> build(new AsyncBuild());
+  build->filename = filename;
   for (int i = 0; i < nheaders; i++) {
-    args.push_back(headers[i]);
-    lengths.push_back(strlen(headers[i]));
+    build->headers.push_back(headers[i]);
   }
-  args.push_back(clstr.c_str());
-  lengths.push_back(clstr.size());
+  build->options = options ? options : "";
+  build->callback = callback;
+  build->userData = userData;
 
-  int n = int(args.size());
+  MUDABuildFuture future = build->promise.get_future().share();
 
-  MUDAProgram program = new _MUDAProgram;
-  program->progObjOCL = clCreateProgramWithSource(
-      this->context, n, &args.at(0), &lengths.at(0), &err);
-  CL_CHECK(err);
+  {
+    std::lock_guard<std::mutex> lock(this->asyncMutex);
+    this->asyncQueue.push_back(build);
+
+    // Start another build thread unless an idle one can take the build.
+    size_t maxThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    if ((this->asyncQueue.size() > size_t(this->numIdleAsyncThreads)) &&
+        (this->asyncThreads.size() < maxThreads)) {
+      this->asyncThreads.push_back(
+          std::thread(&MUDADeviceOCL::asyncBuildMain, this));
+    }
+  }
+  this->asyncCond.notify_one();
 
-  err = clBuildProgram(program->progObjOCL, 1,
-                       &this->devices[this->currentDeviceID], options, NULL,
-                       NULL);
+  return future;
+#else
+  cout << "OpenCL device target is not supported in this build."
+       << "\n";
+  std::promise<MUDABuildResult> promise;
+  promise.set_value(MUDABuildResult());
+  return promise.get_future().share();
+#endif
+}
 
-  ///< @fixme { make the code NV independent. }
-  if (err != CL_SUCCESS) {
-    fprintf(stdout, "[OCL] clBuildProgram failed. err = %d\n", err);
+void MUDADeviceOCL::asyncBuildMain() {
+#if HAVE_OPENCL
+  std::unique_lock<std::mutex> lock(this->asyncMutex);
+  for (;;) {
+    this->numIdleAsyncThreads++;
+    this->asyncCond.wait(lock, [this] {
+      return this->stopAsyncThreads || !this->asyncQueue.empty();
+    });
+    this->numIdleAsyncThreads--;
+    if (this->asyncQueue.empty()) {
+      return; // stop requested and no more builds.
+    }
 
-    size_t len;
-    std::vector<unsigned char> buffer;
+    std::shared_ptr<AsyncBuild> build = this->asyncQueue.front();
+    this->asyncQueue.pop_front();
+    this->numRunningAsyncBuilds++;
 
-    // Get err str length
-    clGetProgramBuildInfo(program->progObjOCL,
-                          this->devices[this->currentDeviceID],
-                          CL_PROGRAM_BUILD_LOG, 0, NULL, &len);
-    buffer.resize(len);
+    lock.unlock();
+    runAsyncBuild(build);
+    lock.lock();
 
-    clGetProgramBuildInfo(program->progObjOCL,
-                          this->devices[this->currentDeviceID],
-                          CL_PROGRAM_BUILD_LOG, len, &buffer.at(0), NULL);
-    // printf("len = %d\n", (int)len);
-    printf("err: %s\n", &buffer.at(0));
-    exit(1);
+    this->numRunningAsyncBuilds--;
+    this->asyncDoneCond.notify_all();
   }
+#endif
+}
 
-//
-// Setup command queues.
-//
-#if 0
-  {
-    for (int i = 0; i < this->devices.size(); i++) {
-
-      cl_command_queue cmdq;
+void MUDADeviceOCL::runAsyncBuild(std::shared_ptr<AsyncBuild> build) {
+#if HAVE_OPENCL
+  tlsBuildingDevices.push_back(this);
 
-      cmdq = clCreateCommandQueue(this->context, this->devices[i],
-                                  0, //CL_QUEUE_PROFILING_ENABLE,
-                                  &err);
-      if (err != CL_SUCCESS) {
-          cout << "[OCL] Failed to create command queue.\n";
-          exit(-1);
-      }
+  MUDABuildResult result;
 
-      this->commandQueues.push_back(cmdq);
+  std::ifstream clsrc(build->filename.c_str());
+  if (!clsrc) {
+    result.buildLog = "Failed to open file: " + build->filename + "\n";
+  } else {
+    std::istreambuf_iterator<char> vdataBegin(clsrc);
+    std::istreambuf_iterator<char> vdataEnd;
+    std::string clstr(vdataBegin, vdataEnd);
 
+    std::vector<const char *> headers;
+    for (size_t i = 0; i < build->headers.size(); i++) {
+      headers.push_back(build->headers[i].c_str());
     }
+
+    // Synchronous build on this thread. pfn_notify would not save the
+    // thread, since the result must be queried after the build anyway.
+    result.program = loadKernelSourceString(
+        clstr.c_str(), clstr.size(), int(headers.size()),
+        headers.empty() ? NULL : &headers.at(0), build->options.c_str(),
+        &result.buildLog);
+  }
+
+  build->promise.set_value(result);
+  if (build->callback) {
+    build->callback(result, build->userData);
   }
+
+  tlsBuildingDevices.pop_back();
 #else
-  {
-    cl_command_queue cmdq;
+  (void)build;
+#endif
+}
 
-    cmdq = clCreateCommandQueue(this->context,
-                                this->devices[this->currentDeviceID],
-                                0, // CL_QUEUE_PROFILING_ENABLE,
-                                &err);
-    if (err != CL_SUCCESS) {
-      cout << "[OCL] Failed to create command queue.\n";
-      exit(-1);
+void MUDADeviceOCL::waitAsyncBuilds() {
+#if HAVE_OPENCL
+  // Run queued builds on this thread instead of waiting for a build thread,
+  // so that a callback calling shutdown() can not wait for itself.
+  for (;;) {
+    std::shared_ptr<AsyncBuild> build;
+    {
+      std::lock_guard<std::mutex> lock(this->asyncMutex);
+      if (this->asyncQueue.empty()) {
+        break;
+      }
+      build = this->asyncQueue.front();
+      this->asyncQueue.pop_front();
+      this->numRunningAsyncBuilds++;
     }
 
-    this->commandQueues.push_back(cmdq);
-  }
-#endif
+    runAsyncBuild(build);
 
-  return program;
-#else
+    {
+      std::lock_guard<std::mutex> lock(this->asyncMutex);
+      this->numRunningAsyncBuilds--;
+    }
+    this->asyncDoneCond.notify_all();
+  }
 
-  cout << "OpenCL device target is not supported in this build."
-       << "\n";
-  return NULL;
+  // Builds running on this thread(we are in their callback) are not waited.
+  int numOwn = int(std::count(tlsBuildingDevices.begin(),
+                              tlsBuildingDevices.end(), this));
 
+  std::unique_lock<std::mutex> lock(this->asyncMutex);
+  this->asyncDoneCond.wait(
+      lock, [this, numOwn] { return this->numRunningAsyncBuilds <= numOwn; });
 #endif
 }
 
-MUDAProgram MUDADeviceOCL::loadKernelBinary(const char *filename) {
+MUDAProgram MUDADeviceOCL::loadKernelSourceString(
+    const char *source, size_t sourceLen, int nheaders, const char **headers,
+    const char *options, std::string *buildLog, int deviceID) {
 #if HAVE_OPENCL
-  assert(this->context != NULL);
-
-  size_t len;
-  cl_int err;
 
-  char path[4096];
-  sprintf(path, "%s.clbin", filename);
+  assert(this->context != NULL);
 
-  cout << "[OCL] Load CL kernel: " << path << "\n";
+  if (deviceID < 0) {
+    deviceID = this->currentDeviceID;
+  }
+  assert(deviceID < (int)this->devices.size());
 
-  struct stat st;
-  // If this source file does not include <sys/stat.h>, the below line occurs a
-  // compile error.
-  stat(path, &st);
+  cl_int err;
 
-  len = (size_t)st.st_size;
-  FILE *fp = fopen(path, "rb");
-  size_t lens[] = {len};
-  unsigned char *bins[] = {new unsigned char[len]};
-  size_t lenRead = fread(bins[0], 1, len, fp);
-  assert(lenRead == len);
+  std::vector<const char*> args;
+  std::vector<size_t> lengths;
+  for (int i = 0; i < nheaders; i++) {
+    args.push_back(headers[i]);
+    lengths.push_back(strlen(headers[i]));
+  }
+  args.push_back(source);
+  lengths.push_back(sourceLen);
 
-  MUDAProgram program = new _MUDAProgram;
+  int n = int(args.size());
 
-  program->progObjOCL = clCreateProgramWithBinary(
-      this->context, 1,
-      &this->devices[this->currentDeviceID], lens,
-      const_cast<const unsigned char **>(bins), NULL, &err);
+  MUDAProgram program = slab<_MUDAProgram>().create();
+  program->deviceID = deviceID;
+  {
+    MUDA_PROFILE("clCreateProgramWithSource");
+    program->progObjOCL = clCreateProgramWithSource(
+        this->context, n, &args.at(0), &lengths.at(0), &err);
+  }
   CL_CHECK(err);
+  if (err != CL_SUCCESS) {
+    slab<_MUDAProgram>().destroy(program);
+    return NULL;
+  }
 
-  err = clBuildProgram(program->progObjOCL, static_cast<cl_uint>(this->devices.size()),
-                       &this->devices[this->currentDeviceID], NULL, NULL, NULL);
-  delete[] bins[0];
+  {
+    MUDA_PROFILE("clBuildProgram");
+    err = clBuildProgram(program->progObjOCL, 1, &this->devices[deviceID],
+                         options, NULL, NULL);
+  }
 
   ///< @fixme { make the code NV independent. }
   if (err != CL_SUCCESS) {
-    size_t len;
-    char buffer[2048];
+    std::string log;
+    getBuildLog(program, log);
+
+    char msg[128];
+    snprintf(msg, sizeof(msg), "[OCL] clBuildProgram failed. err = %d\n", err);
+    if (buildLog) {
+      (*buildLog) = std::string(msg) + "err: " + log;
+    } else {
+      fprintf(stdout, "%s", msg);
+      printf("err: %s\n", log.c_str());
+    }
 
-    clGetProgramBuildInfo(program->progObjOCL,
-                          this->devices[this->currentDeviceID],
-                          CL_PROGRAM_BUILD_LOG, sizeof(buffer), buffer, &len);
-    printf("%s\n", buffer);
-    exit(1);
+    // Do not exit here so that the caller can continue with other kernels.
+    clReleaseProgram(program->progObjOCL);
+    slab<_MUDAProgram>().destroy(program);
+    return NULL;
   }
 
-  //
-  // Setup command queues.
-  //
-  {
-    for (int i = 0; i < (int)this->devices.size(); i++) {
-      printf("[OCL] OpenCL Device %d Info:\n", i);
-      // oclPrintDevInfo(LOGBOTH, this->devices[i]);
-
-      cl_command_queue cmdq;
-
-      cmdq = clCreateCommandQueue(this->context, this->devices[i], 0, &err);
-      if (err != CL_SUCCESS) {
-        cout << "[OCL] Failed to create command queue.\n";
-        exit(-1);
-      }
+  if (buildLog) {
+    getBuildLog(program, *buildLog);
+  }
 
-      this->commandQueues.push_back(cmdq);
-    }
+  if (!setupCommandQueue(program->deviceID)) {
+    clReleaseProgram(program->progObjOCL);
+    slab<_MUDAProgram>().destroy(program);
+    return NULL;
   }
 
+  trackProgram(program);
   return program;
 #else
+
   cout << "OpenCL device target is not supported in this build."
        << "\n";
   return NULL;
+
 #endif
 }
 
-bool MUDADeviceOCL::getModule(
-  MUDAProgram program,
-  std::vector<char>& binary)
-{
-  size_t numReads;
-  cl_uint numDevices;
-  cl_int err = clGetProgramInfo(program->progObjOCL, CL_PROGRAM_NUM_DEVICES,
-                         sizeof(cl_uint), &numDevices, &numReads);
-  CL_CHECK(err);
-
-  // @fixme
-  if (numDevices != 1) {
-    return false;
-  }
+bool MUDADeviceOCL::getBuildLog(MUDAProgram program, std::string &log) {
+#if HAVE_OPENCL
+  log.clear();
 
-  std::vector<size_t> sizes(numDevices);
-  err = clGetProgramInfo(program->progObjOCL, CL_PROGRAM_BINARY_SIZES,
-                         sizeof(size_t) * numDevices, &sizes.at(0), &numReads);
-  CL_CHECK(err);
+  cl_device_id device = this->devices[program->deviceID];
 
-  if (err != CL_SUCCESS) {
+  size_t len = 0;
+  cl_int err = clGetProgramBuildInfo(program->progObjOCL, device,
+                                     CL_PROGRAM_BUILD_LOG, 0, NULL, &len);
+  if ((err != CL_SUCCESS) || (len == 0)) {
     return false;
   }
 
-  std::vector<char *> binaries(numDevices);
-  for (cl_uint i = 0; i < numDevices; i++) {
-    printf("[OCL] Binary size[%d] = %d bytes\n", i, static_cast<int>(sizes[i]));
-    binaries[i] = new char[sizes[i]];
-  }
-
-  err = clGetProgramInfo(program->progObjOCL, CL_PROGRAM_BINARIES,
-                         sizeof(unsigned char *) * numDevices, &binaries.at(0),
-                         &numReads);
-  CL_CHECK(err);
-
+  std::vector<char> buffer(len + 1, '\0');
+  err = clGetProgramBuildInfo(program->progObjOCL, device,
+                              CL_PROGRAM_BUILD_LOG, len, &buffer.at(0), NULL);
   if (err != CL_SUCCESS) {
     return false;
   }
 
-  binary.resize(sizes[0]);
-  memcpy(&binary.at(0), binaries[0], sizes[0]);
-
-  for (cl_uint i = 0; i < numDevices; i++) {
-    delete [] binaries[i];
-  }
-
+  log = std::string(&buffer.at(0));
   return true;
+#else
+  cout << "OpenCL device target is not supported in this build."
+       << "\n";
+  return false;
+#endif
 }
 
-MUDAMemory MUDADeviceOCL::alloc(MUDAMemoryType memType,
-                                MUDAMemoryAttrib memAttrib, size_t memSize) {
+void MUDADeviceOCL::trackProgram(MUDAProgram program) {
 #if HAVE_OPENCL
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->programs.push_back(program);
+#else
+  (void)program;
+#endif
+}
 
-  assert(this->context != NULL);
-
-  MUDAMemory mem = new _MUDAMemory;
-
-  cl_int flag = 0;
-
-  if (memAttrib == muda::ro) {
-    flag |= CL_MEM_READ_ONLY;
-  } else if (memAttrib == muda::wo) {
-    flag |= CL_MEM_WRITE_ONLY;
-  } else if (memAttrib == muda::rw) {
-    flag |= CL_MEM_READ_WRITE;
+bool MUDADeviceOCL::releaseProgram(MUDAProgram program) {
+#if HAVE_OPENCL
+  if (!program) {
+    return false;
   }
 
-  cl_int err;
-  cl_mem memObj = clCreateBuffer(this->context, flag, memSize, NULL, &err);
-  CL_CHECK(err);
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    untrack(this->programs, program);
+  }
 
-  mem->memObjOCL = memObj;
-  mem->size = memSize;
-  mem->ptr = NULL; // OCL target don't use this member.
+  releaseKernelTable(program);
 
-  return mem;
+  cl_int err = clReleaseProgram(program->progObjOCL);
+  CL_CHECK(err);
 
+  slab<_MUDAProgram>().destroy(program);
+  return (err == CL_SUCCESS ? true : false);
 #else
-
   cout << "OpenCL device target is not supported in this build."
        << "\n";
-  return NULL;
-
+  return false;
 #endif
 }
 
-#if 0
+void MUDADeviceOCL::setCommandQueues(int numQueuesPerDevice,
+                                     bool outOfOrder) {
+  this->queuesPerDevice = (numQueuesPerDevice > 0) ? numQueuesPerDevice : 1;
+  this->outOfOrderQueues = outOfOrder;
+}
+
+int MUDADeviceOCL::resolveDeviceID(int deviceID) {
+#if HAVE_OPENCL
+  // A context created by initialize() has only the current device.
+  if ((deviceID < 0) || !this->useAllDevices) {
+    return this->currentDeviceID;
+  }
+  assert(deviceID < (int)this->devices.size());
+  return deviceID;
+#else
+  return deviceID;
+#endif
+}
+
+bool MUDADeviceOCL::setupCommandQueue(int deviceID) {
+#if HAVE_OPENCL
+  //
+  // Setup command queues of the device.
+  // Queues are shared by all programs in this context, so create them only
+  // once.
+  //
+  deviceID = resolveDeviceID(deviceID);
+
+  std::lock_guard<std::mutex> lock(this->mutex);
+  if (this->queuePool.size() < this->devices.size()) {
+    this->queuePool.resize(this->devices.size());
+  }
+
+  QueueSet &set = this->queuePool[deviceID];
+  if (!set.queues.empty()) {
+    return true;
+  }
+
+  MUDA_PROFILE("clCreateCommandQueue");
+
+  cl_command_queue_properties props = 0;
+  if (this->kernelProfiling) {
+    props |= CL_QUEUE_PROFILING_ENABLE;
+  }
+  if (this->outOfOrderQueues) {
+    cl_command_queue_properties supported = 0;
+    clGetDeviceInfo(this->devices[deviceID], CL_DEVICE_QUEUE_PROPERTIES,
+                    sizeof(supported), &supported, NULL);
+    if (supported & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE) {
+      props |= CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE;
+    } else if (this->verb) {
+      cout << "[OCL] Out-of-order queue is not supported. Use in-order "
+              "queue.\n";
+    }
+  }
+
+  for (int i = 0; i < this->queuesPerDevice; i++) {
+    cl_int err;
+    cl_command_queue cmdq = clCreateCommandQueue(
+        this->context, this->devices[deviceID], props, &err);
+    if (err != CL_SUCCESS) {
+      cout << "[OCL] Failed to create command queue.\n";
+      break;
+    }
+    set.queues.push_back(cmdq);
+  }
+  set.outOfOrder = (props & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE) != 0;
+
+  return !set.queues.empty();
+#else
+  (void)deviceID;
+  return false;
+#endif
+}
+
+MUDAProgram MUDADeviceOCL::loadKernelBinary(const unsigned char *binary,
+                                            size_t len, std::string *buildLog,
+                                            int deviceID) {
+#if HAVE_OPENCL
+  assert(this->context != NULL);
+
+  if (deviceID < 0) {
+    deviceID = this->currentDeviceID;
+  }
+  assert(deviceID < (int)this->devices.size());
+
+  cl_int err;
+  cl_int binaryStatus = CL_SUCCESS;
+
+  MUDAProgram program = slab<_MUDAProgram>().create();
+  program->deviceID = deviceID;
+
+  {
+    MUDA_PROFILE("clCreateProgramWithBinary");
+    program->progObjOCL = clCreateProgramWithBinary(
+        this->context, 1, &this->devices[deviceID], &len, &binary,
+        &binaryStatus, &err);
+  }
+  if ((err != CL_SUCCESS) || (binaryStatus != CL_SUCCESS)) {
+    // e.g. binary was generated by other driver version.
+    if (buildLog) {
+      char msg[128];
+      snprintf(msg, sizeof(msg),
+               "[OCL] clCreateProgramWithBinary failed. err = %d\n",
+               (err != CL_SUCCESS) ? err : binaryStatus);
+      (*buildLog) = msg;
+    }
+    if (err == CL_SUCCESS) {
+      clReleaseProgram(program->progObjOCL);
+    }
+    slab<_MUDAProgram>().destroy(program);
+    return NULL;
+  }
+
+  {
+    MUDA_PROFILE("clBuildProgram(binary)");
+    err = clBuildProgram(program->progObjOCL, 1, &this->devices[deviceID],
+                         NULL, NULL, NULL);
+  }
+
+  if (buildLog) {
+    getBuildLog(program, *buildLog);
+  }
+
+  if ((err != CL_SUCCESS) || !setupCommandQueue(program->deviceID)) {
+    clReleaseProgram(program->progObjOCL);
+    slab<_MUDAProgram>().destroy(program);
+    return NULL;
+  }
+
+  trackProgram(program);
+  return program;
+#else
+  cout << "OpenCL device target is not supported in this build."
+       << "\n";
+  return NULL;
+#endif
+}
+
+std::string MUDADeviceOCL::getDriverVersion(int deviceID) {
+#if HAVE_OPENCL
+  if (deviceID < 0) {
+    deviceID = this->currentDeviceID;
+  }
+  char buffer[2048];
+  buffer[0] = '\0';
+  clGetDeviceInfo(this->devices[deviceID], CL_DRIVER_VERSION, sizeof(buffer),
+                  buffer, NULL);
+  return std::string(buffer);
+#else
+  (void)deviceID;
+  return std::string();
+#endif
+}
+
+std::string MUDADeviceOCL::getDeviceKey(int deviceID) {
+  return getDeviceName(deviceID) + " / " + getDriverVersion(deviceID);
+}
+
+std::string MUDADeviceOCL::getPlatformVersion() {
+#if HAVE_OPENCL
+  char buffer[2048];
+  buffer[0] = '\0';
+  clGetPlatformInfo(this->platform, CL_PLATFORM_VERSION, sizeof(buffer), buffer,
+                    NULL);
+  return std::string(buffer);
+#else
+  return std::string();
+#endif
+}
+
+MUDAProgram MUDADeviceOCL::loadKernelBinary(const char *filename) {
+#if HAVE_OPENCL
+  assert(this->context != NULL);
+
+  char path[4096];
+  snprintf(path, sizeof(path), "%s.clbin", filename);
+
+  cout << "[OCL] Load CL kernel: " << path << "\n";
+
+  FILE *fp = fopen(path, "rb");
+  if (!fp) {
+    fprintf(stderr, "[OCL] Failed to open %s\n", path);
+    return NULL;
+  }
+
+  std::vector<unsigned char> binary;
+  unsigned char buf[65536];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+    binary.insert(binary.end(), buf, buf + n);
+  }
+  bool readError = ferror(fp) != 0;
+  fclose(fp);
+
+  if (readError || binary.empty()) {
+    fprintf(stderr, "[OCL] Failed to read %s\n", path);
+    return NULL;
+  }
+
+  std::string log;
+  MUDAProgram program =
+      loadKernelBinary(&binary.at(0), binary.size(), &log, -1);
+  if (!program) {
+    fprintf(stderr, "%s\n", log.c_str());
+  }
+  return program;
+#else
+  (void)filename;
+  cout << "OpenCL device target is not supported in this build."
+       << "\n";
+  return NULL;
+#endif
+}
+
+bool MUDADeviceOCL::getModule(
+  MUDAProgram program,
+  std::vector<char>& binary)
+{
+  MUDA_PROFILE("getModule");
+
+  size_t numReads;
+  cl_uint numDevices;
+  cl_int err = clGetProgramInfo(program->progObjOCL, CL_PROGRAM_NUM_DEVICES,
+                         sizeof(cl_uint), &numDevices, &numReads);
+  CL_CHECK(err);
+
+  if ((err != CL_SUCCESS) || (numDevices < 1)) {
+    return false;
+  }
+
+  // Program may be associated with multiple devices when the context was
+  // created with initializeAllDevices(). Pick the one it was built for.
+  std::vector<cl_device_id> programDevices(numDevices);
+  err = clGetProgramInfo(program->progObjOCL, CL_PROGRAM_DEVICES,
+                         sizeof(cl_device_id) * numDevices,
+                         &programDevices.at(0), &numReads);
+  CL_CHECK(err);
+
+  if (err != CL_SUCCESS) {
+    return false;
+  }
+
+  cl_uint index = 0;
+  for (cl_uint i = 0; i < numDevices; i++) {
+    if (programDevices[i] == this->devices[program->deviceID]) {
+      index = i;
+    }
+  }
+
+  std::vector<size_t> sizes(numDevices);
+  err = clGetProgramInfo(program->progObjOCL, CL_PROGRAM_BINARY_SIZES,
+                         sizeof(size_t) * numDevices, &sizes.at(0), &numReads);
+  CL_CHECK(err);
+
+  if ((err != CL_SUCCESS) || (sizes[index] == 0)) {
+    return false;
+  }
+
+  std::vector<std::vector<unsigned char> > buffers(numDevices);
+  std::vector<unsigned char *> binaries(numDevices, NULL);
+  for (cl_uint i = 0; i < numDevices; i++) {
+    if (verb) {
+      printf("[OCL] Binary size[%d] = %d bytes\n", i,
+             static_cast<int>(sizes[i]));
+    }
+    if (sizes[i] > 0) {
+      buffers[i].resize(sizes[i]);
+      binaries[i] = &buffers[i].at(0);
+    }
+  }
+
+  err = clGetProgramInfo(program->progObjOCL, CL_PROGRAM_BINARIES,
+                         sizeof(unsigned char *) * numDevices, &binaries.at(0),
+                         &numReads);
+  CL_CHECK(err);
+
+  if (err != CL_SUCCESS) {
+    return false;
+  }
+
+  binary.assign(buffers[index].begin(), buffers[index].end());
+
+  return true;
+}
+
+MUDAMemory MUDADeviceOCL::alloc(MUDAMemoryType memType,
+                                MUDAMemoryAttrib memAttrib, size_t memSize) {
+  return alloc(memType, memAttrib, memSize, NULL);
+}
+
+MUDAMemory MUDADeviceOCL::alloc(MUDAMemoryType memType,
+                                MUDAMemoryAttrib memAttrib, size_t memSize,
+                                void *hostPtr) {
+#if HAVE_OPENCL
+
+  (void)memType;
+
+  assert(this->context != NULL);
+
+  cl_mem_flags flag = 0;
+
+  if (memAttrib == muda::ro) {
+    flag |= CL_MEM_READ_ONLY;
+  } else if (memAttrib == muda::wo) {
+    flag |= CL_MEM_WRITE_ONLY;
+  } else if (memAttrib == muda::rw) {
+    flag |= CL_MEM_READ_WRITE;
+  }
+
+  if (hostPtr) {
+    flag |= CL_MEM_USE_HOST_PTR;
+  } else if (this->memoryPool) {
+    cl_mem memObj;
+    MUDAPoolBlock *block = this->memoryPool->alloc(memSize, &memObj);
+    if (block) {
+      MUDAMemory mem = slab<_MUDAMemory>().create();
+      mem->memObjOCL = memObj;
+      mem->poolBlock = block;
+      mem->size = memSize;
+      mem->ptr = NULL;
+      return mem;
+    }
+    // Too large for the pool. Allocate a dedicated buffer.
+  }
+
+  cl_int err;
+  cl_mem memObj = clCreateBuffer(this->context, flag, memSize, hostPtr, &err);
+  CL_CHECK(err);
+  if (err != CL_SUCCESS) {
+    return NULL;
+  }
+
+  MUDAMemory mem = slab<_MUDAMemory>().create();
+  mem->memObjOCL = memObj;
+  mem->poolBlock = NULL;
+  mem->size = memSize;
+  mem->ptr = hostPtr; // Storage given by the caller, or NULL.
+
+  return mem;
+
+#else
+
+  cout << "OpenCL device target is not supported in this build."
+       << "\n";
+  return NULL;
+
+#endif
+}
+
+#if 0
 MUDAMemory
 MUDADeviceOCL::allocImage(
     MUDAMemoryType   memType,
@@ -596,7 +1262,7 @@ MUDADeviceOCL::allocImage(
 
     assert(this->context != NULL);
 
-    MUDAMemory mem = new _MUDAMemory;
+    MUDAMemory mem = slab<_MUDAMemory>().create();
 
     cl_int flag = 0;
 
@@ -635,9 +1301,26 @@ MUDADeviceOCL::allocImage(
 bool MUDADeviceOCL::free(MUDAMemory mem) {
 #if HAVE_OPENCL
 
+  if (mem->poolBlock) {
+    // Keep the sub-buffer for reuse once commands of every queue which may
+    // use it have completed.
+    assert(this->memoryPool);
+    std::vector<cl_command_queue> queues;
+    {
+      std::lock_guard<std::mutex> lock(this->mutex);
+      for (size_t i = 0; i < this->queuePool.size(); i++) {
+        queues.insert(queues.end(), this->queuePool[i].queues.begin(),
+                      this->queuePool[i].queues.end());
+      }
+    }
+    this->memoryPool->free(mem->poolBlock, queues);
+    slab<_MUDAMemory>().destroy(mem);
+    return true;
+  }
+
   clReleaseMemObject(mem->memObjOCL);
 
-  delete mem;
+  slab<_MUDAMemory>().destroy(mem);
   return true;
 
 #else
@@ -649,31 +1332,45 @@ bool MUDADeviceOCL::free(MUDAMemory mem) {
 #endif
 }
 
-MUDAKernel MUDADeviceOCL::createKernel(const MUDAProgram program,
-                                       const char *functionName) {
+bool MUDADeviceOCL::setMemoryPool(size_t slabSize) {
 #if HAVE_OPENCL
 
   assert(this->context != NULL);
 
-  MUDAKernel kernel = new _MUDAKernel;
-
-  cl_int err;
-  kernel->kernObjOCL = clCreateKernel(program->progObjOCL, functionName, &err);
-
-  if (err != CL_SUCCESS) {
-
-    cout << "[OCL] Failed to create kernel. function name = " << functionName
-         << "\n";
+  if (this->memoryPool) {
+    if (this->memoryPool->numLiveBlocks() > 0) {
+      cout << "[OCL] Memory pool still has live allocations.\n";
+      return false;
+    }
+    delete this->memoryPool;
+    this->memoryPool = NULL;
+  }
 
-    delete kernel;
+  if (slabSize == 0) {
+    return true;
+  }
 
-    exit(-1);
+  // Sub-buffer origin must be aligned for every device in the context.
+  size_t alignment = 1;
+  for (size_t i = 0; i < this->devices.size(); i++) {
+    if (!this->useAllDevices && (int(i) != this->currentDeviceID)) {
+      continue;
+    }
+    cl_uint bits = 0;
+    cl_int err = clGetDeviceInfo(this->devices[i],
+                                 CL_DEVICE_MEM_BASE_ADDR_ALIGN,
+                                 sizeof(cl_uint), &bits, NULL);
+    CL_CHECK(err);
+    alignment = std::max(alignment, size_t(bits / 8));
   }
 
-  return kernel;
+  this->memoryPool = new MUDAMemoryPool(this->context, slabSize, alignment);
+
+  return true;
 
 #else
 
+  (void)slabSize;
   cout << "OpenCL device target is not supported in this build."
        << "\n";
   return false;
@@ -681,66 +1378,844 @@ MUDAKernel MUDADeviceOCL::createKernel(const MUDAProgram program,
 #endif
 }
 
-bool MUDADeviceOCL::read(int deviceID, MUDAMemory mem, size_t size, void *ptr) {
-#ifdef HAVE_OPENCL
+bool MUDADeviceOCL::getMemoryPoolStats(MUDAMemoryPoolStats *stats) {
+#if HAVE_OPENCL
 
-  assert(this->context != NULL);
+  if (!this->memoryPool) {
+    return false;
+  }
 
-  cl_event event;
+  (*stats) = this->memoryPool->getStats();
+  return true;
 
-  if (this->debug) {
-    cout << "[OCL] read operation started.\n";
-  }
+#else
 
-  // blocking read.
+  (void)stats;
+  return false;
 
-  clEnqueueReadBuffer(this->commandQueues[deviceID], mem->memObjOCL, CL_FALSE,
-                      0, size, ptr, 0, NULL, &event);
+#endif
+}
 
-  clWaitForEvents(1, &event);
-  cl_int err = clReleaseEvent(event);
-  CL_CHECK(err);
+size_t MUDADeviceOCL::trimMemoryPool() {
+#if HAVE_OPENCL
 
-  if (this->debug) {
-    cout << "[OCL] read operation ended.\n";
-  }
+  return this->memoryPool ? this->memoryPool->trim() : 0;
 
-  return (err == CL_SUCCESS ? true : false);
 #else
 
-  cout << "OpenCL device target is not supported in this build."
-       << "\n";
-  return false;
+  return 0;
 
 #endif
 }
 
-bool MUDADeviceOCL::write(int deviceID, MUDAMemory mem, size_t size,
-                          const void *ptr) {
-#ifdef HAVE_OPENCL
+void *MUDADeviceOCL::allocHost(size_t size) {
+#if HAVE_OPENCL
 
   assert(this->context != NULL);
 
-  if (this->debug) {
-    cout << "[OCL] write operation started.\n";
+  if (size == 0) {
+    return NULL;
   }
 
-  cl_event event;
-
-  assert(this->commandQueues[deviceID]);
-  assert(mem->memObjOCL);
-
-  cl_int err =
-      clEnqueueWriteBuffer(this->commandQueues[deviceID], mem->memObjOCL,
-                           CL_TRUE, 0, size, ptr, 0, NULL, &event);
-  CL_CHECK(err);
+  {
+    // Best fit among free blocks, but don't waste a block twice as large.
+    std::lock_guard<std::mutex> lock(this->pinnedMutex);
+    int best = -1;
+    for (size_t i = 0; i < this->pinnedPool.size(); i++) {
+      const PinnedBlock &block = this->pinnedPool[i];
+      if (block.inUse || (block.size < size) || (block.size / 2 > size)) {
+        continue;
+      }
+      if ((best < 0) || (block.size < this->pinnedPool[best].size)) {
+        best = int(i);
+      }
+    }
+    if (best >= 0) {
+      this->pinnedPool[best].inUse = true;
+      return this->pinnedPool[best].ptr;
+    }
+  }
+
+  cl_command_queue queue = getQueue(-1);
+  if (!queue) {
+    return NULL;
+  }
+
+  MUDA_PROFILE("allocHost");
+
+  // Round up to 64 KB, so that the block can be reused by slightly larger
+  // requests.
+  PinnedBlock block;
+  block.size = (size + 0xffff) & ~size_t(0xffff);
+  block.inUse = true;
+
+  cl_int err;
+  block.memObj =
+      clCreateBuffer(this->context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+                     block.size, NULL, &err);
+  CL_CHECK(err);
+  if (err != CL_SUCCESS) {
+    return NULL;
+  }
+
+  // Map once. The mapped region is pinned by the driver.
+  block.ptr = clEnqueueMapBuffer(queue, block.memObj, CL_TRUE,
+                                 CL_MAP_READ | CL_MAP_WRITE, 0, block.size, 0,
+                                 NULL, NULL, &err);
+  CL_CHECK(err);
+  if (err != CL_SUCCESS) {
+    clReleaseMemObject(block.memObj);
+    return NULL;
+  }
+
+  std::lock_guard<std::mutex> lock(this->pinnedMutex);
+  this->pinnedPool.push_back(block);
+
+  return block.ptr;
+
+#else
+
+  cout << "OpenCL device target is not supported in this build."
+       << "\n";
+  return NULL;
+
+#endif
+}
+
+bool MUDADeviceOCL::freeHost(void *ptr) {
+#if HAVE_OPENCL
+
+  std::lock_guard<std::mutex> lock(this->pinnedMutex);
+  for (size_t i = 0; i < this->pinnedPool.size(); i++) {
+    if (this->pinnedPool[i].inUse && (this->pinnedPool[i].ptr == ptr)) {
+      this->pinnedPool[i].inUse = false;
+      return true;
+    }
+  }
+
+  cout << "[OCL] freeHost: pointer was not allocated by allocHost().\n";
+  return false;
+
+#else
+
+  cout << "OpenCL device target is not supported in this build."
+       << "\n";
+  return false;
+
+#endif
+}
+
+MUDAKernel MUDADeviceOCL::createKernel(const MUDAProgram program,
+                                       const char *functionName) {
+#if HAVE_OPENCL
+
+  assert(this->context != NULL);
+
+  MUDAKernel kernel = slab<_MUDAKernel>().create();
+
+  cl_int err;
+  kernel->kernObjOCL = clCreateKernel(program->progObjOCL, functionName, &err);
+  kernel->name = functionName;
+
+  if (err != CL_SUCCESS) {
+
+    cout << "[OCL] Failed to create kernel. function name = " << functionName
+         << "\n";
+
+    slab<_MUDAKernel>().destroy(kernel);
+
+    return NULL;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->kernels.push_back(kernel);
+  }
+
+  return kernel;
+
+#else
+
+  cout << "OpenCL device target is not supported in this build."
+       << "\n";
+  return NULL;
+
+#endif
+}
+
+MUDAKernel MUDADeviceOCL::getKernel(MUDAProgram program,
+                                    const char *functionName) {
+#if HAVE_OPENCL
+
+  assert(this->context != NULL);
+
+  std::lock_guard<std::mutex> lock(program->kernelMutex);
+
+  if (!program->kernelTableBuilt) {
+    program->kernelTableBuilt = true;
+
+    cl_uint n = 0;
+    cl_int err = clCreateKernelsInProgram(program->progObjOCL, 0, NULL, &n);
+    CL_CHECK(err);
+
+    std::vector<cl_kernel> kernelObjs(n);
+    if ((err == CL_SUCCESS) && (n > 0)) {
+      err = clCreateKernelsInProgram(program->progObjOCL, n, &kernelObjs.at(0),
+                                     NULL);
+      CL_CHECK(err);
+    }
+
+    for (cl_uint i = 0; (err == CL_SUCCESS) && (i < n); i++) {
+      size_t len = 0;
+      clGetKernelInfo(kernelObjs[i], CL_KERNEL_FUNCTION_NAME, 0, NULL, &len);
+      std::vector<char> name(len + 1, '\0');
+      clGetKernelInfo(kernelObjs[i], CL_KERNEL_FUNCTION_NAME, len, &name.at(0),
+                      NULL);
+
+      MUDAKernel kernel = slab<_MUDAKernel>().create();
+      kernel->kernObjOCL = kernelObjs[i];
+      kernel->name = &name.at(0);
+      MUDAKernelInstances &instances = program->kernelTable[kernel->name];
+      instances.all.push_back(kernel);
+      instances.idle.push_back(kernel);
+    }
+  }
+
+  std::unordered_map<std::string, MUDAKernelInstances>::iterator it =
+      program->kernelTable.find(functionName);
+  if (it == program->kernelTable.end()) {
+    cout << "[OCL] Kernel not found. function name = " << functionName
+         << "\n";
+    return NULL;
+  }
+
+  MUDAKernelInstances &instances = it->second;
+  if (!instances.idle.empty()) {
+    MUDAKernel kernel = instances.idle.back();
+    instances.idle.pop_back();
+    return kernel;
+  }
+
+  // clSetKernelArg() is not thread-safe for the same kernel object, so a
+  // concurrent user gets its own instance.
+  cl_int err;
+  cl_kernel kernelObj =
+      clCreateKernel(program->progObjOCL, functionName, &err);
+  CL_CHECK(err);
+  if (err != CL_SUCCESS) {
+    return NULL;
+  }
+
+  MUDAKernel kernel = slab<_MUDAKernel>().create();
+  kernel->kernObjOCL = kernelObj;
+  kernel->name = functionName;
+  instances.all.push_back(kernel);
+
+  return kernel;
+
+#else
+
+  cout << "OpenCL device target is not supported in this build."
+       << "\n";
+  return NULL;
+
+#endif
+}
+
+bool MUDADeviceOCL::putKernel(MUDAProgram program, MUDAKernel kernel) {
+#if HAVE_OPENCL
+
+  std::lock_guard<std::mutex> lock(program->kernelMutex);
+
+  std::unordered_map<std::string, MUDAKernelInstances>::iterator it =
+      program->kernelTable.find(kernel->name);
+  if (it == program->kernelTable.end()) {
+    return false;
+  }
+
+  MUDAKernelInstances &instances = it->second;
+  if (std::find(instances.all.begin(), instances.all.end(), kernel) ==
+      instances.all.end()) {
+    return false; // Not from getKernel() of this program.
+  }
+  assert(std::find(instances.idle.begin(), instances.idle.end(), kernel) ==
+         instances.idle.end());
+  instances.idle.push_back(kernel);
+  return true;
+
+#else
+
+  (void)program;
+  (void)kernel;
+  return false;
+
+#endif
+}
+
+bool MUDADeviceOCL::releaseKernel(MUDAKernel kernel) {
+#if HAVE_OPENCL
+
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    untrack(this->kernels, kernel);
+  }
+
+  cl_int err = clReleaseKernel(kernel->kernObjOCL);
+  CL_CHECK(err);
+
+  slab<_MUDAKernel>().destroy(kernel);
+
+  return (err == CL_SUCCESS ? true : false);
+
+#else
+
+  cout << "OpenCL device target is not supported in this build."
+       << "\n";
+  return false;
+
+#endif
+}
+
+bool MUDADeviceOCL::getWorkGroupLimits(MUDAKernel kernel,
+                                       MUDAWorkGroupLimits *limits,
+                                       int deviceID) {
+#if HAVE_OPENCL
+
+  assert(this->context != NULL);
+
+  if (deviceID < 0) {
+    deviceID = this->currentDeviceID;
+  }
+  cl_device_id device = this->devices[deviceID];
+
+  size_t deviceMax = 0, kernelMax = 0, multiple = 0;
+  cl_int err = clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_GROUP_SIZE,
+                               sizeof(size_t), &deviceMax, NULL);
+  if (err == CL_SUCCESS) {
+    err = clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_ITEM_SIZES,
+                          3 * sizeof(size_t), limits->maxWorkItemSizes, NULL);
+  }
+  if (err == CL_SUCCESS) {
+    err = clGetKernelWorkGroupInfo(kernel->kernObjOCL, device,
+                                   CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t),
+                                   &kernelMax, NULL);
+  }
+  if (err == CL_SUCCESS) {
+    err = clGetKernelWorkGroupInfo(
+        kernel->kernObjOCL, device,
+        CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE, sizeof(size_t),
+        &multiple, NULL);
+  }
+  CL_CHECK(err);
+  if (err != CL_SUCCESS) {
+    return false;
+  }
+
+  limits->maxWorkGroupSize = std::min(deviceMax, kernelMax);
+  limits->preferredMultiple = (multiple > 0) ? multiple : 1;
+
+  return true;
+
+#else
+
+  cout << "OpenCL device target is not supported in this build."
+       << "\n";
+  return false;
+
+#endif
+}
+
+bool MUDADeviceOCL::read(int deviceID, MUDAMemory mem, size_t size, void *ptr) {
+#ifdef HAVE_OPENCL
+
+  if (this->debug) {
+    cout << "[OCL] read operation started.\n";
+  }
+
+  if (useStaging(deviceID, size, ptr)) {
+    return stagedTransfer(deviceID, mem, size, ptr, /* isWrite */ false);
+  }
+
+  // blocking read.
+  MUDAEvent event = readAsync(deviceID, mem, size, ptr);
+  if (!event) {
+    return false;
+  }
+
+  bool ret = wait(event);
+  releaseEvent(event);
+
+  if (this->debug) {
+    cout << "[OCL] read operation ended.\n";
+  }
+
+  return ret;
+#else
+
+  cout << "OpenCL device target is not supported in this build."
+       << "\n";
+  return false;
+
+#endif
+}
+
+bool MUDADeviceOCL::write(int deviceID, MUDAMemory mem, size_t size,
+                          const void *ptr) {
+#ifdef HAVE_OPENCL
+
+  if (this->debug) {
+    cout << "[OCL] write operation started.\n";
+  }
+
+  if (useStaging(deviceID, size, ptr)) {
+    return stagedTransfer(deviceID, mem, size, const_cast<void *>(ptr),
+                          /* isWrite */ true);
+  }
+
+  MUDAEvent event = writeAsync(deviceID, mem, size, ptr);
+  if (!event) {
+    return false;
+  }
+
+  bool ret = wait(event);
+  releaseEvent(event);
+
+  if (this->debug) {
+    cout << "[OCL] write operation ended.\n";
+  }
+
+  return ret;
+
+#else
+
+  cout << "OpenCL device target is not supported in this build."
+       << "\n";
+  return false;
+
+#endif
+}
+
+MUDAEvent MUDADeviceOCL::readAsync(int deviceID, MUDAMemory mem, size_t size,
+                                   void *ptr, int numWaitEvents,
+                                   const MUDAEvent *waitList) {
+#ifdef HAVE_OPENCL
+
+  assert(this->context != NULL);
+  assert(mem->memObjOCL);
+
+  cl_command_queue queue = getQueue(deviceID);
+  if (!queue) {
+    return NULL;
+  }
+
+  std::vector<cl_event> waits;
+  toCLEvents(numWaitEvents, waitList, &waits);
+
+  cl_event event;
+  cl_int err = clEnqueueReadBuffer(
+      queue, mem->memObjOCL, CL_FALSE, 0, size, ptr,
+      cl_uint(waits.size()), waits.empty() ? NULL : &waits.at(0), &event);
+  CL_CHECK(err);
+  if (err != CL_SUCCESS) {
+    return NULL;
+  }
+
+  MUDAEvent ev = slab<_MUDAEvent>().create();
+  ev->eventCL = event;
+  return ev;
+
+#else
+
+  cout << "OpenCL device target is not supported in this build."
+       << "\n";
+  return NULL;
+
+#endif
+}
+
+MUDAEvent MUDADeviceOCL::writeAsync(int deviceID, MUDAMemory mem, size_t size,
+                                    const void *ptr, int numWaitEvents,
+                                    const MUDAEvent *waitList) {
+#ifdef HAVE_OPENCL
+
+  assert(this->context != NULL);
+  assert(mem->memObjOCL);
+
+  cl_command_queue queue = getQueue(deviceID);
+  if (!queue) {
+    return NULL;
+  }
+
+  std::vector<cl_event> waits;
+  toCLEvents(numWaitEvents, waitList, &waits);
+
+  cl_event event;
+  cl_int err = clEnqueueWriteBuffer(
+      queue, mem->memObjOCL, CL_FALSE, 0, size, ptr,
+      cl_uint(waits.size()), waits.empty() ? NULL : &waits.at(0), &event);
+  CL_CHECK(err);
+  if (err != CL_SUCCESS) {
+    return NULL;
+  }
+
+  MUDAEvent ev = slab<_MUDAEvent>().create();
+  ev->eventCL = event;
+  return ev;
+
+#else
+
+  cout << "OpenCL device target is not supported in this build."
+       << "\n";
+  return NULL;
+
+#endif
+}
+
+bool MUDADeviceOCL::useStaging(int deviceID, size_t size, const void *ptr) {
+#ifdef HAVE_OPENCL
+
+  if ((this->stagingChunkSize == 0) || (size < this->stagingChunkSize)) {
+    return false;
+  }
+
+  // CPU and integrated GPU read pageable memory directly.
+  DeviceLimits limits;
+  if (!getDeviceLimits(deviceID, &limits) || limits.hostUnifiedMemory) {
+    return false;
+  }
+
+  // Memory of allocHost() is already pinned.
+  std::lock_guard<std::mutex> lock(this->pinnedMutex);
+  const char *p = reinterpret_cast<const char *>(ptr);
+  for (size_t i = 0; i < this->pinnedPool.size(); i++) {
+    const char *base = reinterpret_cast<const char *>(this->pinnedPool[i].ptr);
+    if ((p >= base) && (p < base + this->pinnedPool[i].size)) {
+      return false;
+    }
+  }
+
+  return true;
+
+#else
+
+  (void)deviceID;
+  (void)size;
+  (void)ptr;
+  return false;
+
+#endif
+}
+
+bool MUDADeviceOCL::stagedTransfer(int deviceID, MUDAMemory mem, size_t size,
+                                   void *ptr, bool isWrite) {
+#ifdef HAVE_OPENCL
+
+  assert(this->context != NULL);
+  assert(mem->memObjOCL);
+
+  // Chunks go to one queue, so that they complete in order.
+  cl_command_queue queue = getQueue(deviceID);
+  if (!queue) {
+    return false;
+  }
+
+  const size_t chunkSize = this->stagingChunkSize;
+  void *staging[2];
+  staging[0] = allocHost(chunkSize);
+  staging[1] = allocHost(chunkSize);
+  if (!staging[0] || !staging[1]) {
+    if (staging[0]) {
+      freeHost(staging[0]);
+    }
+    if (staging[1]) {
+      freeHost(staging[1]);
+    }
+    return false;
+  }
+
+  char *host = reinterpret_cast<char *>(ptr);
+  cl_event events[2] = {NULL, NULL};
+  size_t offsets[2] = {0, 0};
+  size_t sizes[2] = {0, 0};
+  cl_int err = CL_SUCCESS;
+
+  // Double buffering: while the device transfers one staging buffer, the
+  // host copies the next(or previous, for read) chunk to the other.
+  for (size_t offset = 0, k = 0; (offset < size) && (err == CL_SUCCESS);
+       offset += chunkSize, k++) {
+    int slot = int(k & 1);
+    size_t n = std::min(chunkSize, size - offset);
+
+    if (isWrite) {
+      if (events[slot]) {
+        err = clWaitForEvents(1, &events[slot]);
+        clReleaseEvent(events[slot]);
+        events[slot] = NULL;
+        if (err != CL_SUCCESS) {
+          break;
+        }
+      }
+      memcpy(staging[slot], host + offset, n);
+      err = clEnqueueWriteBuffer(queue, mem->memObjOCL, CL_FALSE, offset, n,
+                                 staging[slot], 0, NULL, &events[slot]);
+      if (err == CL_SUCCESS) {
+        err = clFlush(queue);
+      }
+    } else {
+      err = clEnqueueReadBuffer(queue, mem->memObjOCL, CL_FALSE, offset, n,
+                                staging[slot], 0, NULL, &events[slot]);
+      offsets[slot] = offset;
+      sizes[slot] = n;
+      if (err == CL_SUCCESS) {
+        err = clFlush(queue);
+      }
+
+      int prev = slot ^ 1;
+      if ((err == CL_SUCCESS) && events[prev]) {
+        err = clWaitForEvents(1, &events[prev]);
+        clReleaseEvent(events[prev]);
+        events[prev] = NULL;
+        if (err == CL_SUCCESS) {
+          memcpy(host + offsets[prev], staging[prev], sizes[prev]);
+        }
+      }
+    }
+  }
+
+  // Drain in-flight chunks.
+  for (size_t k = 0; k < 2; k++) {
+    int slot = int(((size + chunkSize - 1) / chunkSize + k) & 1);
+    if (!events[slot]) {
+      continue;
+    }
+    cl_int ret = clWaitForEvents(1, &events[slot]);
+    clReleaseEvent(events[slot]);
+    events[slot] = NULL;
+    if ((ret == CL_SUCCESS) && (err == CL_SUCCESS) && !isWrite) {
+      memcpy(host + offsets[slot], staging[slot], sizes[slot]);
+    }
+    if (err == CL_SUCCESS) {
+      err = ret;
+    }
+  }
+  CL_CHECK(err);
+
+  freeHost(staging[0]);
+  freeHost(staging[1]);
+
+  return (err == CL_SUCCESS ? true : false);
+
+#else
+
+  (void)deviceID;
+  (void)mem;
+  (void)size;
+  (void)ptr;
+  (void)isWrite;
+  return false;
+
+#endif
+}
+
+void *MUDADeviceOCL::map(int deviceID, MUDAMemory mem,
+                         MUDAMemoryAttrib access, size_t offset, size_t size) {
+#ifdef HAVE_OPENCL
+
+  assert(this->context != NULL);
+  assert(mem->memObjOCL);
+
+  if (offset > mem->size) {
+    return NULL;
+  }
+  if (size == 0) {
+    size = mem->size - offset;
+  } else if (size > mem->size - offset) {
+    return NULL;
+  }
+
+  cl_command_queue queue = getQueue(deviceID);
+  if (!queue) {
+    return NULL;
+  }
+
+  cl_map_flags flags = 0;
+  if (access == muda::ro) {
+    flags = CL_MAP_READ;
+  } else if (access == muda::wo) {
+    flags = CL_MAP_WRITE;
+  } else {
+    flags = CL_MAP_READ | CL_MAP_WRITE;
+  }
+
+  cl_int err;
+  void *ptr = clEnqueueMapBuffer(queue, mem->memObjOCL, CL_TRUE, flags, offset,
+                                 size, 0, NULL, NULL, &err);
+  CL_CHECK(err);
+  if (err != CL_SUCCESS) {
+    return NULL;
+  }
+
+  return ptr;
+
+#else
+
+  cout << "OpenCL device target is not supported in this build."
+       << "\n";
+  return NULL;
+
+#endif
+}
+
+bool MUDADeviceOCL::unmap(int deviceID, MUDAMemory mem, void *ptr) {
+#ifdef HAVE_OPENCL
+
+  assert(this->context != NULL);
+  assert(mem->memObjOCL);
+
+  cl_command_queue queue = getQueue(deviceID);
+  if (!queue) {
+    return false;
+  }
+
+  cl_event event;
+  cl_int err =
+      clEnqueueUnmapMemObject(queue, mem->memObjOCL, ptr, 0, NULL, &event);
+  CL_CHECK(err);
+  if (err != CL_SUCCESS) {
+    return false;
+  }
+
+  err = clWaitForEvents(1, &event);
+  CL_CHECK(err);
+  clReleaseEvent(event);
+
+  return (err == CL_SUCCESS ? true : false);
+
+#else
+
+  cout << "OpenCL device target is not supported in this build."
+       << "\n";
+  return false;
+
+#endif
+}
+
+bool MUDADeviceOCL::wait(MUDAEvent event) { return waitEvents(1, &event); }
+
+bool MUDADeviceOCL::waitEvents(int numEvents, const MUDAEvent *events) {
+#ifdef HAVE_OPENCL
+
+  std::vector<cl_event> waits;
+  toCLEvents(numEvents, events, &waits);
+  if (waits.empty()) {
+    return true;
+  }
+
+  cl_int err = clWaitForEvents(cl_uint(waits.size()), &waits.at(0));
+  CL_CHECK(err);
+
+  return (err == CL_SUCCESS ? true : false);
+
+#else
+
+  cout << "OpenCL device target is not supported in this build."
+       << "\n";
+  return false;
+
+#endif
+}
+
+bool MUDADeviceOCL::releaseEvent(MUDAEvent event) {
+#ifdef HAVE_OPENCL
+
+  if (!event) {
+    return true;
+  }
+
+  cl_int err = clReleaseEvent(event->eventCL);
+  CL_CHECK(err);
+  if (event->firstEventCL) {
+    clReleaseEvent(event->firstEventCL);
+  }
+
+  slab<_MUDAEvent>().destroy(event);
+
+  return (err == CL_SUCCESS ? true : false);
+
+#else
+
+  cout << "OpenCL device target is not supported in this build."
+       << "\n";
+  return false;
+
+#endif
+}
+
+bool MUDADeviceOCL::getEventTime(MUDAEvent event, double *msec) {
+#ifdef HAVE_OPENCL
+
+  // END - START is the execution time on the device, excluding the time
+  // spent in the queue. The resolution of the timestamps is nanoseconds.
+  // A launch split into several dispatches spans from the first one.
+  cl_ulong start = 0, end = 0;
+  cl_int err = clGetEventProfilingInfo(
+      event->firstEventCL ? event->firstEventCL : event->eventCL,
+      CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL);
+  if (err == CL_SUCCESS) {
+    err = clGetEventProfilingInfo(event->eventCL, CL_PROFILING_COMMAND_END,
+                                  sizeof(cl_ulong), &end, NULL);
+  }
+  if (err != CL_SUCCESS) {
+    cout << "[OCL] Profiling info is not available. Call "
+            "setKernelProfiling(true) before loading programs.\n";
+    return false;
+  }
+
+  (*msec) = double(end - start) * 1.0e-6;
+  return true;
+
+#else
+
+  cout << "OpenCL device target is not supported in this build."
+       << "\n";
+  return false;
+
+#endif
+}
+
+bool MUDADeviceOCL::flush(int deviceID) {
+#ifdef HAVE_OPENCL
+
+  std::vector<cl_command_queue> queues;
+  getQueues(deviceID, &queues);
+
+  cl_int err = CL_SUCCESS;
+  for (size_t i = 0; (i < queues.size()) && (err == CL_SUCCESS); i++) {
+    err = clFlush(queues[i]);
+    CL_CHECK(err);
+  }
+
+  return (err == CL_SUCCESS ? true : false);
+
+#else
+
+  cout << "OpenCL device target is not supported in this build."
+       << "\n";
+  return false;
+
+#endif
+}
+
+bool MUDADeviceOCL::finish(int deviceID) {
+#ifdef HAVE_OPENCL
 
-  clWaitForEvents(1, &event);
-  err = clReleaseEvent(event);
-  CL_CHECK(err);
+  std::vector<cl_command_queue> queues;
+  getQueues(deviceID, &queues);
 
-  if (this->debug) {
-    cout << "[OCL] write operation ended.\n";
+  cl_int err = CL_SUCCESS;
+  for (size_t i = 0; (i < queues.size()) && (err == CL_SUCCESS); i++) {
+    err = clFinish(queues[i]);
+    CL_CHECK(err);
   }
 
   return (err == CL_SUCCESS ? true : false);
@@ -812,6 +2287,8 @@ bool MUDADeviceOCL::bindMemoryObject(MUDAKernel kernel, int argNum,
                                      MUDAMemory mem) {
 #if HAVE_OPENCL
 
+  invalidateArgCache(kernel, argNum);
+
   cl_int err;
   err = clSetKernelArg(kernel->kernObjOCL, argNum, sizeof(cl_mem),
                        &mem->memObjOCL);
@@ -832,6 +2309,8 @@ bool MUDADeviceOCL::setArg(MUDAKernel kernel, int argNum, size_t size,
                            size_t align, void *arg) {
 #if HAVE_OPENCL
 
+  invalidateArgCache(kernel, argNum);
+
   cl_int err;
   err = clSetKernelArg(kernel->kernObjOCL, argNum, size, arg);
   CL_CHECK(err);
@@ -847,68 +2326,675 @@ bool MUDADeviceOCL::setArg(MUDAKernel kernel, int argNum, size_t size,
 #endif
 }
 
+bool MUDADeviceOCL::setLaunchArg(MUDAKernel kernel, int argNum,
+                                 MUDAMemory mem) {
+#if HAVE_OPENCL
+  return setArgCached(kernel, argNum, sizeof(cl_mem), &mem->memObjOCL, false);
+#else
+  (void)kernel;
+  (void)argNum;
+  (void)mem;
+  return false;
+#endif
+}
+
+bool MUDADeviceOCL::setLaunchArg(MUDAKernel kernel, int argNum,
+                                 const MUDALocalMemory &local) {
+  return setArgCached(kernel, argNum, local.size, NULL, true);
+}
+
+bool MUDADeviceOCL::setArgCached(MUDAKernel kernel, int argNum, size_t size,
+                                 const void *value, bool isLocal) {
+#if HAVE_OPENCL
+
+  // Key of the argument: kind, then the value or the size of local memory.
+  unsigned char key[1 + 64];
+  size_t keySize = 1 + (isLocal ? sizeof(size_t) : size);
+  bool cacheable = (keySize <= sizeof(key));
+  if (cacheable) {
+    key[0] = isLocal ? 1 : 0;
+    memcpy(key + 1, isLocal ? static_cast<const void *>(&size) : value,
+           keySize - 1);
+
+    if (size_t(argNum) >= kernel->argCache.size()) {
+      kernel->argCache.resize(argNum + 1);
+    }
+    std::vector<unsigned char> &cached = kernel->argCache[argNum];
+    if ((cached.size() == keySize) &&
+        (memcmp(&cached.at(0), key, keySize) == 0)) {
+      return true;
+    }
+  }
+
+  cl_int err = clSetKernelArg(kernel->kernObjOCL, argNum, size, value);
+  CL_CHECK(err);
+  if (err != CL_SUCCESS) {
+    invalidateArgCache(kernel, argNum);
+    return false;
+  }
+
+  if (cacheable) {
+    kernel->argCache[argNum].assign(key, key + keySize);
+  } else {
+    invalidateArgCache(kernel, argNum);
+  }
+
+  return true;
+
+#else
+
+  (void)kernel;
+  (void)argNum;
+  (void)size;
+  (void)value;
+  (void)isLocal;
+  return false;
+
+#endif
+}
+
+bool MUDADeviceOCL::lookupLocalSize(int deviceID, MUDAKernel kernel,
+                                    int dimension, const size_t global[3],
+                                    size_t local[3]) {
+#if HAVE_OPENCL
+  deviceID = resolveDeviceID(deviceID);
+
+  // Device key is cached, since execute() is called frequently.
+  std::string key;
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->deviceKeys.resize(this->devices.size());
+    if (this->deviceKeys[deviceID].empty()) {
+      this->deviceKeys[deviceID] = getDeviceKey(deviceID);
+    }
+    key = this->deviceKeys[deviceID];
+  }
+
+  return this->tuningDB->lookup(key, kernel->name, dimension, global, local);
+#else
+  (void)deviceID;
+  (void)kernel;
+  (void)dimension;
+  (void)global;
+  (void)local;
+  return false;
+#endif
+}
+
+#if HAVE_OPENCL
+cl_command_queue MUDADeviceOCL::getQueue(int deviceID) {
+  deviceID = resolveDeviceID(deviceID);
+  if (!setupCommandQueue(deviceID)) {
+    return NULL;
+  }
+
+  // Round robin, so that independent operations run concurrently.
+  std::lock_guard<std::mutex> lock(this->mutex);
+  QueueSet &set = this->queuePool[deviceID];
+  cl_command_queue queue = set.queues[set.next % set.queues.size()];
+  set.next++;
+  return queue;
+}
+
+bool MUDADeviceOCL::isOutOfOrderQueue(int deviceID) {
+  deviceID = resolveDeviceID(deviceID);
+
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return (deviceID < (int)this->queuePool.size()) &&
+         this->queuePool[deviceID].outOfOrder;
+}
+
+void MUDADeviceOCL::getQueues(int deviceID,
+                              std::vector<cl_command_queue> *queues) {
+  deviceID = resolveDeviceID(deviceID);
+
+  std::lock_guard<std::mutex> lock(this->mutex);
+  queues->clear();
+  if (deviceID < (int)this->queuePool.size()) {
+    (*queues) = this->queuePool[deviceID].queues;
+  }
+}
+#endif
+
+int MUDADeviceOCL::getNumCommandQueues(int deviceID) {
+#if HAVE_OPENCL
+  std::vector<cl_command_queue> queues;
+  getQueues(deviceID, &queues);
+  return int(queues.size());
+#else
+  (void)deviceID;
+  return 0;
+#endif
+}
+
 bool MUDADeviceOCL::execute(int deviceID, MUDAKernel kernel, int dimension,
                             size_t sizeX, size_t sizeY, size_t sizeZ,
                             size_t localSizeX, size_t localSizeY,
                             size_t localSizeZ) {
+  return execute(deviceID, kernel, dimension, sizeX, sizeY, sizeZ, localSizeX,
+                 localSizeY, localSizeZ, NULL);
+}
+
+bool MUDADeviceOCL::execute(int deviceID, MUDAKernel kernel, int dimension,
+                            size_t sizeX, size_t sizeY, size_t sizeZ,
+                            size_t localSizeX, size_t localSizeY,
+                            size_t localSizeZ, double *kernelMsec) {
+  MUDANDRange range(sizeX, sizeY, sizeZ);
+  range.dimension = dimension;
+  range.setLocal(localSizeX, localSizeY, localSizeZ);
+
+  return execute(deviceID, kernel, range, kernelMsec);
+}
+
+bool MUDADeviceOCL::execute(int deviceID, MUDAKernel kernel,
+                            const MUDANDRange &range, double *kernelMsec) {
+
+#if HAVE_OPENCL
+
+  // Blocking operation.
+  MUDAEvent event = executeAsync(deviceID, kernel, range);
+  if (!event) {
+    return false;
+  }
+
+  bool ret = wait(event);
+  if (ret && kernelMsec) {
+    ret = getEventTime(event, kernelMsec);
+  }
+
+  return releaseEvent(event) && ret;
+
+#else
+
+  cout << "OpenCL device target is not supported in this build."
+       << "\n";
+  return false;
+
+#endif
+}
+
+bool MUDADeviceOCL::getDeviceLimits(int deviceID, DeviceLimits *limits) {
+#if HAVE_OPENCL
+  if (this->devices.empty()) {
+    return false; // Not initialized.
+  }
+  deviceID = resolveDeviceID(deviceID);
+
+  std::lock_guard<std::mutex> lock(this->mutex);
+  if (this->deviceLimits.size() < this->devices.size()) {
+    this->deviceLimits.resize(this->devices.size());
+  }
+
+  // Cached, since every launch is validated.
+  DeviceLimits &cached = this->deviceLimits[deviceID];
+  if (!cached.valid) {
+    cl_device_id device = this->devices[deviceID];
+    MUDAWorkGroupLimits &workGroup = cached.workGroup;
+    cl_int err = clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_GROUP_SIZE,
+                                 sizeof(size_t), &workGroup.maxWorkGroupSize,
+                                 NULL);
+    if (err == CL_SUCCESS) {
+      err = clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_ITEM_SIZES,
+                            3 * sizeof(size_t), workGroup.maxWorkItemSizes,
+                            NULL);
+    }
+    cl_bool unified = CL_FALSE;
+    if (err == CL_SUCCESS) {
+      err = clGetDeviceInfo(device, CL_DEVICE_HOST_UNIFIED_MEMORY,
+                            sizeof(cl_bool), &unified, NULL);
+    }
+    CL_CHECK(err);
+    if (err != CL_SUCCESS) {
+      cached = DeviceLimits();
+      return false;
+    }
+    cached.hostUnifiedMemory = (unified == CL_TRUE);
+    cached.valid = true;
+  }
+
+  (*limits) = cached;
+  return true;
+#else
+  (void)deviceID;
+  (void)limits;
+  return false;
+#endif
+}
+
+bool MUDADeviceOCL::getKernelWorkGroupSize(int deviceID, MUDAKernel kernel,
+                                           size_t *size) {
+#if HAVE_OPENCL
+  if (this->devices.empty()) {
+    return false; // Not initialized.
+  }
+  deviceID = resolveDeviceID(deviceID);
+
+  std::lock_guard<std::mutex> lock(this->mutex);
+  if ((kernel->workGroupSize == 0) ||
+      (kernel->workGroupSizeDevice != deviceID)) {
+    size_t kernelMax = 0;
+    cl_int err = clGetKernelWorkGroupInfo(
+        kernel->kernObjOCL, this->devices[deviceID], CL_KERNEL_WORK_GROUP_SIZE,
+        sizeof(size_t), &kernelMax, NULL);
+    CL_CHECK(err);
+    if ((err != CL_SUCCESS) || (kernelMax == 0)) {
+      return false;
+    }
+    kernel->workGroupSize = kernelMax;
+    kernel->workGroupSizeDevice = deviceID;
+  }
+
+  (*size) = kernel->workGroupSize;
+  return true;
+#else
+  (void)deviceID;
+  (void)kernel;
+  (void)size;
+  return false;
+#endif
+}
+
+bool MUDADeviceOCL::planLaunch(MUDAKernel kernel, const MUDANDRange &range,
+                               MUDALaunchPlan *plan, std::string *err,
+                               int deviceID) {
+  if ((range.dimension < 1) || (range.dimension > 3)) {
+    (*err) = "Dimension must be 1, 2 or 3.";
+    return false;
+  }
 
+  const int dimension = range.dimension;
+  size_t global[3], local[3], offset[3];
+  for (int i = 0; i < 3; i++) {
+    bool used = (i < dimension);
+    global[i] = used ? range.global[i] : 1;
+    offset[i] = used ? range.offset[i] : 0;
+    local[i] = (used && (range.local[i] > 0)) ? range.local[i] : 1;
+    if (global[i] == 0) {
+      (*err) = "Global size is 0.";
+      return false;
+    }
+  }
+
+  plan->dimension = dimension;
+  plan->dispatches.clear();
+
+  bool driverLocal = (range.local[0] == 0);
+  if (driverLocal && this->tuningDB &&
+      lookupLocalSize(deviceID, kernel, dimension, global, local) &&
+      (local[0] != 0)) {
+    // Tuned local size divides the global size.
+    driverLocal = false;
+  }
+
+  if (driverLocal) {
+    MUDALaunchPlan::Dispatch dispatch;
+    for (int i = 0; i < 3; i++) {
+      dispatch.offset[i] = offset[i];
+      dispatch.global[i] = global[i];
+      dispatch.local[i] = 0;
+    }
+    plan->dispatches.push_back(dispatch);
+    return true;
+  }
+
+  DeviceLimits cached;
+  if (!getDeviceLimits(deviceID, &cached)) {
+    (*err) = "Failed to query work-group limits of the device.";
+    return false;
+  }
+  const MUDAWorkGroupLimits &limits = cached.workGroup;
+
+  size_t total = 1;
+  for (int i = 0; i < dimension; i++) {
+    if (local[i] > limits.maxWorkItemSizes[i]) {
+      std::stringstream ss;
+      ss << "Local size " << local[i] << " of dimension " << i
+         << " exceeds CL_DEVICE_MAX_WORK_ITEM_SIZES("
+         << limits.maxWorkItemSizes[i] << ").";
+      (*err) = ss.str();
+      return false;
+    }
+    total *= local[i];
+  }
+  if (total > limits.maxWorkGroupSize) {
+    std::stringstream ss;
+    ss << "Work-group size " << total
+       << " exceeds CL_DEVICE_MAX_WORK_GROUP_SIZE("
+       << limits.maxWorkGroupSize << ").";
+    (*err) = ss.str();
+    return false;
+  }
+
+  // Register and __local memory usage of the kernel may lower the limit.
+  size_t kernelMax = 0;
+  if (!getKernelWorkGroupSize(deviceID, kernel, &kernelMax)) {
+    (*err) = "Failed to query CL_KERNEL_WORK_GROUP_SIZE.";
+    return false;
+  }
+  if (total > kernelMax) {
+    std::stringstream ss;
+    ss << "Work-group size " << total
+       << " exceeds CL_KERNEL_WORK_GROUP_SIZE(" << kernelMax << ") of "
+       << kernel->name << ".";
+    (*err) = ss.str();
+    return false;
+  }
+
+  // Each dimension is split into the part divisible by the local size and
+  // the remainder. Dispatches are the combinations of the parts.
+  size_t partOffset[3][2], partGlobal[3][2], partLocal[3][2];
+  int numParts[3];
+  for (int i = 0; i < 3; i++) {
+    size_t body = (global[i] / local[i]) * local[i];
+    size_t tail = global[i] - body;
+    numParts[i] = 0;
+    if (body > 0) {
+      partOffset[i][numParts[i]] = offset[i];
+      partGlobal[i][numParts[i]] = body;
+      partLocal[i][numParts[i]] = local[i];
+      numParts[i]++;
+    }
+    if (tail > 0) {
+      partOffset[i][numParts[i]] = offset[i] + body;
+      partGlobal[i][numParts[i]] = tail;
+      partLocal[i][numParts[i]] = tail;
+      numParts[i]++;
+    }
+  }
+
+  for (int z = 0; z < numParts[2]; z++) {
+    for (int y = 0; y < numParts[1]; y++) {
+      for (int x = 0; x < numParts[0]; x++) {
+        int part[3] = {x, y, z};
+        MUDALaunchPlan::Dispatch dispatch;
+        for (int i = 0; i < 3; i++) {
+          dispatch.offset[i] = partOffset[i][part[i]];
+          dispatch.global[i] = partGlobal[i][part[i]];
+          dispatch.local[i] = partLocal[i][part[i]];
+        }
+        plan->dispatches.push_back(dispatch);
+      }
+    }
+  }
+
+  return true;
+}
+
+#if HAVE_OPENCL
+cl_int MUDADeviceOCL::enqueueKernel(int deviceID, cl_command_queue queue,
+                                    MUDAKernel kernel,
+                                    const MUDANDRange &range,
+                                    cl_uint numWaitEvents,
+                                    const cl_event *waitList, cl_event *event,
+                                    cl_event *firstEvent) {
+  MUDALaunchPlan plan;
+  std::string err;
+  if (!planLaunch(kernel, range, &plan, &err, deviceID)) {
+    cout << "[OCL] " << err << "\n";
+    return CL_INVALID_WORK_GROUP_SIZE;
+  }
+
+  bool outOfOrder = (plan.dispatches.size() > 1) && isOutOfOrderQueue(deviceID);
+  return enqueuePlan(queue, outOfOrder, kernel, plan, numWaitEvents, waitList,
+                     event, firstEvent);
+}
+
+cl_int MUDADeviceOCL::enqueuePlan(cl_command_queue queue, bool outOfOrder,
+                                  MUDAKernel kernel,
+                                  const MUDALaunchPlan &plan,
+                                  cl_uint numWaitEvents,
+                                  const cl_event *waitList, cl_event *event,
+                                  cl_event *firstEvent) {
+  if (firstEvent) {
+    (*firstEvent) = NULL;
+  }
+
+  // Dispatches of out-of-order queue may complete in any order, so the last
+  // one waits for the others and its event completes the launch.
+  const size_t n = plan.dispatches.size();
+  outOfOrder = outOfOrder && (n > 1);
+
+  std::vector<cl_event> lastWaits(waitList, waitList + numWaitEvents);
+  std::vector<cl_event> dispatchEvents;
+  cl_int ret = CL_SUCCESS;
+  for (size_t i = 0; (i < n) && (ret == CL_SUCCESS); i++) {
+    const MUDALaunchPlan::Dispatch &dispatch = plan.dispatches[i];
+    bool last = (i + 1 == n);
+
+    cl_uint numWaits = numWaitEvents;
+    const cl_event *waits = waitList;
+    if (last && outOfOrder) {
+      lastWaits.insert(lastWaits.end(), dispatchEvents.begin(),
+                       dispatchEvents.end());
+      numWaits = cl_uint(lastWaits.size());
+      waits = lastWaits.empty() ? NULL : &lastWaits.at(0);
+    }
+
+    cl_event dispatchEvent = NULL;
+    bool needEvent = outOfOrder || ((i == 0) && firstEvent);
+
+    ret = clEnqueueNDRangeKernel(
+        queue, kernel->kernObjOCL, plan.dimension, dispatch.offset,
+        dispatch.global, (dispatch.local[0] == 0) ? NULL : dispatch.local,
+        numWaits, waits, last ? event : (needEvent ? &dispatchEvent : NULL));
+
+    if ((ret == CL_SUCCESS) && !last && needEvent) {
+      dispatchEvents.push_back(dispatchEvent);
+    }
+
+    if ((ret != CL_SUCCESS) && (i > 0)) {
+      // Earlier dispatches are already enqueued. Don't return while they may
+      // still run, since the caller sees the whole launch as failed.
+      cout << "[OCL] Launch failed after " << i << " of " << n
+           << " dispatches were enqueued (" << ret
+           << "). Waiting for them.\n";
+      clFinish(queue);
+    }
+  }
+
+  for (size_t i = 0; i < dispatchEvents.size(); i++) {
+    if ((i == 0) && firstEvent && (ret == CL_SUCCESS)) {
+      // Profiling spans from the first dispatch to the last.
+      (*firstEvent) = dispatchEvents[i];
+    } else {
+      clReleaseEvent(dispatchEvents[i]);
+    }
+  }
+
+  return ret;
+}
+#endif
+
+bool MUDADeviceOCL::submit(const MUDACommandGraph &graph) {
+#if HAVE_OPENCL
+
+  if (graph.size() == 0) {
+    return true;
+  }
+
+  MUDAEvent event = submitAsync(graph);
+  if (!event) {
+    return false;
+  }
+
+  bool ret = wait(event);
+  return releaseEvent(event) && ret;
+
+#else
+
+  (void)graph;
+  cout << "OpenCL device target is not supported in this build."
+       << "\n";
+  return false;
+
+#endif
+}
+
+MUDAEvent MUDADeviceOCL::submitAsync(const MUDACommandGraph &graph) {
 #if HAVE_OPENCL
 
   assert(this->context != NULL);
 
-  size_t sizes[3];
+  if (graph.size() == 0) {
+    return NULL;
+  }
 
-  sizes[0] = sizeX;
-  sizes[1] = sizeY;
-  sizes[2] = sizeZ;
+  // One queue keeps the recorded order. Out-of-order queue needs each node
+  // to wait for the previous one.
+  cl_command_queue queue = getQueue(-1);
+  if (!queue) {
+    return NULL;
+  }
+  bool chain = isOutOfOrderQueue(-1);
 
-  // @fixme {}
-  assert((sizeX % 8) == 0);
-  // assert((sizeY % 8) == 0);
+  // The first node waits for the previous submit, which may be on another
+  // queue of the pool.
+  cl_event prev = graph.lastSubmit;
+  if (prev) {
+    clRetainEvent(prev);
+  }
 
-  size_t local_sizes[3];
-  local_sizes[0] = localSizeX;
-  local_sizes[1] = localSizeY;
-  local_sizes[2] = 1;
-  // printf("dim = %d, sz = %d, %d, %d\n", dimension, sizes[0], sizes[1],
-  // sizes[2]);
-  // printf("dim = %d, local sz = %d, %d, %d\n", dimension, local_sizes[0],
-  // local_sizes[1], local_sizes[2]);
+  cl_int err = CL_SUCCESS;
+  for (size_t i = 0; (i < graph.size()) && (err == CL_SUCCESS); i++) {
+    const MUDACommandGraph::Node &node = graph.node(i);
+    bool last = (i + 1 == graph.size());
+
+    cl_event event = NULL;
+    cl_event *eventPtr = (chain || last) ? &event : NULL;
+    cl_uint numWaits = ((chain || (i == 0)) && prev) ? 1 : 0;
+    const cl_event *waits = numWaits ? &prev : NULL;
+
+    if (node.type == MUDACommandGraph::Node::WRITE) {
+      err = clEnqueueWriteBuffer(queue, node.mem->memObjOCL, CL_FALSE, 0,
+                                 node.size, node.hostPtr, numWaits, waits,
+                                 eventPtr);
+    } else if (node.type == MUDACommandGraph::Node::READ) {
+      err = clEnqueueReadBuffer(queue, node.mem->memObjOCL, CL_FALSE, 0,
+                                node.size, node.hostPtr, numWaits, waits,
+                                eventPtr);
+    } else {
+      for (size_t a = 0; a < node.args.size(); a++) {
+        const MUDACommandGraph::Arg &arg = node.args[a];
+        bool ok;
+        if (arg.kind == MUDACommandGraph::Arg::MEMORY) {
+          ok = setArgCached(node.kernel, int(a), sizeof(cl_mem),
+                            &arg.mem->memObjOCL, false);
+        } else if (arg.kind == MUDACommandGraph::Arg::LOCAL) {
+          ok = setArgCached(node.kernel, int(a), arg.size, NULL, true);
+        } else {
+          ok = setArgCached(node.kernel, int(a), arg.value.size(),
+                            &arg.value.at(0), false);
+        }
+        if (!ok) {
+          err = CL_INVALID_KERNEL_ARGS;
+          break;
+        }
+      }
 
-  // Blocking operation.
+      if ((err == CL_SUCCESS) && !node.planned) {
+        // Planned once, so a replay does not look up the device limits and
+        // the tuning database again.
+        std::string msg;
+        if (planLaunch(node.kernel, node.range, &node.plan, &msg, -1)) {
+          node.planned = true;
+        } else {
+          cout << "[OCL] " << msg << "\n";
+          err = CL_INVALID_WORK_GROUP_SIZE;
+        }
+      }
 
-  cl_int err;
-  cl_event event;
+      if (err == CL_SUCCESS) {
+        err = enqueuePlan(queue, chain, node.kernel, node.plan, numWaits,
+                          waits, eventPtr, NULL);
+      }
+    }
+    CL_CHECK(err);
 
-  err = clEnqueueNDRangeKernel(this->commandQueues[deviceID],
-                               kernel->kernObjOCL, dimension, NULL, sizes,
-                               local_sizes, 0, NULL, &event);
-  CL_CHECK(err);
+    if (prev) {
+      clReleaseEvent(prev);
+    }
+    prev = (err == CL_SUCCESS) ? event : NULL;
+  }
 
-  err = clWaitForEvents(1, &event);
-  CL_CHECK(err);
+  if (err != CL_SUCCESS) {
+    if (prev) {
+      clReleaseEvent(prev);
+    }
+    // Don't return while enqueued nodes may still use host memory.
+    clFinish(queue);
+    return NULL;
+  }
+
+  if (graph.lastSubmit) {
+    clReleaseEvent(graph.lastSubmit);
+  }
+  clRetainEvent(prev);
+  graph.lastSubmit = prev;
+
+  MUDAEvent ev = slab<_MUDAEvent>().create();
+  ev->eventCL = prev;
+  return ev;
+
+#else
+
+  (void)graph;
+  cout << "OpenCL device target is not supported in this build."
+       << "\n";
+  return NULL;
+
+#endif
+}
+
+MUDAEvent MUDADeviceOCL::executeAsync(int deviceID, MUDAKernel kernel,
+                                      int dimension, size_t sizeX,
+                                      size_t sizeY, size_t sizeZ,
+                                      size_t localSizeX, size_t localSizeY,
+                                      size_t localSizeZ, int numWaitEvents,
+                                      const MUDAEvent *waitList) {
+  MUDANDRange range(sizeX, sizeY, sizeZ);
+  range.dimension = dimension;
+  range.setLocal(localSizeX, localSizeY, localSizeZ);
+
+  return executeAsync(deviceID, kernel, range, numWaitEvents, waitList);
+}
+
+MUDAEvent MUDADeviceOCL::executeAsync(int deviceID, MUDAKernel kernel,
+                                      const MUDANDRange &range,
+                                      int numWaitEvents,
+                                      const MUDAEvent *waitList) {
+
+#if HAVE_OPENCL
+
+  assert(this->context != NULL);
+
+  cl_command_queue queue = getQueue(deviceID);
+  if (!queue) {
+    return NULL;
+  }
 
-  //cl_ulong start, end;
-  // clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START,
-  // sizeof(cl_ulong), &start, NULL);
-  // clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong),
-  // &end, NULL);
-  // END-START gives you hints on kind of “pure HW execution time”
-  // the resolution of the events is 1e-09 sec
-  // cl_double timeMs = (cl_double)(end - start)*(cl_double)(1e-06);
+  std::vector<cl_event> waits;
+  toCLEvents(numWaitEvents, waitList, &waits);
 
-  err = clReleaseEvent(event);
+  cl_event event, firstEvent;
+  cl_int err = enqueueKernel(deviceID, queue, kernel, range,
+                             cl_uint(waits.size()),
+                             waits.empty() ? NULL : &waits.at(0), &event,
+                             &firstEvent);
   CL_CHECK(err);
-  // if (err == CL_SUCCESS) {
-  //  cout << "[OCL] Kernel exec: " << timeMs << " msec(s)\n";
-  //}
-  return (err == CL_SUCCESS ? true : false);
+  if (err != CL_SUCCESS) {
+    return NULL;
+  }
+
+  MUDAEvent ev = slab<_MUDAEvent>().create();
+  ev->eventCL = event;
+  ev->firstEventCL = firstEvent;
+  return ev;
 
 #else
 
   cout << "OpenCL device target is not supported in this build."
        << "\n";
-  return false;
+  return NULL;
 
 #endif
 }
@@ -4,12 +4,22 @@
 #ifndef MUDA_IMPL_H
 #define MUDA_IMPL_H
 
+#include <mutex>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
 #ifdef HAVE_OPENCL
 #include "clew.h"
 #endif // HAVE_OPENCL
 
 namespace muda {
 
+struct MUDAPoolBlock;
+struct _MUDAKernel;
+
 // MUDA memory object.
 struct _MUDAMemory {
 
@@ -19,6 +29,7 @@ struct _MUDAMemory {
 #if HAVE_OPENCL
 
   cl_mem memObjOCL;
+  MUDAPoolBlock *poolBlock; // Block of MUDAMemoryPool, or NULL.
 
 #endif
 
@@ -37,12 +48,28 @@ struct _MUDAModule {
   int dummy;
 };
 
+// Instances of one kernel of MUDADeviceOCL::getKernel().
+struct MUDAKernelInstances {
+  std::vector<_MUDAKernel *> all;
+  std::vector<_MUDAKernel *> idle; // Not checked out.
+};
+
 // MUDA program object.
 struct _MUDAProgram {
 
 #if HAVE_OPENCL
 
   cl_program progObjOCL;
+  int deviceID; // Index of the device the program was built for.
+
+  // Kernels of MUDADeviceOCL::getKernel(), keyed by function name. An
+  // instance is checked out by getKernel() and returned by putKernel(), so
+  // instances are bounded by concurrent users, not by threads ever seen.
+  // Filled by clCreateKernelsInProgram() on first use. Guarded by
+  // `kernelMutex`.
+  std::unordered_map<std::string, MUDAKernelInstances> kernelTable;
+  bool kernelTableBuilt;
+  std::mutex kernelMutex;
 
 #endif
 
@@ -58,20 +85,75 @@ struct _MUDAKernel {
 
 #endif
 
+  std::string name; // Function name. Key of the tuning database.
+
+  // Last value of each argument set by MUDADeviceOCL::launch(), prefixed by
+  // 1 for __local memory(size) or 0 for a value. Empty = unknown.
+  std::vector<std::vector<unsigned char> > argCache;
+
+  // CL_KERNEL_WORK_GROUP_SIZE on `workGroupSizeDevice`, cached by
+  // MUDADeviceOCL::planLaunch(). 0 = not queried yet.
+  size_t workGroupSize;
+  int workGroupSizeDevice;
+
   int dummy;
 };
 
 // MUDA event object.
-struct MUDAEvent {
+struct _MUDAEvent {
 
 #if HAVE_OPENCL
 
   cl_event eventCL;
+  // First dispatch when the launch was split into several dispatches(see
+  // MUDADeviceOCL::planLaunch()), or NULL. START of the launch.
+  cl_event firstEventCL;
 
 #endif
 
   int dummy;
 };
+
+// Allocator of MUDA objects. Objects are carved from chunks of `ChunkSize`
+// and recycled through a free list, so that handles created per call(e.g.
+// events of *Async()) do not hit the heap. Chunks are never returned to the
+// heap. This class is thread-safe.
+template <typename T, size_t ChunkSize = 64> class MUDASlab {
+public:
+  // Returns value-initialized(zero-filled) object.
+  T *create() {
+    void *p;
+    {
+      std::lock_guard<std::mutex> lock(this->mutex);
+      if (this->freeList.empty()) {
+        grow();
+      }
+      p = this->freeList.back();
+      this->freeList.pop_back();
+    }
+    return new (p) T();
+  }
+
+  void destroy(T *obj) {
+    if (!obj) {
+      return;
+    }
+    obj->~T();
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->freeList.push_back(obj);
+  }
+
+private:
+  void grow() {
+    char *chunk = static_cast<char *>(::operator new(sizeof(T) * ChunkSize));
+    for (size_t i = ChunkSize; i-- > 0;) {
+      this->freeList.push_back(chunk + i * sizeof(T));
+    }
+  }
+
+  std::vector<void *> freeList;
+  std::mutex mutex;
+};
 }
 
 #endif // MUDA_IMPL_H
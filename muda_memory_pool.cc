@@ -0,0 +1,301 @@
+//
+// Copyright 2009 - 2017 Light Transport Entertainment Inc.
+//
+#include "muda_memory_pool.h"
+
+#ifdef HAVE_OPENCL
+
+#include <cstdio>
+
+namespace muda {
+
+// Slab of one size class.
+struct MUDAPoolSlab {
+  cl_mem memObj;
+  size_t blockSize;  // Size class.
+  size_t carved;     // Bytes carved into blocks so far.
+  size_t liveBlocks;
+};
+
+struct MUDAPoolBlock {
+  cl_mem memObj; // Sub-buffer of the slab.
+  MUDAPoolSlab *slab;
+  size_t requested;
+
+  // Fences of free(). The block is reused once all of them completed.
+  std::vector<cl_event> fences;
+};
+
+namespace {
+
+// Returns the size class index of `size`, and rounds `size` up to the class.
+size_t sizeClass(size_t minBlockSize, size_t *size) {
+  size_t index = 0;
+  size_t blockSize = minBlockSize;
+  while (blockSize < (*size)) {
+    blockSize *= 2;
+    index++;
+  }
+  (*size) = blockSize;
+  return index;
+}
+
+void releaseFences(MUDAPoolBlock *block) {
+  for (size_t i = 0; i < block->fences.size(); i++) {
+    clReleaseEvent(block->fences[i]);
+  }
+  block->fences.clear();
+}
+
+} // namespace
+
+MUDAMemoryPool::MUDAMemoryPool(cl_context context, size_t slabSize,
+                               size_t alignment)
+    : context(context), slabSize(slabSize), minBlockSize(256) {
+  // Blocks are carved at multiples of their size, so blocks of at least the
+  // alignment are always aligned.
+  while (this->minBlockSize < alignment) {
+    this->minBlockSize *= 2;
+  }
+
+  size_t numClasses = 0;
+  for (size_t s = this->minBlockSize; s <= maxBlockSize(); s *= 2) {
+    numClasses++;
+  }
+  this->freeLists.resize(numClasses);
+  this->fencedLists.resize(numClasses);
+}
+
+MUDAMemoryPool::~MUDAMemoryPool() {
+  // Release of the sub-buffers is deferred by the driver until fenced
+  // commands have completed.
+  for (size_t i = 0; i < this->fencedLists.size(); i++) {
+    for (size_t k = 0; k < this->fencedLists[i].size(); k++) {
+      releaseFences(this->fencedLists[i][k]);
+      clReleaseMemObject(this->fencedLists[i][k]->memObj);
+      delete this->fencedLists[i][k];
+    }
+  }
+
+  for (size_t i = 0; i < this->freeLists.size(); i++) {
+    for (size_t k = 0; k < this->freeLists[i].size(); k++) {
+      clReleaseMemObject(this->freeLists[i][k]->memObj);
+      delete this->freeLists[i][k];
+    }
+  }
+
+  for (size_t i = 0; i < this->slabs.size(); i++) {
+    clReleaseMemObject(this->slabs[i]->memObj);
+    delete this->slabs[i];
+  }
+}
+
+MUDAPoolBlock *MUDAMemoryPool::alloc(size_t size, cl_mem *memObj) {
+  if ((size == 0) || (size > maxBlockSize())) {
+    return NULL;
+  }
+
+  size_t blockSize = size;
+  size_t index = sizeClass(this->minBlockSize, &blockSize);
+  if (index >= this->freeLists.size()) {
+    return NULL;
+  }
+
+  std::lock_guard<std::mutex> lock(this->mutex);
+
+  reclaim(index);
+
+  MUDAPoolBlock *block = NULL;
+  if (!this->freeLists[index].empty()) {
+    block = this->freeLists[index].back();
+    this->freeLists[index].pop_back();
+    this->stats.freeBytes -= blockSize;
+    this->stats.numReused++;
+  } else {
+    // Carve from the newest slab of the class, or a new slab.
+    MUDAPoolSlab *slab = NULL;
+    for (size_t i = this->slabs.size(); i-- > 0;) {
+      if ((this->slabs[i]->blockSize == blockSize) &&
+          (this->slabs[i]->carved + blockSize <= this->slabSize)) {
+        slab = this->slabs[i];
+        break;
+      }
+    }
+
+    cl_int err;
+    if (!slab) {
+      cl_mem slabObj = clCreateBuffer(this->context, CL_MEM_READ_WRITE,
+                                      this->slabSize, NULL, &err);
+      if (err != CL_SUCCESS) {
+        fprintf(stderr, "[OCL] Failed to allocate memory pool slab (%d)\n",
+                err);
+        return NULL;
+      }
+
+      slab = new MUDAPoolSlab;
+      slab->memObj = slabObj;
+      slab->blockSize = blockSize;
+      slab->carved = 0;
+      slab->liveBlocks = 0;
+      this->slabs.push_back(slab);
+      this->stats.reservedBytes += this->slabSize;
+      this->stats.numSlabs++;
+    }
+
+    cl_buffer_region region;
+    region.origin = slab->carved;
+    region.size = blockSize;
+    cl_mem subObj = clCreateSubBuffer(slab->memObj, 0,
+                                      CL_BUFFER_CREATE_TYPE_REGION, &region,
+                                      &err);
+    if (err != CL_SUCCESS) {
+      fprintf(stderr, "[OCL] Failed to create sub-buffer (%d)\n", err);
+      return NULL;
+    }
+    slab->carved += blockSize;
+
+    block = new MUDAPoolBlock;
+    block->memObj = subObj;
+    block->slab = slab;
+  }
+
+  block->requested = size;
+  block->slab->liveBlocks++;
+
+  this->stats.blockBytes += blockSize;
+  this->stats.requestedBytes += size;
+  this->stats.numBlocks++;
+  this->stats.numAllocs++;
+
+  (*memObj) = block->memObj;
+  return block;
+}
+
+void MUDAMemoryPool::free(MUDAPoolBlock *block,
+                          const std::vector<cl_command_queue> &queues) {
+  size_t blockSize = block->slab->blockSize;
+  size_t index = sizeClass(this->minBlockSize, &blockSize);
+
+  // Fence the block on every queue which may still use it. A marker
+  // completes after all commands enqueued before it, also on out-of-order
+  // queues.
+  for (size_t i = 0; i < queues.size(); i++) {
+    cl_event fence;
+    if (clEnqueueMarker(queues[i], &fence) == CL_SUCCESS) {
+      block->fences.push_back(fence);
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(this->mutex);
+
+  block->slab->liveBlocks--;
+  if (block->fences.empty()) {
+    this->freeLists[index].push_back(block);
+  } else {
+    this->fencedLists[index].push_back(block);
+  }
+
+  this->stats.blockBytes -= blockSize;
+  this->stats.requestedBytes -= block->requested;
+  this->stats.freeBytes += blockSize;
+  this->stats.numBlocks--;
+}
+
+void MUDAMemoryPool::reclaim(size_t index) {
+  std::vector<MUDAPoolBlock *> &fenced = this->fencedLists[index];
+  size_t n = 0;
+  for (size_t k = 0; k < fenced.size(); k++) {
+    MUDAPoolBlock *block = fenced[k];
+
+    bool completed = true;
+    for (size_t i = 0; i < block->fences.size(); i++) {
+      cl_int status = CL_COMPLETE;
+      clGetEventInfo(block->fences[i], CL_EVENT_COMMAND_EXECUTION_STATUS,
+                     sizeof(status), &status, NULL);
+      // Negative status is an error, which also ends the command.
+      if (status > CL_COMPLETE) {
+        completed = false;
+        break;
+      }
+    }
+
+    if (completed) {
+      releaseFences(block);
+      this->freeLists[index].push_back(block);
+    } else {
+      fenced[n++] = block;
+    }
+  }
+  fenced.resize(n);
+}
+
+size_t MUDAMemoryPool::trim() {
+  std::lock_guard<std::mutex> lock(this->mutex);
+
+  for (size_t i = 0; i < this->fencedLists.size(); i++) {
+    reclaim(i);
+  }
+
+  size_t released = 0;
+  std::vector<MUDAPoolSlab *> alive;
+  for (size_t i = 0; i < this->slabs.size(); i++) {
+    MUDAPoolSlab *slab = this->slabs[i];
+    if (slab->liveBlocks > 0) {
+      alive.push_back(slab);
+      continue;
+    }
+
+    // Keep the slab while its freed blocks are still fenced.
+    size_t blockSize = slab->blockSize;
+    size_t index = sizeClass(this->minBlockSize, &blockSize);
+    bool fenced = false;
+    for (size_t k = 0; k < this->fencedLists[index].size(); k++) {
+      if (this->fencedLists[index][k]->slab == slab) {
+        fenced = true;
+        break;
+      }
+    }
+    if (fenced) {
+      alive.push_back(slab);
+      continue;
+    }
+
+    // Sub-buffers must be released before the slab.
+    std::vector<MUDAPoolBlock *> &list = this->freeLists[index];
+    size_t n = 0;
+    for (size_t k = 0; k < list.size(); k++) {
+      if (list[k]->slab == slab) {
+        clReleaseMemObject(list[k]->memObj);
+        delete list[k];
+        this->stats.freeBytes -= blockSize;
+      } else {
+        list[n++] = list[k];
+      }
+    }
+    list.resize(n);
+
+    clReleaseMemObject(slab->memObj);
+    delete slab;
+
+    released += this->slabSize;
+    this->stats.reservedBytes -= this->slabSize;
+    this->stats.numSlabs--;
+  }
+  this->slabs.swap(alive);
+
+  return released;
+}
+
+MUDAMemoryPoolStats MUDAMemoryPool::getStats() {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->stats;
+}
+
+size_t MUDAMemoryPool::numLiveBlocks() {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->stats.numBlocks;
+}
+
+} // namespace muda
+
+#endif // HAVE_OPENCL
@@ -0,0 +1,113 @@
+//
+// Copyright 2009 - 2017 Light Transport Entertainment Inc.
+//
+#ifndef MUDA_MEMORY_POOL_H
+#define MUDA_MEMORY_POOL_H
+
+#include <cstdlib>
+#include <mutex>
+#include <vector>
+
+#ifdef HAVE_OPENCL
+#include "clew.h"
+#endif // HAVE_OPENCL
+
+namespace muda {
+
+// Usage and fragmentation of MUDAMemoryPool.
+struct MUDAMemoryPoolStats {
+  size_t reservedBytes;  // Slabs allocated from the device.
+  size_t blockBytes;     // Live blocks, rounded up to their size class.
+  size_t requestedBytes; // Bytes requested for live blocks.
+  size_t freeBytes;      // Freed blocks kept for reuse.
+  size_t numSlabs;
+  size_t numBlocks;      // Live blocks.
+  size_t numAllocs;      // Allocations served by the pool.
+  size_t numReused;      // Allocations served by a freed block.
+
+  MUDAMemoryPoolStats()
+      : reservedBytes(0), blockBytes(0), requestedBytes(0), freeBytes(0),
+        numSlabs(0), numBlocks(0), numAllocs(0), numReused(0) {}
+
+  // Space of live blocks lost to rounding up to size classes.
+  double internalFragmentation() const {
+    return (blockBytes > 0) ? 1.0 - double(requestedBytes) / double(blockBytes)
+                            : 0.0;
+  }
+
+  // Reserved space not used by live blocks(freed or not carved yet).
+  double externalFragmentation() const {
+    return (reservedBytes > 0)
+               ? 1.0 - double(blockBytes) / double(reservedBytes)
+               : 0.0;
+  }
+};
+
+#ifdef HAVE_OPENCL
+
+struct MUDAPoolSlab;
+struct MUDAPoolBlock;
+
+// Sub-allocates buffers from large slabs with clCreateSubBuffer().
+// Requests are rounded up to power of two size classes, and each slab serves
+// one size class. Slabs are carved on demand, and a freed block keeps its
+// sub-buffer, so the next request of the class reuses it without CL calls.
+// A freed block is reused only after commands enqueued before free() have
+// completed, like clReleaseMemObject() defers the deletion.
+// Pooled buffers inherit CL_MEM_READ_WRITE of the slab.
+// This class is thread-safe.
+class MUDAMemoryPool {
+public:
+  //  `alignment` is the sub-buffer offset alignment in bytes
+  //  (CL_DEVICE_MEM_BASE_ADDR_ALIGN is in bits).
+  MUDAMemoryPool(cl_context context, size_t slabSize, size_t alignment);
+
+  //  Releases freed blocks and slabs. Sub-buffers of live blocks keep their
+  //  slab alive until they are released.
+  ~MUDAMemoryPool();
+
+  //  Function: alloc
+  //  Returns a block of at least `size` bytes and stores its sub-buffer to
+  //  `memObj`. Returns NULL when `size` exceeds maxBlockSize() or the slab
+  //  could not be allocated.
+  MUDAPoolBlock *alloc(size_t size, cl_mem *memObj);
+
+  //  Function: free
+  //  Returns the block to the pool. The block is fenced with a marker on each
+  //  of `queues`, and is reused once every marker has completed.
+  void free(MUDAPoolBlock *block, const std::vector<cl_command_queue> &queues);
+
+  //  Function: trim
+  //  Releases slabs without live blocks. Returns released bytes.
+  size_t trim();
+
+  //  Function: getStats
+  MUDAMemoryPoolStats getStats();
+
+  //  Function: maxBlockSize
+  //  Largest request served by the pool(a quarter of the slab).
+  size_t maxBlockSize() const { return this->slabSize / 4; }
+
+  //  Function: numLiveBlocks
+  size_t numLiveBlocks();
+
+private:
+  // Moves fenced blocks of the class whose fences completed to the free
+  // list. Called with `mutex` locked.
+  void reclaim(size_t index);
+  cl_context context;
+  size_t slabSize;
+  size_t minBlockSize;
+
+  std::vector<MUDAPoolSlab *> slabs;
+  std::vector<std::vector<MUDAPoolBlock *> > freeLists; // Per size class.
+  std::vector<std::vector<MUDAPoolBlock *> > fencedLists; // Per size class.
+  MUDAMemoryPoolStats stats;
+  std::mutex mutex;
+};
+
+#endif // HAVE_OPENCL
+
+} // namespace muda
+
+#endif // MUDA_MEMORY_POOL_H
@@ -10,6 +10,14 @@
 // C++ headers
 #include <vector>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <string>
+#include <thread>
+#include <type_traits>
 
 #ifdef HAVE_OPENCL
 #include "clew.h"
@@ -47,7 +55,112 @@ struct _MUDAProgram;
 typedef struct _MUDAProgram *MUDAProgram; // MUDA kernel object.
 struct _MUDAKernel;
 typedef struct _MUDAKernel *MUDAKernel; // MUDA kernel object.
+struct _MUDAEvent;
+typedef struct _MUDAEvent *MUDAEvent; // MUDA event object.
 class MUDADeviceImpl;
+class MUDATuningDB;
+class MUDAMemoryPool;
+struct MUDAMemoryPoolStats;
+class MUDACommandGraph;
+
+// Result of asynchronous program build.
+struct MUDABuildResult {
+  MUDAProgram program; // NULL when the build failed.
+  std::string buildLog;
+
+  MUDABuildResult() : program(NULL) {}
+};
+
+typedef std::shared_future<MUDABuildResult> MUDABuildFuture;
+
+// Accumulated wall clock time of a profiled phase.
+struct MUDAProfileEntry {
+  std::string name;
+  double msec; // total
+  int count;   // # of calls
+
+  MUDAProfileEntry() : msec(0.0), count(0) {}
+};
+
+// Work-group size limits of a kernel on a device.
+struct MUDAWorkGroupLimits {
+  size_t maxWorkGroupSize; // min(CL_DEVICE_MAX_WORK_GROUP_SIZE,
+                           //     CL_KERNEL_WORK_GROUP_SIZE)
+  size_t maxWorkItemSizes[3]; // CL_DEVICE_MAX_WORK_ITEM_SIZES
+  size_t preferredMultiple;   // CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE
+
+  MUDAWorkGroupLimits() : maxWorkGroupSize(1), preferredMultiple(1) {
+    maxWorkItemSizes[0] = maxWorkItemSizes[1] = maxWorkItemSizes[2] = 1;
+  }
+};
+
+// Global size, local size and global offset of a kernel launch. The global
+// size need not be a multiple of the local size(see
+// MUDADeviceOCL::planLaunch()).
+struct MUDANDRange {
+  int dimension;
+  size_t global[3];
+  size_t local[3]; // local[0] == 0 lets the tuning database or the driver
+                   // choose.
+  size_t offset[3]; // Global offset.
+
+  MUDANDRange(size_t x) : dimension(1) { set(x, 1, 1); }
+  MUDANDRange(size_t x, size_t y) : dimension(2) { set(x, y, 1); }
+  MUDANDRange(size_t x, size_t y, size_t z) : dimension(3) { set(x, y, z); }
+
+  //  Function: setLocal
+  //  Sets the local size. Unused dimensions must be 1.
+  MUDANDRange &setLocal(size_t x, size_t y = 1, size_t z = 1) {
+    local[0] = x;
+    local[1] = y;
+    local[2] = z;
+    return *this;
+  }
+
+  //  Function: setOffset
+  //  Sets the global offset. get_global_id() starts from it.
+  MUDANDRange &setOffset(size_t x, size_t y = 0, size_t z = 0) {
+    offset[0] = x;
+    offset[1] = y;
+    offset[2] = z;
+    return *this;
+  }
+
+private:
+  void set(size_t x, size_t y, size_t z) {
+    global[0] = x;
+    global[1] = y;
+    global[2] = z;
+    local[0] = local[1] = local[2] = 0;
+    offset[0] = offset[1] = offset[2] = 0;
+  }
+};
+
+// Dispatches which execute a MUDANDRange, made by
+// MUDADeviceOCL::planLaunch().
+struct MUDALaunchPlan {
+  struct Dispatch {
+    size_t offset[3];
+    size_t global[3];
+    size_t local[3]; // All 0 = NULL(driver's choice).
+  };
+
+  int dimension;
+  std::vector<Dispatch> dispatches; // [0] is the main dispatch.
+
+  MUDALaunchPlan() : dimension(1) {}
+};
+
+// __local memory argument of MUDADeviceOCL::launch().
+struct MUDALocalMemory {
+  size_t size; // In bytes.
+
+  explicit MUDALocalMemory(size_t size) : size(size) {}
+};
+
+// Called when asynchronous build finished(from a background thread).
+typedef void (*MUDABuildCallback)(const MUDABuildResult &result,
+                                  void *userData);
 
 // Base class of MUDA device.
 class MUDADevice {
@@ -120,7 +233,7 @@ private:
 class MUDADeviceImpl {
 public:
   MUDADeviceImpl() {};
-  ~MUDADeviceImpl() {};
+  virtual ~MUDADeviceImpl() {};
 
   //  Function: initialize
   //  Initializes MUDA device(s).
@@ -143,10 +256,25 @@ public:
                                        const char **headers,
                                        const char *options) = 0;
 
+  //  Function: loadKernelSourceAsync
+  //  Starts loading and compiling MUDA kernel in background and returns
+  //  immediately. `callback`(can be NULL) is called when the build finished.
+  //  Arguments are copied, so they need not outlive this call.
+  virtual MUDABuildFuture loadKernelSourceAsync(const char *filename,
+                                                int nheaders,
+                                                const char **headers,
+                                                const char *options,
+                                                MUDABuildCallback callback,
+                                                void *userData) = 0;
+
   //  Function: loadKernelBinary
   //  Loads precompiled MUDA binary from the file.
   virtual MUDAProgram loadKernelBinary(const char *filename) = 0;
 
+  //  Function: releaseProgram
+  //  Releases program object created by loadKernelSource()/loadKernelBinary().
+  virtual bool releaseProgram(MUDAProgram program) = 0;
+
   //  Function: createKernel
   //  Creates kernel object from kernel module.
   //  You should call loadKernelSource() before calling createKernel().
@@ -162,6 +290,12 @@ public:
   virtual MUDAMemory alloc(MUDAMemoryType memType, MUDAMemoryAttrib memAttrib,
                            size_t memSize) = 0;
 
+  //  Function: alloc
+  //  Allocates MUDA device memory which uses `hostPtr` as its storage.
+  //  `hostPtr` must outlive the memory object.
+  virtual MUDAMemory alloc(MUDAMemoryType memType, MUDAMemoryAttrib memAttrib,
+                           size_t memSize, void *hostPtr) = 0;
+
   // virtual MUDAMemory allocImage(MUDAMemoryType memType, MUDAMemoryAttrib
   // memAttrib,
   //              size_t width, size_t height, int components) = 0;
@@ -198,6 +332,18 @@ public:
   virtual bool write(int deviceID, MUDAMemory mem, size_t size,
                      const void *ptr) = 0;
 
+  //  Function: map
+  //  Maps `size` bytes(0 = to the end) of MUDA buffer from `offset` into host
+  //  address space for `access`, and returns the host pointer. NULL on
+  //  failure or when the region exceeds the buffer.
+  virtual void *map(int deviceID, MUDAMemory mem, MUDAMemoryAttrib access,
+                    size_t offset, size_t size) = 0;
+
+  //  Function: unmap
+  //  Unmaps the pointer returned by map(). Writes through the pointer are
+  //  visible to kernels after this returns.
+  virtual bool unmap(int deviceID, MUDAMemory mem, void *ptr) = 0;
+
   //  Function: writeImage
   //  Writes image to MUDA buffer.
   //  This function does not return until actual memory copy is finished
@@ -219,8 +365,78 @@ public:
   bool initialize(int platformID = 0, int preferredDeviceID = 0,
                   bool verbosity = false);
 
+  //  Function: initializeAllDevices
+  //  Initializes OpenCL context containing all devices in the platform.
+  //  Use loadKernelSource(..., deviceID) to build for each device.
+  bool initializeAllDevices(int platformID = 0, bool verbosity = false);
+
+  //  Function: getNumPlatforms
+  //  Returns # of available OpenCL platforms. clewInit() must be called
+  //  before.
+  static int getNumPlatforms();
+
+  std::string getPlatformName();
+  std::string getPlatformVersion();
+
+  //  Function: getDeviceName
+  //  Returns CL_DEVICE_NAME of ith device(current device if -1).
+  std::string getDeviceName(int deviceID = -1);
+
+  //  Function: getDriverVersion
+  //  Returns CL_DRIVER_VERSION of ith device(current device if -1).
+  std::string getDriverVersion(int deviceID = -1);
+
+  //  Function: getDeviceKey
+  //  Returns device name and driver version of ith device(current device if
+  //  -1), which identifies the device in MUDATuningDB.
+  std::string getDeviceKey(int deviceID = -1);
+
   int getNumDevices();
 
+  //  Function: setMeasureProfile
+  //  Enables wall clock timing of OpenCL API calls(platform/device query,
+  //  context creation, program build, binary extraction, etc.).
+  //  Call before initialize() to measure the initialization.
+  void setMeasureProfile(bool enable) { measureProfile = enable; }
+
+  //  Function: addProfile
+  //  Adds `msec` to the phase `name`. Does nothing unless profiling is
+  //  enabled. The application can record its own phases with this.
+  //  This function is thread-safe.
+  void addProfile(const char *name, double msec);
+
+  //  Function: getProfile
+  //  Returns accumulated phases in the order of first appearance.
+  void getProfile(std::vector<MUDAProfileEntry> &entries);
+
+  //  Function: setKernelProfiling
+  //  Creates command queues with CL_QUEUE_PROFILING_ENABLE, so that execute()
+  //  can return device side execution time of the kernel.
+  //  Call before loading programs(the command queue is created then).
+  void setKernelProfiling(bool enable) { kernelProfiling = enable; }
+
+  //  Function: setTuningDB
+  //  execute() looks up the local size from `db` when the caller passes 0 to
+  //  `localSizeX`(NULL = let the driver choose). `db` must outlive this
+  //  device.
+  void setTuningDB(MUDATuningDB *db) { tuningDB = db; }
+
+  //  Function: setCommandQueues
+  //  Creates `numQueuesPerDevice` command queues for each device(default 1),
+  //  with CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE when `outOfOrder` is true
+  //  and the device supports it. Call before loading programs(queues are
+  //  created then, and reused by later programs).
+  //  execute(), read() and write() use the queues of the device in round
+  //  robin, so independent operations can overlap. With more than one queue
+  //  or out-of-order queues, operations are no longer ordered by submission:
+  //  express dependencies with the wait-list of *Async().
+  void setCommandQueues(int numQueuesPerDevice, bool outOfOrder);
+
+  //  Function: getNumCommandQueues
+  //  Returns # of command queues created for ith device(current device if
+  //  -1).
+  int getNumCommandQueues(int deviceID = -1);
+
   //  Function: estimateMFlops
   //  Returns the Mflops of ith device.
   int estimateMFlops(int deviceId);
@@ -231,18 +447,95 @@ public:
 
   //  Function: loadKernelSource
   //  Loads and compiles OpenCL kernel from source file.
+  //  Returns NULL when the file could not be read or the build failed.
   MUDAProgram loadKernelSource(const char *filename, int nheaders,
                                const char **headers, const char *options);
 
+  //  Function: loadKernelSource
+  //  Same as above, but stores the build log to `buildLog` instead of
+  //  printing it to stdout(if `buildLog` is not NULL).
+  //  This function is thread-safe. Multiple programs can be built
+  //  concurrently in the same context.
+  //  `deviceID` selects the device to build for(current device if -1).
+  MUDAProgram loadKernelSource(const char *filename, int nheaders,
+                               const char **headers, const char *options,
+                               std::string *buildLog, int deviceID = -1);
+
+  //  Function: loadKernelSourceAsync
+  //  Builds the program in background. Builds run synchronously on build
+  //  threads of this device(up to hardware_concurrency(), further builds are
+  //  queued). The future is completed, then `callback` is called on the
+  //  build thread. `callback` may call shutdown(), but must not destroy the
+  //  device.
+  //  Pending builds are waited in shutdown() and the destructor.
+  MUDABuildFuture loadKernelSourceAsync(const char *filename, int nheaders,
+                                        const char **headers,
+                                        const char *options,
+                                        MUDABuildCallback callback,
+                                        void *userData);
+
+  //  Function: loadKernelSourceString
+  //  Compiles OpenCL kernel from source string of `sourceLen` bytes.
+  MUDAProgram loadKernelSourceString(const char *source, size_t sourceLen,
+                                     int nheaders, const char **headers,
+                                     const char *options,
+                                     std::string *buildLog,
+                                     int deviceID = -1);
+
   //  Function: loadKernelBinary
-  //  Loads precompiled MUDA binary from the file.
+  //  Loads precompiled MUDA binary from `filename`.clbin. Returns NULL(and
+  //  prints the build log) when the file could not be read or built.
   MUDAProgram loadKernelBinary(const char *filename);
 
+  //  Function: loadKernelBinary
+  //  Creates program from binary in memory(e.g. obtained by getModule()).
+  //  Returns NULL when the driver rejected the binary.
+  MUDAProgram loadKernelBinary(const unsigned char *binary, size_t len,
+                               std::string *buildLog, int deviceID = -1);
+
+  //  Function: releaseProgram
+  //  Releases CL program object.
+  bool releaseProgram(MUDAProgram program);
+
+  //  Function: getBuildLog
+  //  Get build log of the program for the current device.
+  bool getBuildLog(MUDAProgram program, std::string &log);
+
   //  Function: createKernel
   //  Creates CL kernel object from CL program.
   //  You should call loadKernelSource() before calling createKernel().
+  //  Returns NULL when the program has no kernel `functionName`.
   MUDAKernel createKernel(const MUDAProgram program, const char *functionName);
 
+  //  Function: getKernel
+  //  Checks out an instance of the kernel `functionName` of the program.
+  //  All kernels of the program are created once with
+  //  clCreateKernelsInProgram() and looked up by name, so this is cheap
+  //  enough for hot loops. An instance is used by one caller until it is
+  //  returned with putKernel(), so that threads can set arguments and launch
+  //  concurrently. A returned instance is reused and keeps its arguments; a
+  //  new instance is created(with no arguments set) only when all instances
+  //  are checked out. The kernel is owned by the program and released with
+  //  it: don't pass it to releaseKernel(). Returns NULL when the program has
+  //  no such kernel.
+  MUDAKernel getKernel(MUDAProgram program, const char *functionName);
+
+  //  Function: putKernel
+  //  Returns the instance checked out by getKernel() of the program. Returns
+  //  false when it is not an instance of the program.
+  bool putKernel(MUDAProgram program, MUDAKernel kernel);
+
+  //  Function: releaseKernel
+  //  Releases CL kernel object created by createKernel(). The program is not
+  //  freed by releaseProgram() while its kernels are alive.
+  bool releaseKernel(MUDAKernel kernel);
+
+  //  Function: getWorkGroupLimits
+  //  Returns legal work-group sizes of the kernel on ith device(current device
+  //  if -1).
+  bool getWorkGroupLimits(MUDAKernel kernel, MUDAWorkGroupLimits *limits,
+                          int deviceID = -1);
+
   //  Function getModule
   //  Get compiled binary kernel module. 
   bool getModule(MUDAProgram program, std::vector<char>& binary);
@@ -252,6 +545,15 @@ public:
   MUDAMemory alloc(MUDAMemoryType memType, MUDAMemoryAttrib memAttrib,
                    size_t memSize);
 
+  //  Function: alloc
+  //  Allocates OpenCL buffer on `hostPtr`(CL_MEM_USE_HOST_PTR). CPU and
+  //  integrated GPU devices use the memory in place, so map() of the buffer
+  //  returns `hostPtr` without copy. Some drivers require 4096 byte
+  //  alignment and a size of multiple of 64 bytes for zero copy.
+  //  `hostPtr` must outlive the memory object.
+  MUDAMemory alloc(MUDAMemoryType memType, MUDAMemoryAttrib memAttrib,
+                   size_t memSize, void *hostPtr);
+
   //  Function: allocImage
   //  Allocates OpenCL image memory.
   // MUDAMemory allocImage(MUDAMemoryType memType, MUDAMemoryAttrib memAttrib,
@@ -261,6 +563,45 @@ public:
   //  Frees OpenCL device memory.
   bool free(MUDAMemory mem);
 
+  //  Function: setMemoryPool
+  //  Serves alloc() of at most `slabSize` / 4 bytes from sub-buffers of
+  //  `slabSize` byte slabs, and free() returns them to the pool for reuse
+  //  once commands enqueued before free() have completed.
+  //  Pooled buffers are read/write regardless of `memAttrib`. 0 disables
+  //  the pool(default). Returns false when the current pool still has live
+  //  allocations. Call after initialize().
+  bool setMemoryPool(size_t slabSize);
+
+  //  Function: getMemoryPoolStats
+  //  Returns usage and fragmentation of the memory pool. False when the pool
+  //  is disabled.
+  bool getMemoryPoolStats(MUDAMemoryPoolStats *stats);
+
+  //  Function: trimMemoryPool
+  //  Releases slabs of the memory pool without live allocations. Returns
+  //  released bytes.
+  size_t trimMemoryPool();
+
+  //  Function: allocHost
+  //  Allocates pinned host memory(CL_MEM_ALLOC_HOST_PTR buffer, mapped once)
+  //  from the staging pool. read()/write() and *Async() with this memory are
+  //  DMA transfers without bounce copies in the driver. Returns NULL on
+  //  failure.
+  void *allocHost(size_t size);
+
+  //  Function: freeHost
+  //  Returns memory allocated by allocHost() to the staging pool. The pool
+  //  keeps it pinned for later allocHost() calls.
+  bool freeHost(void *ptr);
+
+  //  Function: setStagingChunkSize
+  //  read() and write() of pageable memory of at least `size` bytes on a
+  //  device without host unified memory(e.g. discrete GPU) are split into
+  //  chunks of `size` bytes and copied through two pinned staging buffers,
+  //  so that memcpy of a chunk overlaps DMA of the other. 0 disables it.
+  //  Default 4 MB.
+  void setStagingChunkSize(size_t size) { stagingChunkSize = size; }
+
   //  Function: bindMemoryObject
   //  Binds memory object to the OpenCL kernel.
   bool bindMemoryObject(MUDAKernel kernel, int argNum, MUDAMemory mem);
@@ -272,10 +613,102 @@ public:
 
   //  Function: execute
   //  Executes OpenCL kernel.
+  //  Passing 0 to `localSizeX` uses the local size in the tuning database
+  //  (see setTuningDB()), or lets the driver choose it. Any global size can
+  //  be used(see planLaunch()).
   bool execute(int deviceID, MUDAKernel kernel, int dimension, size_t sizeX,
                size_t sizeY, size_t sizeZ, size_t localSizeX, size_t localSizeY,
                size_t localSizeZ);
 
+  //  Function: execute
+  //  Same as above, but stores device side execution time(END - START of the
+  //  profiling event) in milliseconds to `kernelMsec`.
+  //  Requires setKernelProfiling(true).
+  bool execute(int deviceID, MUDAKernel kernel, int dimension, size_t sizeX,
+               size_t sizeY, size_t sizeZ, size_t localSizeX, size_t localSizeY,
+               size_t localSizeZ, double *kernelMsec);
+
+  //  Function: planLaunch
+  //  Plans dispatches of `range` for the kernel on ith device(current device
+  //  if -1). When the local size is given but does not divide the global
+  //  size, the remainder of each dimension is covered by tail dispatches with
+  //  global offsets and the remainder as local size(up to 8 dispatches in
+  //  3D; get_local_size() differs in tails). Without local size, the local
+  //  size in the tuning database is used, or NULL is passed so that the
+  //  driver chooses(the tuning database records when that is the fastest).
+  //  Unused dimensions and 0 in local[1] and local[2] are taken as 1. The
+  //  local size is validated against CL_DEVICE_MAX_WORK_ITEM_SIZES,
+  //  CL_DEVICE_MAX_WORK_GROUP_SIZE and CL_KERNEL_WORK_GROUP_SIZE. Returns
+  //  false with the reason in `err` when `range` cannot be launched or the
+  //  limits could not be queried.
+  bool planLaunch(MUDAKernel kernel, const MUDANDRange &range,
+                  MUDALaunchPlan *plan, std::string *err, int deviceID = -1);
+
+  //  Function: execute
+  //  Executes the kernel over `range`(see planLaunch()). Stores device side
+  //  execution time to `kernelMsec` when not NULL(requires
+  //  setKernelProfiling(true)).
+  bool execute(int deviceID, MUDAKernel kernel, const MUDANDRange &range,
+               double *kernelMsec = NULL);
+
+  //  Function: executeAsync
+  //  Enqueues the kernel over `range` and returns immediately. The event
+  //  completes when all dispatches of the launch completed.
+  MUDAEvent executeAsync(int deviceID, MUDAKernel kernel,
+                         const MUDANDRange &range, int numWaitEvents = 0,
+                         const MUDAEvent *waitList = NULL);
+
+  //  Function: launch
+  //  Sets `args` to kernel arguments 0, 1, ... and executes the kernel on the
+  //  current device(blocking, like execute()). MUDAMemory is bound as a
+  //  buffer, MUDALocalMemory as __local memory, and other arguments are
+  //  copied by value, so their C++ type must have the size of the OpenCL
+  //  type(e.g. cl_float4 for float4). clSetKernelArg() is skipped for
+  //  arguments unchanged since the last launch of the kernel.
+  template <typename... Args>
+  bool launch(MUDAKernel kernel, const MUDANDRange &range,
+              const Args &... args) {
+    if (!setLaunchArgs(kernel, 0, args...)) {
+      return false;
+    }
+    return execute(-1, kernel, range);
+  }
+
+  //  Function: launchAsync
+  //  Same as launch(), but returns immediately like executeAsync().
+  template <typename... Args>
+  MUDAEvent launchAsync(MUDAKernel kernel, const MUDANDRange &range,
+                        const Args &... args) {
+    if (!setLaunchArgs(kernel, 0, args...)) {
+      return NULL;
+    }
+    return executeAsync(-1, kernel, range);
+  }
+
+  //  Function: submit
+  //  Replays the graph on the current device in recorded order, and waits
+  //  until it completed. Nodes are enqueued without waiting in between, and
+  //  kernel arguments unchanged since the last replay are not set again.
+  //  Dispatches of LAUNCH nodes are planned(see planLaunch()) on the first
+  //  submit and reused until setRange(). A submit starts after the previous
+  //  submit of the graph completed.
+  bool submit(const MUDACommandGraph &graph);
+
+  //  Function: submitAsync
+  //  Same as submit(), but returns the event of the last node immediately.
+  //  Returns NULL on failure or for an empty graph.
+  MUDAEvent submitAsync(const MUDACommandGraph &graph);
+
+  //  Function: executeAsync
+  //  Enqueues the kernel and returns immediately. The kernel starts after the
+  //  events in `waitList` completed. Returns NULL on failure. Release the
+  //  event with releaseEvent().
+  MUDAEvent executeAsync(int deviceID, MUDAKernel kernel, int dimension,
+                         size_t sizeX, size_t sizeY, size_t sizeZ,
+                         size_t localSizeX, size_t localSizeY,
+                         size_t localSizeZ, int numWaitEvents = 0,
+                         const MUDAEvent *waitList = NULL);
+
   //  Function: read
   //  Reads data from OpenCL buffer.
   bool read(int deviceID, MUDAMemory mem, size_t size, void *ptr);
@@ -286,6 +719,59 @@ public:
   //  (bloking operation).
   bool write(int deviceID, MUDAMemory mem, size_t size, const void *ptr);
 
+  //  Function: readAsync
+  //  Enqueues read from OpenCL buffer and returns immediately. `ptr` is valid
+  //  after the returned event completed.
+  MUDAEvent readAsync(int deviceID, MUDAMemory mem, size_t size, void *ptr,
+                      int numWaitEvents = 0, const MUDAEvent *waitList = NULL);
+
+  //  Function: writeAsync
+  //  Enqueues write to OpenCL buffer and returns immediately. `ptr` must not
+  //  be modified until the returned event completed.
+  MUDAEvent writeAsync(int deviceID, MUDAMemory mem, size_t size,
+                       const void *ptr, int numWaitEvents = 0,
+                       const MUDAEvent *waitList = NULL);
+
+  //  Function: map
+  //  Maps the buffer with clEnqueueMapBuffer() and returns the host pointer.
+  //  `access` ro maps for reading, wo for writing(contents are undefined
+  //  until written), rw for both. On devices with host unified memory this
+  //  is zero copy, so prefer map() to read()/write() of whole buffers on
+  //  CPU devices. Blocks until the region is mapped.
+  void *map(int deviceID, MUDAMemory mem, MUDAMemoryAttrib access,
+            size_t offset = 0, size_t size = 0);
+
+  //  Function: unmap
+  //  Unmaps the pointer returned by map(). Blocks until the unmap completed.
+  bool unmap(int deviceID, MUDAMemory mem, void *ptr);
+
+  //  Function: wait
+  //  Waits until the event completed.
+  bool wait(MUDAEvent event);
+
+  //  Function: waitEvents
+  //  Waits until all events completed.
+  bool waitEvents(int numEvents, const MUDAEvent *events);
+
+  //  Function: releaseEvent
+  //  Releases the event returned by *Async(). The operation itself is not
+  //  cancelled.
+  bool releaseEvent(MUDAEvent event);
+
+  //  Function: getEventTime
+  //  Returns device side execution time of the completed event in
+  //  milliseconds. Requires setKernelProfiling(true).
+  bool getEventTime(MUDAEvent event, double *msec);
+
+  //  Function: flush
+  //  Submits queued operations of all command queues of the device.
+  bool flush(int deviceID);
+
+  //  Function: finish
+  //  Waits until all queued operations of all command queues of the device
+  //  completed.
+  bool finish(int deviceID);
+
   //  Function: writeImage
   //  Writes image to OpenCL buffer.
   //  This function does not return until actual memory copy is finished
@@ -297,24 +783,207 @@ public:
   const size_t getMemoryObjectSize() const;
 
 private:
+  struct AsyncBuild;
+
+  bool setLaunchArgs(MUDAKernel kernel, int argNum) {
+    (void)kernel;
+    (void)argNum;
+    return true;
+  }
+
+  template <typename T, typename... Rest>
+  bool setLaunchArgs(MUDAKernel kernel, int argNum, const T &arg,
+                     const Rest &... rest) {
+    return setLaunchArg(kernel, argNum, arg) &&
+           setLaunchArgs(kernel, argNum + 1, rest...);
+  }
+
+  bool setLaunchArg(MUDAKernel kernel, int argNum, MUDAMemory mem);
+  bool setLaunchArg(MUDAKernel kernel, int argNum,
+                    const MUDALocalMemory &local);
+
+  template <typename T>
+  bool setLaunchArg(MUDAKernel kernel, int argNum, const T &value) {
+    static_assert(!std::is_pointer<T>::value,
+                  "Pass MUDAMemory for buffer arguments.");
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Kernel argument must be trivially copyable.");
+    return setArgCached(kernel, argNum, sizeof(T), &value, false);
+  }
+
+  // Calls clSetKernelArg() unless the argument has the same value.
+  bool setArgCached(MUDAKernel kernel, int argNum, size_t size,
+                    const void *value, bool isLocal);
+
+  void trackProgram(MUDAProgram program);
+  int resolveDeviceID(int deviceID);
+  bool setupCommandQueue(int deviceID);
+  void asyncBuildMain();
+  void runAsyncBuild(std::shared_ptr<AsyncBuild> build);
+  void waitAsyncBuilds();
+  bool lookupLocalSize(int deviceID, MUDAKernel kernel, int dimension,
+                       const size_t global[3], size_t local[3]);
+  bool useStaging(int deviceID, size_t size, const void *ptr);
+  bool stagedTransfer(int deviceID, MUDAMemory mem, size_t size, void *ptr,
+                      bool isWrite);
+
   bool useCPU;
   bool debug;
   bool measureProfile;
+  bool kernelProfiling;
+  MUDATuningDB *tuningDB;
   bool verb;
 
+  // Live programs and kernels, released by the destructor. Guarded by
+  // `mutex`.
   std::vector<MUDAProgram> programs;
+  std::vector<MUDAKernel> kernels;
+
+  bool useAllDevices;
+
+  int queuesPerDevice;
+  bool outOfOrderQueues;
+
+  size_t stagingChunkSize;
+
+  MUDAMemoryPool *memoryPool; // NULL = disabled.
+
+  // Accumulated by addProfile().
+  std::vector<MUDAProfileEntry> profile;
+  std::mutex profileMutex;
 
 #ifdef HAVE_OPENCL
+  cl_platform_id platform;
   cl_context context;
   std::vector<cl_device_id> devices; // array
   int currentDeviceID;
 
-  std::vector<cl_command_queue> commandQueues;
-  std::vector<cl_kernel> kernels;
+  // Command queues of a device. `next` picks the queue in round robin.
+  struct QueueSet {
+    std::vector<cl_command_queue> queues;
+    size_t next;
+    bool outOfOrder; // Created with CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE.
+
+    QueueSet() : next(0), outOfOrder(false) {}
+  };
+
+  cl_command_queue getQueue(int deviceID);
+  bool isOutOfOrderQueue(int deviceID);
+  cl_int enqueueKernel(int deviceID, cl_command_queue queue, MUDAKernel kernel,
+                       const MUDANDRange &range, cl_uint numWaitEvents,
+                       const cl_event *waitList, cl_event *event,
+                       cl_event *firstEvent);
+  cl_int enqueuePlan(cl_command_queue queue, bool outOfOrder,
+                     MUDAKernel kernel, const MUDALaunchPlan &plan,
+                     cl_uint numWaitEvents, const cl_event *waitList,
+                     cl_event *event, cl_event *firstEvent);
+  void getQueues(int deviceID, std::vector<cl_command_queue> *queues);
+
+  std::vector<QueueSet> queuePool; // Indexed by device.
+
+  // Device properties queried once, for planLaunch() and useStaging().
+  struct DeviceLimits {
+    bool valid; // Queried.
+    MUDAWorkGroupLimits workGroup; // Device part.
+    bool hostUnifiedMemory;        // CL_DEVICE_HOST_UNIFIED_MEMORY
+
+    DeviceLimits() : valid(false), hostUnifiedMemory(false) {}
+  };
+
+  bool getDeviceLimits(int deviceID, DeviceLimits *limits);
+  bool getKernelWorkGroupSize(int deviceID, MUDAKernel kernel, size_t *size);
+
+  std::vector<DeviceLimits> deviceLimits; // Indexed by device.
+
+  // Pinned host memory of allocHost(). Blocks stay mapped until shutdown and
+  // are reused.
+  struct PinnedBlock {
+    cl_mem memObj;
+    void *ptr;
+    size_t size;
+    bool inUse;
+  };
+
+  std::vector<PinnedBlock> pinnedPool;
+  std::mutex pinnedMutex;
+
+  // getDeviceKey() of each device, used by execute() with tuningDB.
+  std::vector<std::string> deviceKeys;
+
+  // Guards lazily created objects(e.g. command queue), so that programs can
+  // be built from multiple threads sharing this context.
+  std::mutex mutex;
+
+  // loadKernelSourceAsync() builds waiting for a build thread.
+  std::deque<std::shared_ptr<AsyncBuild> > asyncQueue;
+  std::vector<std::thread> asyncThreads;
+  int numIdleAsyncThreads;
+  int numRunningAsyncBuilds;
+  bool stopAsyncThreads;
+  std::mutex asyncMutex;
+  std::condition_variable asyncCond;     // Build queued or stop requested.
+  std::condition_variable asyncDoneCond; // Build finished.
 // std::vector<MUDAMemory>   memObjs;
 #endif
 };
 
+// Move-only owner of a MUDA object of MUDADeviceOCL. The object is released
+// with `Release` when the handle is destroyed or reset, so programs reloaded
+// in a loop do not leak driver memory. The device must outlive the handle.
+//
+//   MUDAProgramHandle program(device, device->loadKernelSource(...));
+//   MUDAKernelHandle kernel(device, device->createKernel(program.get(), "f"));
+template <typename T, bool (MUDADeviceOCL::*Release)(T)> class MUDAHandle {
+public:
+  MUDAHandle() : device(NULL), obj(NULL) {}
+  MUDAHandle(MUDADeviceOCL *device, T obj) : device(device), obj(obj) {}
+  ~MUDAHandle() { reset(); }
+
+  MUDAHandle(MUDAHandle &&rhs) : device(rhs.device), obj(rhs.release()) {}
+
+  MUDAHandle &operator=(MUDAHandle &&rhs) {
+    if (this != &rhs) {
+      reset();
+      device = rhs.device;
+      obj = rhs.release();
+    }
+    return *this;
+  }
+
+  MUDAHandle(const MUDAHandle &) = delete;
+  MUDAHandle &operator=(const MUDAHandle &) = delete;
+
+  T get() const { return obj; }
+  explicit operator bool() const { return obj != NULL; }
+
+  //  Function: release
+  //  Gives up the ownership and returns the object.
+  T release() {
+    T ret = obj;
+    obj = NULL;
+    return ret;
+  }
+
+  //  Function: reset
+  //  Releases the object now.
+  void reset() {
+    if (obj) {
+      (device->*Release)(obj);
+      obj = NULL;
+    }
+  }
+
+private:
+  MUDADeviceOCL *device;
+  T obj;
+};
+
+typedef MUDAHandle<MUDAProgram, &MUDADeviceOCL::releaseProgram>
+    MUDAProgramHandle;
+typedef MUDAHandle<MUDAKernel, &MUDADeviceOCL::releaseKernel> MUDAKernelHandle;
+typedef MUDAHandle<MUDAMemory, &MUDADeviceOCL::free> MUDAMemoryHandle;
+typedef MUDAHandle<MUDAEvent, &MUDADeviceOCL::releaseEvent> MUDAEventHandle;
+
 } // namespace muda
 
 #endif // MUDA_RUNTIME_H
@@ -0,0 +1,185 @@
+//
+// Copyright 2009 - 2017 Light Transport Entertainment Inc.
+//
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include "muda_tuning_db.h"
+
+namespace muda {
+
+namespace {
+
+std::string makeKey(const std::string &device, const std::string &kernel) {
+  return device + "\t" + kernel;
+}
+
+bool parseSize3(const std::string &s, size_t v[3]) {
+  unsigned long long x, y, z;
+  if (sscanf(s.c_str(), "%llu,%llu,%llu", &x, &y, &z) != 3) {
+    return false;
+  }
+  v[0] = size_t(x);
+  v[1] = size_t(y);
+  v[2] = size_t(z);
+  return true;
+}
+
+bool sameGlobal(const MUDATuningEntry &e, int dimension,
+                const size_t global[3]) {
+  if (e.dimension != dimension) {
+    return false;
+  }
+  for (int i = 0; i < dimension; i++) {
+    if (e.global[i] != global[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+// File format(tab separated):
+// device, kernel, dimension, global(x,y,z), local(x,y,z), msec
+bool MUDATuningDB::load(const std::string &filename) {
+  std::ifstream ifs(filename.c_str());
+  if (!ifs) {
+    // Not tuned yet.
+    return true;
+  }
+
+  std::string line;
+  while (std::getline(ifs, line)) {
+    if (line.empty() || (line[0] == '#')) {
+      continue;
+    }
+
+    std::vector<std::string> cols;
+    std::stringstream ss(line);
+    std::string col;
+    while (std::getline(ss, col, '\t')) {
+      cols.push_back(col);
+    }
+    if (cols.size() < 6) {
+      return false;
+    }
+
+    MUDATuningEntry e;
+    e.device = cols[0];
+    e.kernel = cols[1];
+    e.dimension = atoi(cols[2].c_str());
+    e.msec = atof(cols[5].c_str());
+    if ((e.dimension < 1) || (e.dimension > 3) ||
+        !parseSize3(cols[3], e.global) || !parseSize3(cols[4], e.local)) {
+      return false;
+    }
+
+    set(e);
+  }
+
+  return true;
+}
+
+bool MUDATuningDB::save(const std::string &filename) {
+  FILE *fp = fopen(filename.c_str(), "w");
+  if (!fp) {
+    return false;
+  }
+
+  fprintf(fp, "# oclc local size tuning database\n");
+  fprintf(fp, "# device\tkernel\tdimension\tglobal\tlocal\tmsec\n");
+
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    std::map<std::string, std::vector<MUDATuningEntry> >::iterator it;
+    for (it = this->entries.begin(); it != this->entries.end(); it++) {
+      for (size_t i = 0; i < it->second.size(); i++) {
+        const MUDATuningEntry &e = it->second[i];
+        fprintf(fp, "%s\t%s\t%d\t%llu,%llu,%llu\t%llu,%llu,%llu\t%.6f\n",
+                e.device.c_str(), e.kernel.c_str(), e.dimension,
+                (unsigned long long)e.global[0],
+                (unsigned long long)e.global[1],
+                (unsigned long long)e.global[2],
+                (unsigned long long)e.local[0], (unsigned long long)e.local[1],
+                (unsigned long long)e.local[2], e.msec);
+      }
+    }
+  }
+
+  return (fclose(fp) == 0);
+}
+
+void MUDATuningDB::set(const MUDATuningEntry &entry) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+
+  std::vector<MUDATuningEntry> &list =
+      this->entries[makeKey(entry.device, entry.kernel)];
+  for (size_t i = 0; i < list.size(); i++) {
+    if (sameGlobal(list[i], entry.dimension, entry.global)) {
+      list[i] = entry;
+      return;
+    }
+  }
+  list.push_back(entry);
+}
+
+bool MUDATuningDB::lookup(const std::string &device, const std::string &kernel,
+                          int dimension, const size_t global[3],
+                          size_t local[3]) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+
+  std::map<std::string, std::vector<MUDATuningEntry> >::iterator it =
+      this->entries.find(makeKey(device, kernel));
+  if (it == this->entries.end()) {
+    return false;
+  }
+
+  const MUDATuningEntry *best = NULL;
+  double bestDistance = 0.0;
+  for (size_t i = 0; i < it->second.size(); i++) {
+    const MUDATuningEntry &e = it->second[i];
+    if (e.dimension != dimension) {
+      continue;
+    }
+
+    // OpenCL 1.x requires that the local size divides the global size.
+    bool usable = true;
+    double distance = 0.0;
+    for (int d = 0; d < dimension; d++) {
+      if ((e.local[d] != 0) && ((global[d] % e.local[d]) != 0)) {
+        usable = false;
+      }
+      distance += std::fabs(std::log(double(e.global[d])) -
+                            std::log(double(global[d])));
+    }
+    if (usable && (!best || (distance < bestDistance))) {
+      best = &e;
+      bestDistance = distance;
+    }
+  }
+
+  if (!best) {
+    return false;
+  }
+
+  for (int d = 0; d < 3; d++) {
+    local[d] = (d < dimension) ? best->local[d] : 1;
+  }
+  return true;
+}
+
+size_t MUDATuningDB::size() {
+  std::lock_guard<std::mutex> lock(this->mutex);
+
+  size_t n = 0;
+  std::map<std::string, std::vector<MUDATuningEntry> >::iterator it;
+  for (it = this->entries.begin(); it != this->entries.end(); it++) {
+    n += it->second.size();
+  }
+  return n;
+}
+
+} // namespace muda
@@ -0,0 +1,70 @@
+//
+// Copyright 2009 - 2017 Light Transport Entertainment Inc.
+//
+#ifndef MUDA_TUNING_DB_H
+#define MUDA_TUNING_DB_H
+
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace muda {
+
+// Best local size of a kernel for a global size on a device.
+struct MUDATuningEntry {
+  std::string device; // MUDADeviceOCL::getDeviceKey()
+  std::string kernel; // Kernel function name.
+  int dimension;
+  size_t global[3];
+  size_t local[3]; // All 0 when the driver's choice was the fastest.
+  double msec;     // Kernel time with the local size.
+
+  MUDATuningEntry() : dimension(1), msec(0.0) {
+    for (int i = 0; i < 3; i++) {
+      global[i] = 1;
+      local[i] = 0;
+    }
+  }
+};
+
+// Tuning database of local sizes, persisted as a text file.
+// MUDADeviceOCL::execute() looks up the local size from the database when the
+// caller passes 0(see MUDADeviceOCL::setTuningDB()).
+// This class is thread-safe.
+class MUDATuningDB {
+public:
+  //  Function: load
+  //  Loads entries from the file. A missing file is an empty database.
+  bool load(const std::string &filename);
+
+  //  Function: save
+  //  Writes all entries to the file.
+  bool save(const std::string &filename);
+
+  //  Function: set
+  //  Adds the entry, or replaces the entry of the same device, kernel and
+  //  global size.
+  void set(const MUDATuningEntry &entry);
+
+  //  Function: lookup
+  //  Finds the local size for the global size. When the global size was not
+  //  tuned, the entry of the nearest global size whose local size divides
+  //  `global` is used. Returns false when no entry can be used.
+  bool lookup(const std::string &device, const std::string &kernel,
+              int dimension, const size_t global[3], size_t local[3]);
+
+  //  Function: size
+  //  Returns # of entries.
+  size_t size();
+
+private:
+  // Keyed by device and kernel.
+  std::map<std::string, std::vector<MUDATuningEntry> > entries;
+  std::mutex mutex;
+};
+
+} // namespace muda
+
+#endif // MUDA_TUNING_DB_H
@@ -1,11 +1,34 @@
 sources = {
    "muda_impl.h",
+   "thread_pool.h",
    "muda_device_ocl.cc",
+   "muda_command_graph.cc",
+   "muda_memory_pool.cc",
+   "muda_tuning_db.cc",
+   "compile_job.cc",
+   "compile_server.cc",
+   "include_scanner.cc",
+   "include_vfs.cc",
+   "watch.cc",
+   "binary_cache.cc",
+   "ipc.cc",
+   "worker_pool.cc",
+   "device_matrix.cc",
+   "kernel_bench.cc",
    "OptionParser.cpp",
    "main.cc",
    "third_party/clew/src/clew.c",
    }
 
+bench_sources = {
+   "bench/compile_bench.cc",
+   "muda_device_ocl.cc",
+   "muda_memory_pool.cc",
+   "muda_tuning_db.cc",
+   "OptionParser.cpp",
+   "third_party/clew/src/clew.c",
+   }
+
 -- premake4.lua
 solution "OCLCSolution"
    configurations { "Release", "Debug" }
@@ -20,6 +43,7 @@ solution "OCLCSolution"
    project "OCLC"
       kind "ConsoleApp"
       language "C++"
+      cppdialect "C++11"
       files { sources }
 
       includedirs {
@@ -27,12 +51,14 @@ solution "OCLCSolution"
          "./third_party/clew/include",
       }
 
-      defines { 'HAVE_OPENCL' }
+      -- clEnqueueMarker() fences freed blocks of the memory pool.
+      defines { 'HAVE_OPENCL', 'CL_USE_DEPRECATED_OPENCL_1_1_APIS' }
 
       -- MacOSX. Guess we use gcc.
       configuration { "macosx", "gmake" }
 
          defines { '_LARGEFILE_SOURCE', '_FILE_OFFSET_BITS=64' }
+         links { "pthread" }
 
       -- Windows specific
       configuration { "windows", "gmake" }
@@ -60,7 +86,7 @@ solution "OCLCSolution"
       configuration {"linux", "gmake"}
          defines { '__STDC_CONSTANT_MACROS', '__STDC_LIMIT_MACROS' } -- c99
 
-         links { "dl" }
+         links { "dl", "pthread" }
 
       configuration "Debug"
          defines { "DEBUG" } -- -DDEBUG
@@ -71,3 +97,48 @@ solution "OCLCSolution"
          -- defines { "NDEBUG" } -- -NDEBUG
          symbols "On"
          targetname "oclc"
+
+   -- Compile time benchmark of OpenCL drivers
+   project "OCLCBench"
+      kind "ConsoleApp"
+      language "C++"
+      cppdialect "C++11"
+      files { bench_sources }
+
+      includedirs {
+         "./",
+         "./third_party/clew/include",
+      }
+
+      -- clEnqueueMarker() fences freed blocks of the memory pool.
+      defines { 'HAVE_OPENCL', 'CL_USE_DEPRECATED_OPENCL_1_1_APIS' }
+
+      configuration { "macosx", "gmake" }
+
+         defines { '_LARGEFILE_SOURCE', '_FILE_OFFSET_BITS=64' }
+         links { "pthread" }
+
+      configuration { "windows", "gmake" }
+
+         defines { '__STDC_CONSTANT_MACROS', '__STDC_LIMIT_MACROS' } -- c99
+
+         links { "stdc++", "msvcrt", "ws2_32", "winmm" }
+
+      configuration { "windows", "vs*", "x64" }
+
+         defines { '_CRT_SECURE_NO_WARNINGS' }
+         defines { 'NOMINMAX', '_LARGEFILE_SOURCE', '_FILE_OFFSET_BITS=64' }
+
+      configuration {"linux", "gmake"}
+         defines { '__STDC_CONSTANT_MACROS', '__STDC_LIMIT_MACROS' } -- c99
+
+         links { "dl", "pthread" }
+
+      configuration "Debug"
+         defines { "DEBUG" } -- -DDEBUG
+         symbols "On"
+         targetname "oclc_bench_d"
+
+      configuration "Release"
+         symbols "On"
+         targetname "oclc_bench"
@@ -0,0 +1,103 @@
+//
+// Simple bounded thread pool.
+//
+#ifndef OCLC_THREAD_POOL_H
+#define OCLC_THREAD_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace oclc {
+
+// Fixed number of worker threads consuming a FIFO task queue.
+// Tasks are started in the order they were enqueued.
+class ThreadPool {
+public:
+  explicit ThreadPool(int numThreads) : stop(false), numPending(0) {
+    if (numThreads < 1) {
+      numThreads = 1;
+    }
+    for (int i = 0; i < numThreads; i++) {
+      workers.push_back(std::thread(&ThreadPool::workerMain, this));
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stop = true;
+    }
+    taskCond.notify_all();
+    for (size_t i = 0; i < workers.size(); i++) {
+      workers[i].join();
+    }
+  }
+
+  void enqueue(const std::function<void()> &task) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      tasks.push_back(task);
+      numPending++;
+    }
+    taskCond.notify_one();
+  }
+
+  //  Function: wait
+  //  Blocks until all enqueued tasks are finished.
+  void wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    doneCond.wait(lock, [this] { return numPending == 0; });
+  }
+
+  int size() const { return int(workers.size()); }
+
+  //  Function: defaultNumThreads
+  //  Returns # of hardware threads(at least 1).
+  static int defaultNumThreads() {
+    unsigned int n = std::thread::hardware_concurrency();
+    return (n > 0) ? int(n) : 1;
+  }
+
+private:
+  void workerMain() {
+    for (;;) {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        taskCond.wait(lock, [this] { return stop || !tasks.empty(); });
+        if (tasks.empty()) {
+          return; // stop requested and no more tasks.
+        }
+        task = tasks.front();
+        tasks.pop_front();
+      }
+
+      task();
+
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        numPending--;
+      }
+      doneCond.notify_all();
+    }
+  }
+
+  ThreadPool(const ThreadPool &);
+  ThreadPool &operator=(const ThreadPool &);
+
+  std::vector<std::thread> workers;
+  std::deque<std::function<void()> > tasks;
+  std::mutex mutex;
+  std::condition_variable taskCond;
+  std::condition_variable doneCond;
+  bool stop;
+  int numPending;
+};
+
+} // namespace oclc
+
+#endif // OCLC_THREAD_POOL_H
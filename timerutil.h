@@ -0,0 +1,51 @@
+//
+// Simple high resolution timer.
+//
+#ifndef TIMERUTIL_H
+#define TIMERUTIL_H
+
+#include <chrono>
+
+namespace timerutil {
+
+// Measures wall clock time between start() and end() with monotonic clock.
+class timerutil {
+public:
+  typedef unsigned long long time_t;
+
+  timerutil() { start(); }
+
+  void start() {
+    t_[0] = std::chrono::steady_clock::now();
+    t_[1] = t_[0];
+  }
+  void end() { t_[1] = std::chrono::steady_clock::now(); }
+
+  time_t sec() const {
+    return time_t(
+        std::chrono::duration_cast<std::chrono::seconds>(t_[1] - t_[0])
+            .count());
+  }
+  time_t msec() const {
+    return time_t(
+        std::chrono::duration_cast<std::chrono::milliseconds>(t_[1] - t_[0])
+            .count());
+  }
+  time_t usec() const {
+    return time_t(
+        std::chrono::duration_cast<std::chrono::microseconds>(t_[1] - t_[0])
+            .count());
+  }
+
+  // Elapsed time in milliseconds with sub-millisecond precision.
+  double elapsed() const {
+    return std::chrono::duration<double, std::milli>(t_[1] - t_[0]).count();
+  }
+
+private:
+  std::chrono::steady_clock::time_point t_[2];
+};
+
+} // namespace timerutil
+
+#endif // TIMERUTIL_H
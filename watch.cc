@@ -0,0 +1,287 @@
+//
+// Watch mode: rebuild inputs on file change(--watch, Linux only).
+//
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <map>
+#include <set>
+
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include "include_scanner.h"
+#include "include_vfs.h"
+#include "thread_pool.h"
+#include "watch.h"
+
+namespace oclc {
+
+#if defined(__linux__)
+
+namespace {
+
+struct WatchedFile {
+  std::string path;
+  std::string content;     // Content of the last build.
+  int headerIndex;         // Index in WatchConfig::headerFiles. -1 = input.
+  std::vector<size_t> jobs; // Inputs built from this file.
+
+  WatchedFile() : headerIndex(-1) {}
+};
+
+void splitPath(const std::string &path, std::string *dir,
+               std::string *basename) {
+  size_t pos = path.find_last_of('/');
+  if (pos == std::string::npos) {
+    (*dir) = ".";
+    (*basename) = path;
+  } else {
+    (*dir) = (pos == 0) ? std::string("/") : path.substr(0, pos);
+    (*basename) = path.substr(pos + 1);
+  }
+}
+
+// Returns canonical directory of `path`. Directories are watched instead of
+// files, since editors often save by writing a new file and renaming it.
+std::string canonicalDirectory(const std::string &dir) {
+  char buf[PATH_MAX];
+  if (realpath(dir.c_str(), buf) == NULL) {
+    return dir;
+  }
+  return std::string(buf);
+}
+
+// Reads pending inotify events and collects watched files touched by them.
+void readEvents(int fd, const std::map<int, std::string> &wdDirs,
+                const std::map<std::string, size_t> &fileIndex,
+                std::set<size_t> *touched) {
+  // Buffer aligned for inotify_event.
+  char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+  ssize_t len = read(fd, buf, sizeof(buf));
+  if (len <= 0) {
+    return;
+  }
+
+  for (char *p = buf; p < buf + len;) {
+    const struct inotify_event *ev =
+        reinterpret_cast<const struct inotify_event *>(p);
+    p += sizeof(struct inotify_event) + ev->len;
+
+    if (ev->len == 0) {
+      continue;
+    }
+
+    std::map<int, std::string>::const_iterator d = wdDirs.find(ev->wd);
+    if (d == wdDirs.end()) {
+      continue;
+    }
+
+    std::map<std::string, size_t>::const_iterator f =
+        fileIndex.find(d->second + "/" + ev->name);
+    if (f != fileIndex.end()) {
+      touched->insert(f->second);
+    }
+  }
+}
+
+} // namespace
+
+bool runWatch(muda::MUDADeviceOCL *device, const std::vector<CompileJob> &jobs,
+              const CompileOptions &options, const WatchConfig &config,
+              WatchReportFunc report) {
+  std::vector<WatchedFile> files;
+  std::map<std::string, size_t> fileIndex; // canonical path -> files
+  std::map<int, std::string> wdDirs;
+
+  int fd = inotify_init1(IN_CLOEXEC);
+  if (fd < 0) {
+    perror("inotify_init1");
+    return false;
+  }
+
+  // Registers file and returns its index.
+  std::function<size_t(const std::string &)> addFile =
+      [&](const std::string &path) {
+        std::string dir, basename;
+        splitPath(path, &dir, &basename);
+        dir = canonicalDirectory(dir);
+        std::string key = dir + "/" + basename;
+
+        std::map<std::string, size_t>::iterator it = fileIndex.find(key);
+        if (it != fileIndex.end()) {
+          return it->second;
+        }
+
+        // inotify returns the same descriptor for a directory already
+        // watched.
+        int wd = inotify_add_watch(fd, dir.c_str(),
+                                   IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+        if (wd < 0) {
+          fprintf(stderr, "[oclc] Failed to watch directory: %s\n",
+                  dir.c_str());
+        } else {
+          wdDirs[wd] = dir;
+        }
+
+        WatchedFile f;
+        f.path = path;
+        readfile(path, &f.content);
+        files.push_back(f);
+        fileIndex[key] = files.size() - 1;
+        return files.size() - 1;
+      };
+
+  // Adds files included by ith input, so that editing them rebuilds it.
+  std::function<void(size_t)> addDependencies = [&](size_t i) {
+    std::vector<std::string> deps;
+    scanIncludes(jobs[i].input, options.includeDirs, &deps, NULL);
+    for (size_t d = 0; d < deps.size(); d++) {
+      WatchedFile &f = files[addFile(deps[d])];
+      if (std::find(f.jobs.begin(), f.jobs.end(), i) == f.jobs.end()) {
+        f.jobs.push_back(i);
+      }
+    }
+  };
+
+  for (size_t i = 0; i < jobs.size(); i++) {
+    files[addFile(jobs[i].input)].jobs.push_back(i);
+    addDependencies(i);
+  }
+  for (size_t i = 0; i < config.headerFiles.size(); i++) {
+    size_t idx = addFile(config.headerFiles[i]);
+    files[idx].headerIndex = int(i);
+  }
+
+  CompileOptions opts = options;
+
+  ThreadPool pool(config.numThreads);
+
+  printf("[oclc] Watching %d file(s). Press Ctrl-C to quit.\n",
+         int(files.size()));
+  fflush(stdout);
+
+  for (;;) {
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    if (poll(&pfd, 1, -1) <= 0) {
+      continue;
+    }
+
+    std::set<size_t> touched;
+    readEvents(fd, wdDirs, fileIndex, &touched);
+
+    // Debounce.
+    for (;;) {
+      pfd.revents = 0;
+      if (poll(&pfd, 1, config.debounceMsec) <= 0) {
+        break;
+      }
+      readEvents(fd, wdDirs, fileIndex, &touched);
+    }
+
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+
+    std::set<size_t> dirtyJobs;
+    bool headerChanged = false;
+    for (std::set<size_t>::iterator it = touched.begin(); it != touched.end();
+         it++) {
+      WatchedFile &f = files[*it];
+      std::string content;
+      if (!readfile(f.path, &content) || (content == f.content)) {
+        continue; // Removed while saving, or only timestamp was changed.
+      }
+      f.content = content;
+      if (f.headerIndex >= 0) {
+        headerChanged = true;
+      }
+      dirtyJobs.insert(f.jobs.begin(), f.jobs.end());
+    }
+
+    if (headerChanged) {
+      // Headers are prepended to every input.
+      std::vector<std::string> headers(config.headerFiles.size());
+      for (size_t i = 0; i < files.size(); i++) {
+        if (files[i].headerIndex >= 0) {
+          headers[files[i].headerIndex] = files[i].content;
+        }
+      }
+      opts.headers.clear();
+      for (size_t i = 0; i < headers.size(); i++) {
+        if (!headers[i].empty()) {
+          opts.headers.push_back(headers[i]);
+        }
+      }
+      for (size_t i = 0; i < jobs.size(); i++) {
+        dirtyJobs.insert(i);
+      }
+    }
+
+    if (dirtyJobs.empty()) {
+      continue;
+    }
+
+    if (opts.vfs) {
+      opts.vfs->clear();
+    }
+
+    std::vector<size_t> indices(dirtyJobs.begin(), dirtyJobs.end());
+    std::vector<CompileResult> results(indices.size());
+    for (size_t i = 0; i < indices.size(); i++) {
+      pool.enqueue([&, i] {
+        runCompileJob(device, jobs[indices[i]], opts, &results[i]);
+      });
+    }
+    pool.wait();
+
+    int numFailed = 0;
+    for (size_t i = 0; i < indices.size(); i++) {
+      // The input may include new files.
+      addDependencies(indices[i]);
+
+      report(jobs[indices[i]], results[i]);
+      if (!results[i].success) {
+        numFailed++;
+      }
+    }
+
+    double msec = std::chrono::duration<double, std::milli>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+    printf("[oclc] Rebuilt %d input(s), %d failed. %.1f ms\n",
+           int(indices.size()), numFailed, msec);
+    fflush(stdout);
+  }
+
+  close(fd);
+  return true;
+}
+
+#else
+
+bool runWatch(muda::MUDADeviceOCL *device, const std::vector<CompileJob> &jobs,
+              const CompileOptions &options, const WatchConfig &config,
+              WatchReportFunc report) {
+  (void)device;
+  (void)jobs;
+  (void)options;
+  (void)config;
+  (void)report;
+  fprintf(stderr, "--watch is not supported on this platform.\n");
+  return false;
+}
+
+#endif
+
+} // namespace oclc
@@ -0,0 +1,42 @@
+//
+// Watch mode: rebuild inputs on file change(--watch, Linux only).
+//
+#ifndef OCLC_WATCH_H
+#define OCLC_WATCH_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "compile_job.h"
+
+namespace oclc {
+
+struct WatchConfig {
+  std::vector<std::string> headerFiles; // --header files. Order of
+                                        // CompileOptions::headers.
+  int numThreads;                       // # of programs rebuilt in parallel.
+  int debounceMsec; // Wait until files are quiet for this period, so that a
+                    // save which touches a file several times triggers one
+                    // rebuild.
+
+  WatchConfig() : numThreads(1), debounceMsec(50) {}
+};
+
+typedef std::function<void(const CompileJob &, const CompileResult &)>
+    WatchReportFunc;
+
+//  Function: runWatch
+//  Watches inputs, header files and files included by the inputs, and
+//  rebuilds with `device`(whose context is kept alive) when they are
+//  modified. Only inputs whose content actually changed are rebuilt. A
+//  modified --header file rebuilds every input.
+//  Each result is passed to `report`. Initial build is done by the caller.
+//  Does not return unless an error occurred.
+bool runWatch(muda::MUDADeviceOCL *device, const std::vector<CompileJob> &jobs,
+              const CompileOptions &options, const WatchConfig &config,
+              WatchReportFunc report);
+
+} // namespace oclc
+
+#endif // OCLC_WATCH_H
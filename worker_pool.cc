@@ -0,0 +1,427 @@
+//
+// Process-isolated compile worker pool(POSIX only).
+//
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <deque>
+#include <iostream>
+
+#ifndef _WIN32
+#include <poll.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "clew.h"
+
+#include "ipc.h"
+#include "worker_pool.h"
+
+namespace oclc {
+
+#ifndef _WIN32
+
+namespace {
+
+// Message types sent from worker to parent.
+enum { kMessageReady = 0, kMessageResult = 1 };
+
+enum WorkerState { kWorkerDead, kWorkerStarting, kWorkerIdle, kWorkerBusy };
+
+// Worker startup(clewInit + context creation) is not bounded by the job
+// timeout, but a worker which never becomes ready is still killed.
+const double kStartupTimeoutSec = 60.0;
+
+struct Worker {
+  pid_t pid;
+  int jobFd;    // parent -> worker
+  int resultFd; // worker -> parent
+  WorkerState state;
+  size_t jobIndex;
+  double deadline; // <= 0 means no deadline.
+
+  Worker()
+      : pid(-1), jobFd(-1), resultFd(-1), state(kWorkerDead), jobIndex(0),
+        deadline(0.0) {}
+};
+
+double now() {
+  return std::chrono::duration<double>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void workerMain(int jobFd, int resultFd, const WorkerConfig &config) {
+  if (clewInit() != CLEW_SUCCESS) {
+    fprintf(stderr, "[worker %d] Failed to find OpenCL device.\n",
+            int(getpid()));
+    _exit(2);
+  }
+
+  muda::MUDADeviceOCL device(muda::ocl_cpu);
+  if (!device.initialize(config.platformID, config.deviceID,
+                         config.options.verbose)) {
+    _exit(2);
+  }
+
+  {
+    MessageWriter w;
+    w.putU32(kMessageReady);
+    if (!sendMessage(resultFd, w.data())) {
+      _exit(2);
+    }
+  }
+
+  for (;;) {
+    std::string msg;
+    if (!recvMessage(jobFd, &msg)) {
+      break; // Parent closed the pipe.
+    }
+
+    CompileJob job;
+    MessageReader r(msg);
+    unsigned int deviceID;
+    if (!r.getString(&job.input) || !r.getString(&job.moduleFile) ||
+        !r.getString(&job.depFile) || !r.getU32(&deviceID)) {
+      break;
+    }
+    job.deviceID = int(deviceID); // -1 = current device.
+
+    CompileResult result;
+    runCompileJob(&device, job, config.options, &result);
+    fflush(stdout);
+
+    MessageWriter w;
+    w.putU32(kMessageResult);
+    w.putU32(result.success ? 1 : 0);
+    w.putU32(result.cached ? 1 : 0);
+    w.putU32((unsigned int)(result.msec * 1000.0)); // usec
+    w.putString(result.log);
+    if (!sendMessage(resultFd, w.data())) {
+      break;
+    }
+  }
+
+  fflush(stdout);
+  _exit(0);
+}
+
+void closeWorkerFds(Worker *w) {
+  if (w->jobFd >= 0) {
+    close(w->jobFd);
+    w->jobFd = -1;
+  }
+  if (w->resultFd >= 0) {
+    close(w->resultFd);
+    w->resultFd = -1;
+  }
+}
+
+bool spawnWorker(std::vector<Worker> &workers, size_t idx,
+                 const WorkerConfig &config) {
+  int toWorker[2];
+  int fromWorker[2];
+  if (pipe(toWorker) != 0) {
+    return false;
+  }
+  if (pipe(fromWorker) != 0) {
+    close(toWorker[0]);
+    close(toWorker[1]);
+    return false;
+  }
+
+  fflush(stdout);
+  fflush(stderr);
+
+  pid_t pid = fork();
+  if (pid < 0) {
+    close(toWorker[0]);
+    close(toWorker[1]);
+    close(fromWorker[0]);
+    close(fromWorker[1]);
+    return false;
+  }
+
+  if (pid == 0) {
+    // Child. Close pipes to other workers so that they see EOF correctly.
+    for (size_t i = 0; i < workers.size(); i++) {
+      closeWorkerFds(&workers[i]);
+    }
+    close(toWorker[1]);
+    close(fromWorker[0]);
+    workerMain(toWorker[0], fromWorker[1], config);
+    _exit(0); // not reached.
+  }
+
+  close(toWorker[0]);
+  close(fromWorker[1]);
+
+  Worker &w = workers[idx];
+  w.pid = pid;
+  w.jobFd = toWorker[1];
+  w.resultFd = fromWorker[0];
+  w.state = kWorkerStarting;
+  w.deadline = now() + std::max(kStartupTimeoutSec, config.timeoutSec);
+
+  return true;
+}
+
+// Reaps the worker process and returns the reason of its termination.
+std::string reapWorker(Worker *w, bool forceKill) {
+  closeWorkerFds(w);
+
+  std::string reason;
+  if (w->pid > 0) {
+    if (forceKill) {
+      kill(w->pid, SIGKILL);
+    }
+    int status = 0;
+    while (waitpid(w->pid, &status, 0) < 0 && errno == EINTR) {
+    }
+
+    char buf[128];
+    if (WIFSIGNALED(status)) {
+      snprintf(buf, sizeof(buf), "killed by signal %d", WTERMSIG(status));
+    } else {
+      snprintf(buf, sizeof(buf), "exited with status %d",
+               WEXITSTATUS(status));
+    }
+    reason = buf;
+  }
+
+  w->pid = -1;
+  w->state = kWorkerDead;
+  w->deadline = 0.0;
+
+  return reason;
+}
+
+} // namespace
+
+bool runWorkerPool(const WorkerConfig &config,
+                   const std::vector<CompileJob> &jobs,
+                   std::vector<CompileResult> *results) {
+  results->clear();
+  results->resize(jobs.size());
+
+  if (jobs.empty()) {
+    return true;
+  }
+
+  // Do not die when writing to a crashed worker.
+  signal(SIGPIPE, SIG_IGN);
+
+  int numWorkers = config.numWorkers;
+  if (numWorkers < 1) {
+    numWorkers = 1;
+  }
+  if (numWorkers > int(jobs.size())) {
+    numWorkers = int(jobs.size());
+  }
+
+  std::vector<Worker> workers(numWorkers);
+  for (size_t i = 0; i < workers.size(); i++) {
+    if (!spawnWorker(workers, i, config)) {
+      std::cerr << "[oclc] Failed to spawn worker process." << std::endl;
+    }
+  }
+
+  std::deque<size_t> pending;
+  for (size_t i = 0; i < jobs.size(); i++) {
+    pending.push_back(i);
+  }
+
+  size_t numDone = 0;
+  int numStartupFailures = 0;
+  bool anyWorkerReady = false;
+
+  // Respawns a dead worker. Gives up when no worker could ever start(e.g. no
+  // OpenCL device), so that we don't fork forever.
+  const int maxStartupFailures = 2 * numWorkers;
+
+  while (numDone < jobs.size()) {
+
+    if (!anyWorkerReady && numStartupFailures >= maxStartupFailures) {
+      while (!pending.empty()) {
+        CompileResult &result = (*results)[pending.front()];
+        result.success = false;
+        result.log = "[oclc] Worker process failed to initialize.\n";
+        pending.pop_front();
+        numDone++;
+      }
+      break;
+    }
+
+    // Dispatch jobs to idle workers and restart dead ones.
+    for (size_t i = 0; i < workers.size(); i++) {
+      Worker &w = workers[i];
+      if (w.state == kWorkerDead && !pending.empty()) {
+        spawnWorker(workers, i, config);
+      }
+      if (w.state == kWorkerIdle && !pending.empty()) {
+        size_t jobIndex = pending.front();
+        MessageWriter msg;
+        msg.putString(jobs[jobIndex].input);
+        msg.putString(jobs[jobIndex].moduleFile);
+        msg.putString(jobs[jobIndex].depFile);
+        msg.putU32((unsigned int)jobs[jobIndex].deviceID);
+        if (!sendMessage(w.jobFd, msg.data())) {
+          // Worker died while idle. The job was not started, so retry it.
+          reapWorker(&w, true);
+          continue;
+        }
+        pending.pop_front();
+        w.state = kWorkerBusy;
+        w.jobIndex = jobIndex;
+        w.deadline =
+            (config.timeoutSec > 0.0) ? (now() + config.timeoutSec) : 0.0;
+      }
+    }
+
+    std::vector<struct pollfd> fds;
+    std::vector<size_t> fdWorkers;
+    double t = now();
+    int timeoutMs = -1;
+    for (size_t i = 0; i < workers.size(); i++) {
+      const Worker &w = workers[i];
+      if (w.state != kWorkerStarting && w.state != kWorkerBusy) {
+        continue;
+      }
+      struct pollfd pfd;
+      pfd.fd = w.resultFd;
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+      fds.push_back(pfd);
+      fdWorkers.push_back(i);
+
+      if (w.deadline > 0.0) {
+        int ms = int((w.deadline - t) * 1000.0) + 1;
+        if (ms < 0) {
+          ms = 0;
+        }
+        if (timeoutMs < 0 || ms < timeoutMs) {
+          timeoutMs = ms;
+        }
+      }
+    }
+
+    if (fds.empty()) {
+      if (pending.empty()) {
+        break; // Should not happen.
+      }
+      // All workers are dead and could not be respawned.
+      numStartupFailures++;
+      continue;
+    }
+
+    int ret = poll(&fds.at(0), fds.size(), timeoutMs);
+    if (ret < 0 && errno != EINTR) {
+      perror("poll");
+      break;
+    }
+
+    t = now();
+    for (size_t k = 0; k < fds.size(); k++) {
+      Worker &w = workers[fdWorkers[k]];
+
+      if (fds[k].revents != 0) {
+        std::string msg;
+        unsigned int type = 0;
+        MessageReader r(msg);
+        bool ok = recvMessage(w.resultFd, &msg) && r.getU32(&type);
+
+        if (ok && type == kMessageReady && w.state == kWorkerStarting) {
+          w.state = kWorkerIdle;
+          w.deadline = 0.0;
+          anyWorkerReady = true;
+          continue;
+        }
+
+        if (ok && type == kMessageResult && w.state == kWorkerBusy) {
+          CompileResult &result = (*results)[w.jobIndex];
+          unsigned int success = 0;
+          unsigned int cached = 0;
+          unsigned int usec = 0;
+          if (r.getU32(&success) && r.getU32(&cached) && r.getU32(&usec) &&
+              r.getString(&result.log)) {
+            result.success = (success != 0);
+            result.cached = (cached != 0);
+            result.msec = usec / 1000.0;
+            numDone++;
+            w.state = kWorkerIdle;
+            w.deadline = 0.0;
+            continue;
+          }
+        }
+
+        // EOF or broken message: the worker crashed.
+        WorkerState state = w.state;
+        size_t jobIndex = w.jobIndex;
+        std::string reason = reapWorker(&w, true);
+        if (state == kWorkerBusy) {
+          CompileResult &result = (*results)[jobIndex];
+          result.success = false;
+          result.log +=
+              "[oclc] Worker process crashed(" + reason + ") while compiling " +
+              jobs[jobIndex].input + "\n";
+          numDone++;
+        } else {
+          numStartupFailures++;
+        }
+        continue;
+      }
+
+      if (w.deadline > 0.0 && t >= w.deadline) {
+        WorkerState state = w.state;
+        size_t jobIndex = w.jobIndex;
+        reapWorker(&w, true);
+        if (state == kWorkerBusy) {
+          char buf[64];
+          snprintf(buf, sizeof(buf), "%.1f", config.timeoutSec);
+          CompileResult &result = (*results)[jobIndex];
+          result.success = false;
+          result.log = "[oclc] Compile timed out after " + std::string(buf) +
+                       " sec: " + jobs[jobIndex].input + "\n";
+          numDone++;
+        } else {
+          numStartupFailures++;
+        }
+      }
+    }
+  }
+
+  // Shutdown. Closing the job pipe makes the worker exit.
+  for (size_t i = 0; i < workers.size(); i++) {
+    Worker &w = workers[i];
+    if (w.state == kWorkerIdle) {
+      reapWorker(&w, false);
+    } else if (w.state != kWorkerDead) {
+      reapWorker(&w, true);
+    }
+  }
+
+  return (numDone == jobs.size());
+}
+
+#else
+
+bool runWorkerPool(const WorkerConfig &config,
+                   const std::vector<CompileJob> &jobs,
+                   std::vector<CompileResult> *results) {
+  (void)config;
+  (void)jobs;
+  (void)results;
+  std::cerr << "[oclc] Worker processes are not supported on this platform."
+            << std::endl;
+  return false;
+}
+
+#endif
+
+} // namespace oclc
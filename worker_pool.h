@@ -0,0 +1,39 @@
+//
+// Process-isolated compile worker pool(POSIX only).
+//
+#ifndef OCLC_WORKER_POOL_H
+#define OCLC_WORKER_POOL_H
+
+#include <vector>
+
+#include "compile_job.h"
+
+namespace oclc {
+
+struct WorkerConfig {
+  int numWorkers;
+  int platformID;
+  int deviceID;
+  double timeoutSec; // Wall clock timeout per job. <= 0 means no timeout.
+  CompileOptions options;
+
+  WorkerConfig()
+      : numWorkers(1), platformID(0), deviceID(0), timeoutSec(0.0) {}
+};
+
+//  Function: runWorkerPool
+//  Compiles `jobs` with `config.numWorkers` forked worker processes.
+//  Each worker calls clewInit() and creates its own OpenCL context, so
+//  builds run truly in parallel even when the driver serializes
+//  clBuildProgram within a process. A worker which crashed or exceeded the
+//  timeout is killed and replaced, and only its job is reported as failed.
+//  The caller must not call clewInit() before this function(the OpenCL
+//  runtime is not fork-safe).
+//  `results` is filled in the same order as `jobs`.
+bool runWorkerPool(const WorkerConfig &config,
+                   const std::vector<CompileJob> &jobs,
+                   std::vector<CompileResult> *results);
+
+} // namespace oclc
+
+#endif // OCLC_WORKER_POOL_H